@@ -0,0 +1,874 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_MAX_LIST_NUM (32)
+#define BENCH_MAX_TRIAL_NUM (100)
+
+/* How often the main thread checks whether the consumers are done */
+#define BENCH_POLL_NS (100000)
+
+#define BENCH_FORMAT_JSON (0)
+#define BENCH_FORMAT_CSV (1)
+
+/*
+ * bench_worker - One producer or consumer thread of a trial
+ * @thread: the thread
+ * @trial: trial it belongs to
+ * @cpu_idx: index used to pin the thread
+ * @start_tsc: when a producer started enqueueing
+ * @last_tsc: when a consumer took its last item
+ * @consumed_cnt: items taken so far, consumers only, polled by the main thread
+ * @hist: latency samples seen by this consumer
+ * @perf: counters of this thread while it runs the workload
+ * @perf_values: their values once stopped
+ * @perf_valid: which of them could be read
+ *
+ * The trial is timed from the earliest producer start to the latest consumed
+ * item, so that waking the main thread does not show up in the throughput.
+ */
+struct bench_worker {
+	pthread_t thread;
+	struct bench_trial *trial;
+	int cpu_idx;
+	uint64_t start_tsc;
+	uint64_t last_tsc;
+	_Atomic uint64_t consumed_cnt;
+	struct bench_hist *hist;
+	struct bench_perf perf;
+	uint64_t perf_values[BENCH_PERF_COUNTER_NUM];
+	bool perf_valid[BENCH_PERF_COUNTER_NUM];
+} __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+
+/*
+ * bench_trial - One run of a queue with fresh threads
+ * @ops: queue under test
+ * @config: point of the matrix
+ * @queue: queue created for this trial
+ * @barrier: releases all threads and the timer at once
+ * @done: set once every item has been consumed
+ * @producers: producer_num workers
+ * @consumers: consumer_num workers
+ */
+struct bench_trial {
+	const struct bench_queue_ops *ops;
+	const struct bench_config *config;
+	void *queue;
+	pthread_barrier_t barrier;
+	_Atomic bool done;
+	struct bench_worker producers[BENCH_MAX_THREAD_NUM];
+	struct bench_worker consumers[BENCH_MAX_THREAD_NUM];
+};
+
+/*
+ * bench_result - Summary of the trials of one point of the matrix
+ * @p99_ns: latency p99 of each timed trial, for comparisons across runs
+ * @item_cnt: items transferred over all timed trials
+ * @perf_sum: counters summed over every thread of every timed trial
+ * @perf_valid: counters that every thread could read
+ * @detach_fail_cnt: batch detaches lost to another dequeue thread over all
+ * timed trials, -1 if the queue cannot tell
+ *
+ * Counters are reported per item, which covers its enqueue, its dequeue and
+ * whatever the threads spent polling or spinning around them.
+ */
+struct bench_result {
+	const char *queue_name;
+	const struct bench_config *config;
+	int trial_num;
+	double mops[BENCH_MAX_TRIAL_NUM];
+	double mops_mean;
+	double mops_stddev;
+	double mops_min;
+	double mops_median;
+	double mops_max;
+	uint64_t p99_ns[BENCH_MAX_TRIAL_NUM];
+	struct bench_hist hist;
+	uint64_t item_cnt;
+	uint64_t perf_sum[BENCH_PERF_COUNTER_NUM];
+	bool perf_valid[BENCH_PERF_COUNTER_NUM];
+	int64_t detach_fail_cnt;
+};
+
+/*
+ * bench_options - Command line
+ */
+struct bench_options {
+	const char *queue_names[BENCH_MAX_LIST_NUM];
+	int queue_name_num;
+	int producer_nums[BENCH_MAX_LIST_NUM];
+	int producer_num_cnt;
+	int consumer_nums[BENCH_MAX_LIST_NUM];
+	int consumer_num_cnt;
+	int payloads[BENCH_MAX_LIST_NUM];
+	int payload_cnt;
+	struct bench_config config;
+	int format;
+	bool perf;
+	uint64_t perf_hitm_config;
+	int cpu_num;
+	int cpu_quota_pct;
+	const char *label;
+	const char *relaxed_lib;
+	const char *linearizable_lib;
+};
+
+static const char *bench_payload_name(int payload)
+{
+	return (payload == BENCH_PAYLOAD_PTR) ? "ptr" : "scalar";
+}
+
+/*
+ * Pin, open the counters and wait for the others. Opening happens before the
+ * barrier so that its syscalls are not timed.
+ */
+static void bench_worker_begin(struct bench_worker *worker)
+{
+	if (worker->trial->config->pin) {
+		bench_pin_thread(worker->cpu_idx);
+	}
+
+	bench_perf_open(&worker->perf);
+	pthread_barrier_wait(&worker->trial->barrier);
+	bench_perf_start(&worker->perf);
+}
+
+static void bench_worker_end(struct bench_worker *worker)
+{
+	bench_perf_stop(&worker->perf, worker->perf_values, worker->perf_valid);
+}
+
+/*
+ * Items carry their latency stamp in the datum itself (scalar payload) or in
+ * the first 8 bytes of the buffer (pointer payload). A scalar datum with the
+ * low bit set is stamped, the others carry a sequence number.
+ */
+static void *bench_producer(void *arg)
+{
+	struct bench_worker *worker = arg;
+	struct bench_trial *trial = worker->trial;
+	const struct bench_config *config = trial->config;
+	uint64_t datum, stamp;
+	uint64_t *buf;
+	int spin_cnt;
+
+	bench_worker_begin(worker);
+	worker->start_tsc = bench_rdtsc();
+
+	for (uint64_t i = 0; i < config->op_num; i++) {
+		stamp = 0;
+		if (config->latency_sample != 0 &&
+				i % (uint64_t)config->latency_sample == 0) {
+			stamp = bench_rdtsc();
+		}
+
+		if (config->payload == BENCH_PAYLOAD_PTR) {
+			buf = malloc(config->payload_size);
+			memset(buf, (int)i, config->payload_size);
+			buf[0] = stamp;
+			datum = (uint64_t)(uintptr_t)buf;
+		} else {
+			datum = (stamp != 0) ? (stamp << 1) | 1 : i << 1;
+		}
+
+		spin_cnt = 0;
+		while (!trial->ops->enqueue(trial->queue, datum)) {
+			bench_backoff(&spin_cnt);
+		}
+	}
+
+	bench_worker_end(worker);
+
+	return NULL;
+}
+
+static void *bench_consumer(void *arg)
+{
+	struct bench_worker *worker = arg;
+	struct bench_trial *trial = worker->trial;
+	const struct bench_config *config = trial->config;
+	uint64_t datum, stamp, consumed_cnt = 0;
+	volatile uint64_t sink = 0;
+	uint64_t *buf;
+	int spin_cnt = 0;
+
+	bench_worker_begin(worker);
+
+	while (!atomic_load_explicit(&trial->done, memory_order_relaxed)) {
+		if (!trial->ops->dequeue(trial->queue, &datum)) {
+			bench_backoff(&spin_cnt);
+			continue;
+		}
+
+		spin_cnt = 0;
+		worker->last_tsc = bench_rdtsc();
+
+		if (config->payload == BENCH_PAYLOAD_PTR) {
+			buf = (uint64_t *)(uintptr_t)datum;
+			stamp = buf[0];
+			sink += ((uint8_t *)buf)[config->payload_size - 1];
+			free(buf);
+		} else {
+			stamp = (datum & 1) ? datum >> 1 : 0;
+		}
+
+		if (stamp != 0) {
+			bench_hist_record(worker->hist, worker->last_tsc - stamp);
+		}
+
+		atomic_store_explicit(&worker->consumed_cnt, ++consumed_cnt,
+			memory_order_relaxed);
+	}
+
+	bench_worker_end(worker);
+	(void)sink;
+
+	return NULL;
+}
+
+/*
+ * Fold the counters of one worker into the result.
+ */
+static void bench_add_perf(struct bench_result *result,
+	const struct bench_worker *worker)
+{
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		result->perf_sum[i] += worker->perf_values[i];
+		result->perf_valid[i] &= worker->perf_valid[i];
+	}
+}
+
+/*
+ * Add the detaches the trial's queue lost, before it is destroyed. Unknown in
+ * one trial makes the whole result unknown.
+ */
+static void bench_add_detach_fails(struct bench_result *result,
+	const struct bench_queue_ops *ops, void *queue)
+{
+	int64_t fail_cnt;
+
+	if (result->detach_fail_cnt < 0) {
+		return;
+	}
+
+	fail_cnt = ops->detach_fails(queue);
+	result->detach_fail_cnt = (fail_cnt < 0) ? -1
+		: result->detach_fail_cnt + fail_cnt;
+}
+
+static uint64_t bench_latency_ns(const struct bench_hist *hist,
+	double percentile)
+{
+	return (uint64_t)((double)bench_hist_percentile(hist, percentile)
+		/ bench_tsc_per_ns());
+}
+
+/*
+ * Run one trial and return its throughput in million items per second, or a
+ * negative value on failure. Latency samples and counters are added to
+ * @result unless it is NULL.
+ */
+static double bench_run_trial(const struct bench_queue_ops *ops,
+	const struct bench_config *config, struct bench_result *result,
+	int trial_idx)
+{
+	struct bench_trial *trial = NULL;
+	struct bench_hist *trial_hist;
+	uint64_t target = config->op_num * (uint64_t)config->producer_num;
+	uint64_t consumed_cnt, start_tsc = UINT64_MAX, end_tsc = 0;
+	struct timespec poll = { 0, BENCH_POLL_NS };
+	int thread_num = config->producer_num + config->consumer_num;
+	double mops;
+
+	trial = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct bench_trial));
+	if (trial == NULL) {
+		return -1.0;
+	}
+
+	trial_hist = calloc(1, sizeof(struct bench_hist));
+	if (trial_hist == NULL) {
+		free(trial);
+		return -1.0;
+	}
+
+	memset(trial, 0, sizeof(struct bench_trial));
+	trial->ops = ops;
+	trial->config = config;
+	trial->queue = ops->init(config);
+
+	if (trial->queue == NULL) {
+		fprintf(stderr, "bench: %s init failed\n", ops->name);
+		free(trial_hist);
+		free(trial);
+		return -1.0;
+	}
+
+	pthread_barrier_init(&trial->barrier, NULL, (unsigned)thread_num + 1);
+
+	/* Producers and consumers alternate over the cpus */
+	for (int i = 0; i < config->consumer_num; i++) {
+		trial->consumers[i].trial = trial;
+		trial->consumers[i].cpu_idx = 2 * i + 1;
+		trial->consumers[i].hist = calloc(1, sizeof(struct bench_hist));
+		pthread_create(&trial->consumers[i].thread, NULL, bench_consumer,
+			&trial->consumers[i]);
+	}
+
+	for (int i = 0; i < config->producer_num; i++) {
+		trial->producers[i].trial = trial;
+		trial->producers[i].cpu_idx = 2 * i;
+		pthread_create(&trial->producers[i].thread, NULL, bench_producer,
+			&trial->producers[i]);
+	}
+
+	pthread_barrier_wait(&trial->barrier);
+
+	do {
+		nanosleep(&poll, NULL);
+
+		consumed_cnt = 0;
+		for (int i = 0; i < config->consumer_num; i++) {
+			consumed_cnt += atomic_load_explicit(
+				&trial->consumers[i].consumed_cnt, memory_order_relaxed);
+		}
+	} while (consumed_cnt < target);
+
+	atomic_store(&trial->done, true);
+
+	for (int i = 0; i < config->producer_num; i++) {
+		pthread_join(trial->producers[i].thread, NULL);
+
+		if (trial->producers[i].start_tsc < start_tsc) {
+			start_tsc = trial->producers[i].start_tsc;
+		}
+
+		if (result != NULL) {
+			bench_add_perf(result, &trial->producers[i]);
+		}
+	}
+
+	for (int i = 0; i < config->consumer_num; i++) {
+		pthread_join(trial->consumers[i].thread, NULL);
+
+		if (trial->consumers[i].last_tsc > end_tsc) {
+			end_tsc = trial->consumers[i].last_tsc;
+		}
+
+		if (result != NULL) {
+			bench_hist_merge(trial_hist, trial->consumers[i].hist);
+			bench_add_perf(result, &trial->consumers[i]);
+		}
+		free(trial->consumers[i].hist);
+	}
+
+	if (result != NULL) {
+		bench_hist_merge(&result->hist, trial_hist);
+		result->p99_ns[trial_idx] = bench_latency_ns(trial_hist, 0.99);
+		result->item_cnt += target;
+		bench_add_detach_fails(result, ops, trial->queue);
+	}
+
+	mops = (double)target * bench_tsc_per_ns()
+		/ (double)(end_tsc - start_tsc) * 1000.0;
+
+	pthread_barrier_destroy(&trial->barrier);
+	ops->destroy(trial->queue);
+	free(trial_hist);
+	free(trial);
+
+	return mops;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Warm up, run the timed trials and summarize them. Returns false if a trial
+ * failed.
+ */
+static bool bench_run(const struct bench_queue_ops *ops,
+	const struct bench_config *config, struct bench_result *result)
+{
+	double sorted[BENCH_MAX_TRIAL_NUM], sum = 0.0, sq_sum = 0.0;
+	int n = config->trial_num;
+
+	memset(result, 0, sizeof(struct bench_result));
+	result->queue_name = ops->name;
+	result->config = config;
+	result->trial_num = n;
+	result->detach_fail_cnt = (ops->detach_fails != NULL) ? 0 : -1;
+
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		result->perf_valid[i] = true;
+	}
+
+	for (int i = 0; i < config->warmup_num; i++) {
+		if (bench_run_trial(ops, config, NULL, i) < 0.0) {
+			return false;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		result->mops[i] = bench_run_trial(ops, config, result, i);
+		if (result->mops[i] < 0.0) {
+			return false;
+		}
+
+		sorted[i] = result->mops[i];
+		sum += result->mops[i];
+	}
+
+	qsort(sorted, (size_t)n, sizeof(double), bench_cmp_double);
+
+	result->mops_mean = sum / n;
+	for (int i = 0; i < n; i++) {
+		sq_sum += (result->mops[i] - result->mops_mean)
+			* (result->mops[i] - result->mops_mean);
+	}
+
+	result->mops_stddev = (n > 1) ? sqrt(sq_sum / (n - 1)) : 0.0;
+	result->mops_min = sorted[0];
+	result->mops_max = sorted[n - 1];
+	result->mops_median = (n % 2) ? sorted[n / 2]
+		: (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+
+	return true;
+}
+
+static double bench_perf_per_item(const struct bench_result *result,
+	int counter)
+{
+	return (double)result->perf_sum[counter] / (double)result->item_cnt;
+}
+
+static void bench_print_header(const struct bench_options *options)
+{
+	const struct bench_config *config = &options->config;
+
+	if (options->format == BENCH_FORMAT_CSV) {
+		printf("label,queue,producers,consumers,payload,payload_size,ops,trials,"
+			"mops_mean,mops_stddev,mops_min,mops_median,mops_max,"
+			"lat_samples,lat_p50_ns,lat_p99_ns,lat_p999_ns,lat_max_ns");
+		for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+			printf(",%s_per_op", bench_perf_name(i));
+		}
+		printf(",detach_fails\n");
+		return;
+	}
+
+	printf("{\n  \"machine\": {\"cpus\": %ld, \"tsc_per_ns\": %.4f},\n",
+		sysconf(_SC_NPROCESSORS_ONLN), bench_tsc_per_ns());
+	printf("  \"settings\": {\"label\": \"%s\", \"ops\": %lu, \"warmup\": %d, "
+		"\"trials\": %d, \"latency_sample\": %d, \"pin\": %s, \"cpus\": %d, "
+		"\"cpu_quota_pct\": %d},\n",
+		options->label, config->op_num, config->warmup_num, config->trial_num,
+		config->latency_sample, config->pin ? "true" : "false",
+		options->cpu_num, options->cpu_quota_pct);
+	printf("  \"results\": [");
+}
+
+static void bench_print_result(const struct bench_options *options,
+	const struct bench_result *result, bool first)
+{
+	const struct bench_config *config = result->config;
+	const struct bench_hist *hist = &result->hist;
+
+	if (options->format == BENCH_FORMAT_CSV) {
+		printf("%s,%s,%d,%d,%s,%zu,%lu,%d,%.4f,%.4f,%.4f,%.4f,%.4f,"
+			"%lu,%lu,%lu,%lu,%lu",
+			options->label, result->queue_name, config->producer_num, config->consumer_num,
+			bench_payload_name(config->payload), config->payload_size,
+			config->op_num, result->trial_num, result->mops_mean,
+			result->mops_stddev, result->mops_min, result->mops_median,
+			result->mops_max, hist->cnt, bench_latency_ns(hist, 0.5),
+			bench_latency_ns(hist, 0.99), bench_latency_ns(hist, 0.999),
+			bench_latency_ns(hist, 1.0));
+
+		/* Unavailable counters are left empty */
+		for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+			if (result->perf_valid[i]) {
+				printf(",%.6f", bench_perf_per_item(result, i));
+			} else {
+				printf(",");
+			}
+		}
+
+		if (result->detach_fail_cnt >= 0) {
+			printf(",%ld", result->detach_fail_cnt);
+		} else {
+			printf(",");
+		}
+		printf("\n");
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"queue\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+		"\"payload\": \"%s\", \"payload_size\": %zu,\n",
+		first ? "" : ",", result->queue_name, config->producer_num,
+		config->consumer_num, bench_payload_name(config->payload),
+		config->payload_size);
+
+	printf("     \"trials_mops\": [");
+	for (int i = 0; i < result->trial_num; i++) {
+		printf("%s%.4f", (i == 0) ? "" : ", ", result->mops[i]);
+	}
+	printf("],\n");
+
+	/* Zero when latency sampling is off */
+	printf("     \"trials_p99_ns\": [");
+	for (int i = 0; i < result->trial_num; i++) {
+		printf("%s%lu", (i == 0) ? "" : ", ", result->p99_ns[i]);
+	}
+	printf("],\n");
+
+	printf("     \"throughput_mops\": {\"mean\": %.4f, \"stddev\": %.4f, "
+		"\"min\": %.4f, \"median\": %.4f, \"max\": %.4f},\n",
+		result->mops_mean, result->mops_stddev, result->mops_min,
+		result->mops_median, result->mops_max);
+
+	printf("     \"latency_ns\": {\"samples\": %lu, \"p50\": %lu, "
+		"\"p99\": %lu, \"p999\": %lu, \"max\": %lu},\n",
+		hist->cnt, bench_latency_ns(hist, 0.5), bench_latency_ns(hist, 0.99),
+		bench_latency_ns(hist, 0.999), bench_latency_ns(hist, 1.0));
+
+	/* Summed over the timed trials, null if the queue cannot tell */
+	if (result->detach_fail_cnt >= 0) {
+		printf("     \"detach_fails\": %ld,\n", result->detach_fail_cnt);
+	} else {
+		printf("     \"detach_fails\": null,\n");
+	}
+
+	/* Unavailable counters are null */
+	printf("     \"perf_per_op\": {");
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		printf("%s\"%s\": ", (i == 0) ? "" : ", ", bench_perf_name(i));
+		if (result->perf_valid[i]) {
+			printf("%.6f", bench_perf_per_item(result, i));
+		} else {
+			printf("null");
+		}
+	}
+	printf("}}");
+	fflush(stdout);
+}
+
+static void bench_print_footer(const struct bench_options *options)
+{
+	if (options->format == BENCH_FORMAT_JSON) {
+		printf("\n  ]\n}\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --queues a,b,...     queues to run (default: all), --list shows them\n"
+		"  --producers 1,2,...  producer counts (default 1,2,4)\n"
+		"  --consumers 1,2,...  consumer counts (default 1,2,4)\n"
+		"  --payload scalar,ptr payload patterns (default scalar,ptr)\n"
+		"  --payload-size N     bytes per ptr item (default 64)\n"
+		"  --ops N              items per producer per trial (default 1000000)\n"
+		"  --warmup N           untimed trials (default 1)\n"
+		"  --trials N           timed trials (default 5)\n"
+		"  --latency-sample N   stamp every N'th item, 0 = off (default 64)\n"
+		"  --no-pin             do not pin threads\n"
+		"  --no-perf            do not collect perf_event counters\n"
+		"  --perf-hitm CONFIG   raw event config counting HITM loads, e.g.\n"
+		"                       0x04d2 on Skylake (default: not counted)\n"
+		"  --cpus N             run on the first N cpus only, to oversubscribe\n"
+		"  --cpu-quota PCT      run in a cgroup limited to PCT%% of one cpu\n"
+		"  --label STR          tag the results, e.g. with the library variant\n"
+		"  --format json|csv    output format (default json)\n"
+		"  --lib PATH           relaxed library (default ../libscq.so)\n"
+		"  --lin-lib PATH       linearizable library "
+		"(default ../linearizable/libscq.so)\n", prog);
+}
+
+/*
+ * Split a comma separated list. Returns the number of items.
+ */
+static int bench_split(char *str, char **items, int max)
+{
+	int n = 0;
+
+	for (char *tok = strtok(str, ","); tok != NULL && n < max;
+			tok = strtok(NULL, ",")) {
+		items[n++] = tok;
+	}
+
+	return n;
+}
+
+static int bench_parse_ints(char *str, int *values)
+{
+	char *items[BENCH_MAX_LIST_NUM];
+	int n = bench_split(str, items, BENCH_MAX_LIST_NUM);
+
+	for (int i = 0; i < n; i++) {
+		values[i] = atoi(items[i]);
+		if (values[i] <= 0 || values[i] > BENCH_MAX_THREAD_NUM) {
+			fprintf(stderr, "bench: thread count out of range: %s\n",
+				items[i]);
+			exit(1);
+		}
+	}
+
+	return n;
+}
+
+static void bench_parse_options(int argc, char **argv,
+	struct bench_options *options, bool *list_only)
+{
+	static const struct option long_options[] = {
+		{ "queues", required_argument, NULL, 'q' },
+		{ "producers", required_argument, NULL, 'p' },
+		{ "consumers", required_argument, NULL, 'c' },
+		{ "payload", required_argument, NULL, 'P' },
+		{ "payload-size", required_argument, NULL, 's' },
+		{ "ops", required_argument, NULL, 'n' },
+		{ "warmup", required_argument, NULL, 'w' },
+		{ "trials", required_argument, NULL, 't' },
+		{ "latency-sample", required_argument, NULL, 'l' },
+		{ "no-pin", no_argument, NULL, 'N' },
+		{ "no-perf", no_argument, NULL, 'R' },
+		{ "perf-hitm", required_argument, NULL, 'H' },
+		{ "cpus", required_argument, NULL, 'C' },
+		{ "cpu-quota", required_argument, NULL, 'Q' },
+		{ "label", required_argument, NULL, 'B' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "lib", required_argument, NULL, 'L' },
+		{ "lin-lib", required_argument, NULL, 'I' },
+		{ "list", no_argument, NULL, 'x' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	char *items[BENCH_MAX_LIST_NUM];
+	int opt, n;
+
+	memset(options, 0, sizeof(struct bench_options));
+	options->config.payload_size = 64;
+	options->config.op_num = 1000000;
+	options->config.warmup_num = 1;
+	options->config.trial_num = 5;
+	options->config.latency_sample = 64;
+	options->config.pin = true;
+	options->format = BENCH_FORMAT_JSON;
+	options->perf = true;
+	options->label = "default";
+	options->relaxed_lib = "../libscq.so";
+	options->linearizable_lib = "../linearizable/libscq.so";
+	*list_only = false;
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			options->queue_name_num = bench_split(optarg,
+				(char **)options->queue_names, BENCH_MAX_LIST_NUM);
+			break;
+		case 'p':
+			options->producer_num_cnt = bench_parse_ints(optarg,
+				options->producer_nums);
+			break;
+		case 'c':
+			options->consumer_num_cnt = bench_parse_ints(optarg,
+				options->consumer_nums);
+			break;
+		case 'P':
+			n = bench_split(optarg, items, BENCH_MAX_LIST_NUM);
+			options->payload_cnt = n;
+			for (int i = 0; i < n; i++) {
+				options->payloads[i] = (strcmp(items[i], "ptr") == 0) ?
+					BENCH_PAYLOAD_PTR : BENCH_PAYLOAD_SCALAR;
+			}
+			break;
+		case 's':
+			options->config.payload_size = (size_t)atol(optarg);
+			if (options->config.payload_size < sizeof(uint64_t)) {
+				options->config.payload_size = sizeof(uint64_t);
+			}
+			break;
+		case 'n':
+			options->config.op_num = (uint64_t)atoll(optarg);
+			break;
+		case 'w':
+			options->config.warmup_num = atoi(optarg);
+			break;
+		case 't':
+			options->config.trial_num = atoi(optarg);
+			break;
+		case 'l':
+			options->config.latency_sample = atoi(optarg);
+			break;
+		case 'N':
+			options->config.pin = false;
+			break;
+		case 'R':
+			options->perf = false;
+			break;
+		case 'H':
+			options->perf_hitm_config = strtoull(optarg, NULL, 0);
+			break;
+		case 'C':
+			options->cpu_num = atoi(optarg);
+			break;
+		case 'Q':
+			options->cpu_quota_pct = atoi(optarg);
+			break;
+		case 'B':
+			options->label = optarg;
+			break;
+		case 'f':
+			options->format = (strcmp(optarg, "csv") == 0) ?
+				BENCH_FORMAT_CSV : BENCH_FORMAT_JSON;
+			break;
+		case 'L':
+			options->relaxed_lib = optarg;
+			break;
+		case 'I':
+			options->linearizable_lib = optarg;
+			break;
+		case 'x':
+			*list_only = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (options->config.trial_num < 1 ||
+			options->config.trial_num > BENCH_MAX_TRIAL_NUM) {
+		fprintf(stderr, "bench: trials must be 1..%d\n", BENCH_MAX_TRIAL_NUM);
+		exit(1);
+	}
+
+	if (options->producer_num_cnt == 0) {
+		options->producer_nums[0] = 1;
+		options->producer_nums[1] = 2;
+		options->producer_nums[2] = 4;
+		options->producer_num_cnt = 3;
+	}
+
+	if (options->consumer_num_cnt == 0) {
+		options->consumer_nums[0] = 1;
+		options->consumer_nums[1] = 2;
+		options->consumer_nums[2] = 4;
+		options->consumer_num_cnt = 3;
+	}
+
+	if (options->payload_cnt == 0) {
+		options->payloads[0] = BENCH_PAYLOAD_SCALAR;
+		options->payloads[1] = BENCH_PAYLOAD_PTR;
+		options->payload_cnt = 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const struct bench_queue_ops *queues[BENCH_MAX_LIST_NUM];
+	struct bench_options options;
+	struct bench_result *result = NULL;
+	struct bench_config config;
+	int queue_num = 0;
+	bool list_only, first = true;
+
+	bench_parse_options(argc, argv, &options, &list_only);
+	bench_perf_setup(options.perf, options.perf_hitm_config);
+	bench_queue_register(options.relaxed_lib, options.linearizable_lib);
+
+	if (list_only) {
+		for (int i = 0; i < bench_queue_num(); i++) {
+			printf("%s\n", bench_queue_get(i)->name);
+		}
+		return 0;
+	}
+
+	if (options.queue_name_num == 0) {
+		for (int i = 0; i < bench_queue_num() && i < BENCH_MAX_LIST_NUM; i++) {
+			queues[queue_num++] = bench_queue_get(i);
+		}
+	} else {
+		for (int i = 0; i < options.queue_name_num; i++) {
+			queues[queue_num] = bench_queue_find(options.queue_names[i]);
+			if (queues[queue_num] == NULL) {
+				fprintf(stderr, "bench: unknown queue %s\n",
+					options.queue_names[i]);
+				return 1;
+			}
+			queue_num++;
+		}
+	}
+
+	result = malloc(sizeof(struct bench_result));
+	if (result == NULL) {
+		return 1;
+	}
+
+	/* Threads inherit the restricted mask, so do this before creating any */
+	if (options.cpu_num > 0) {
+		options.cpu_num = bench_restrict_cpus(options.cpu_num);
+		if (options.cpu_num < 0) {
+			return 1;
+		}
+	}
+
+	if (options.cpu_quota_pct > 0 &&
+			!bench_cgroup_enter(options.cpu_quota_pct)) {
+		fprintf(stderr, "bench: cpu quota unavailable, try "
+			"systemd-run --scope -p CPUQuota=%d%% instead\n",
+			options.cpu_quota_pct);
+		return 1;
+	}
+
+	bench_print_header(&options);
+
+	for (int q = 0; q < queue_num; q++) {
+		for (int p = 0; p < options.producer_num_cnt; p++) {
+			for (int c = 0; c < options.consumer_num_cnt; c++) {
+				for (int l = 0; l < options.payload_cnt; l++) {
+					config = options.config;
+					config.producer_num = options.producer_nums[p];
+					config.consumer_num = options.consumer_nums[c];
+					config.payload = options.payloads[l];
+
+					if (queues[q]->supports != NULL &&
+							!queues[q]->supports(config.producer_num,
+								config.consumer_num)) {
+						continue;
+					}
+
+					if (!bench_run(queues[q], &config, result)) {
+						fprintf(stderr, "bench: %s %dP/%dC failed\n",
+							queues[q]->name, config.producer_num,
+							config.consumer_num);
+						continue;
+					}
+
+					bench_print_result(&options, result, first);
+					first = false;
+				}
+			}
+		}
+	}
+
+	bench_print_footer(&options);
+	bench_cgroup_leave();
+	free(result);
+
+	return 0;
+}
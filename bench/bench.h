@@ -0,0 +1,186 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_MAX_THREAD_NUM (256)
+#define BENCH_CACHE_LINE_SIZE (64)
+
+/* Capacity of the bounded queues */
+#define BENCH_RING_CAPACITY (65536)
+
+/*
+ * Payload patterns. With SCALAR the datum itself is the payload. With PTR each
+ * item is a malloc'd buffer of payload_size bytes that the producer fills and
+ * the consumer reads and frees, like a queue of work items.
+ */
+#define BENCH_PAYLOAD_SCALAR (0)
+#define BENCH_PAYLOAD_PTR (1)
+
+/*
+ * bench_config - One point of the benchmark matrix
+ * @producer_num: number of enqueue threads
+ * @consumer_num: number of dequeue threads
+ * @payload: BENCH_PAYLOAD_*
+ * @payload_size: bytes per item with BENCH_PAYLOAD_PTR
+ * @op_num: items each producer enqueues per trial
+ * @warmup_num: untimed trials run first
+ * @trial_num: timed trials
+ * @latency_sample: every this many'th item is stamped for latency, 0 for none
+ * @pin: pin threads to cpus round-robin
+ */
+struct bench_config {
+	int producer_num;
+	int consumer_num;
+	int payload;
+	size_t payload_size;
+	uint64_t op_num;
+	int warmup_num;
+	int trial_num;
+	int latency_sample;
+	bool pin;
+};
+
+/*
+ * bench_queue_ops - A queue under test
+ * @name: name used on the command line and in the results
+ * @supports: whether the queue can run with the given thread counts, NULL if
+ * any count is fine
+ * @init: create a queue for one trial, NULL on failure
+ * @destroy: destroy it, items still queued are discarded
+ * @enqueue: false if the queue is full and the item must be retried
+ * @dequeue: false if nothing was found
+ * @held_nodes: nodes the queue allocated that hold no item, i.e. kept for
+ * reuse or not yet given back, -1 if unknown; NULL if the queue cannot tell
+ * @detach_fails: batch detaches a dequeue thread lost to another one so far,
+ * -1 if unknown; NULL if the queue cannot tell
+ *
+ * Each trial creates a fresh queue and fresh threads, so that per-thread state
+ * of one trial does not leak into the next.
+ */
+struct bench_queue_ops {
+	const char *name;
+	bool (*supports)(int producer_num, int consumer_num);
+	void *(*init)(const struct bench_config *config);
+	void (*destroy)(void *queue);
+	bool (*enqueue)(void *queue, uint64_t datum);
+	bool (*dequeue)(void *queue, uint64_t *datum);
+	int64_t (*held_nodes)(void *queue);
+	int64_t (*detach_fails)(void *queue);
+};
+
+/*
+ * Register the queues of bench_queue.c and the baselines. The scalable_queue
+ * libraries are loaded with dlopen(RTLD_LOCAL), since both define the same
+ * symbols. Queues whose library cannot be loaded are skipped with a warning.
+ */
+void bench_queue_register(const char *relaxed_lib, const char *linearizable_lib);
+
+int bench_queue_num(void);
+const struct bench_queue_ops *bench_queue_get(int idx);
+const struct bench_queue_ops *bench_queue_find(const char *name);
+void bench_queue_add(const struct bench_queue_ops *ops);
+
+/*
+ * Baselines built into the harness, registered after the scalable_queue
+ * libraries so that every run has the same reference points.
+ */
+extern const struct bench_queue_ops bench_ms_queue_ops;
+extern const struct bench_queue_ops bench_mutex_queue_ops;
+extern const struct bench_queue_ops bench_vyukov_ring_ops;
+extern const struct bench_queue_ops bench_faa_array_queue_ops;
+
+/*
+ * Latency histogram with 8 log-linear buckets per power of two, in TSC cycles.
+ */
+#define BENCH_HIST_SUB_BUCKET_NUM (8)
+#define BENCH_HIST_BUCKET_NUM (62 * BENCH_HIST_SUB_BUCKET_NUM)
+
+struct bench_hist {
+	uint64_t cnt;
+	uint64_t max;
+	uint64_t bucket_cnt[BENCH_HIST_BUCKET_NUM];
+};
+
+void bench_hist_record(struct bench_hist *hist, uint64_t value);
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src);
+uint64_t bench_hist_percentile(const struct bench_hist *hist, double percentile);
+
+static inline uint64_t bench_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * Waits for the preceding instructions to finish, so that a short region
+ * timed with two of these does not leak into its neighbours.
+ */
+static inline uint64_t bench_rdtscp(void)
+{
+	uint32_t lo, hi, aux;
+
+	__asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux) :: "memory");
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t bench_now_ns(void);
+
+/* TSC cycles per nanosecond, measured once */
+double bench_tsc_per_ns(void);
+
+/*
+ * Spin for a while, then give the cpu away. Used by the harness on full and
+ * empty queues, so that oversubscribed runs make progress.
+ */
+void bench_backoff(int *spin_cnt);
+
+/* Pin the calling thread to the idx'th cpu of the process's affinity mask */
+void bench_pin_thread(int idx);
+
+/*
+ * Oversubscription scenarios. bench_restrict_cpus() keeps the first cpu_num
+ * cpus of the affinity mask for the threads created afterwards and returns the
+ * number of cpus left. bench_cgroup_enter() moves the process into a new
+ * cgroup v2 limited to quota_pct percent of one cpu, which needs a delegated
+ * cgroup with the cpu controller; false if that is not possible.
+ */
+int bench_restrict_cpus(int cpu_num);
+bool bench_cgroup_enter(int quota_pct);
+void bench_cgroup_leave(void);
+
+/*
+ * Per-thread perf_event_open(2) counters. HITM has no generic encoding, so it
+ * is only counted when a raw event config is given. Context switches are taken
+ * from getrusage(RUSAGE_THREAD) instead.
+ */
+#define BENCH_PERF_CYCLES (0)
+#define BENCH_PERF_INSTRUCTIONS (1)
+#define BENCH_PERF_LLC_MISSES (2)
+#define BENCH_PERF_HITM (3)
+#define BENCH_PERF_CONTEXT_SWITCHES (4)
+#define BENCH_PERF_COUNTER_NUM (5)
+
+/*
+ * bench_perf - Counters of one thread
+ * @fd: perf_event_open(2) descriptors, -1 if not counted
+ * @csw_start: voluntary and involuntary context switches at start
+ */
+struct bench_perf {
+	int fd[BENCH_PERF_COUNTER_NUM];
+	uint64_t csw_start;
+};
+
+void bench_perf_setup(bool enable, uint64_t hitm_raw_config);
+const char *bench_perf_name(int counter);
+void bench_perf_open(struct bench_perf *perf);
+void bench_perf_start(struct bench_perf *perf);
+void bench_perf_stop(struct bench_perf *perf, uint64_t *values, bool *valid);
+
+#endif /* BENCH_H */
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Per-thread counters through perf_event_open(2). Each counter is opened on
+ * its own rather than as a group, so that a counter the cpu or the kernel
+ * does not offer only drops that column. User space only is counted, which
+ * perf_event_paranoid <= 2 allows without privileges.
+ *
+ * Context switches happen in the kernel, so the software event would always
+ * read 0 there. They come from getrusage(RUSAGE_THREAD), which needs nothing.
+ */
+
+static const char *bench_perf_name_arr[BENCH_PERF_COUNTER_NUM] = {
+	"cycles",
+	"instructions",
+	"llc_misses",
+	"hitm",
+	"context_switches",
+};
+
+static bool bench_perf_enabled;
+static uint64_t bench_perf_hitm_config;
+static bool bench_perf_warned[BENCH_PERF_COUNTER_NUM];
+
+void bench_perf_setup(bool enable, uint64_t hitm_raw_config)
+{
+	bench_perf_enabled = enable;
+	bench_perf_hitm_config = hitm_raw_config;
+}
+
+const char *bench_perf_name(int counter)
+{
+	return bench_perf_name_arr[counter];
+}
+
+static void bench_perf_attr(int counter, struct perf_event_attr *attr)
+{
+	memset(attr, 0, sizeof(struct perf_event_attr));
+	attr->size = sizeof(struct perf_event_attr);
+	attr->disabled = 1;
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+	attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+		| PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	switch (counter) {
+	case BENCH_PERF_CYCLES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case BENCH_PERF_INSTRUCTIONS:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case BENCH_PERF_LLC_MISSES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case BENCH_PERF_HITM:
+		/* There is no generic event, the encoding is model specific */
+		attr->type = PERF_TYPE_RAW;
+		attr->config = bench_perf_hitm_config;
+		break;
+	}
+}
+
+static uint64_t bench_perf_csw(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+		return 0;
+	}
+
+	return (uint64_t)usage.ru_nvcsw + (uint64_t)usage.ru_nivcsw;
+}
+
+void bench_perf_open(struct bench_perf *perf)
+{
+	struct perf_event_attr attr;
+
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		perf->fd[i] = -1;
+
+		if (!bench_perf_enabled || i == BENCH_PERF_CONTEXT_SWITCHES ||
+				(i == BENCH_PERF_HITM && bench_perf_hitm_config == 0)) {
+			continue;
+		}
+
+		bench_perf_attr(i, &attr);
+		perf->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+		/* Racy between threads, at worst the warning is printed twice */
+		if (perf->fd[i] < 0 && !bench_perf_warned[i]) {
+			bench_perf_warned[i] = true;
+			fprintf(stderr, "bench: perf counter %s unavailable: %s\n",
+				bench_perf_name_arr[i], strerror(errno));
+		}
+	}
+}
+
+void bench_perf_start(struct bench_perf *perf)
+{
+	perf->csw_start = bench_perf_csw();
+
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		if (perf->fd[i] >= 0) {
+			ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+/*
+ * Stop and close the counters, storing the values scaled for multiplexing in
+ * @values. @valid tells which counters could be read.
+ */
+void bench_perf_stop(struct bench_perf *perf, uint64_t *values, bool *valid)
+{
+	uint64_t buf[3];
+
+	for (int i = 0; i < BENCH_PERF_COUNTER_NUM; i++) {
+		values[i] = 0;
+		valid[i] = false;
+
+		if (i == BENCH_PERF_CONTEXT_SWITCHES && bench_perf_enabled) {
+			values[i] = bench_perf_csw() - perf->csw_start;
+			valid[i] = true;
+			continue;
+		}
+
+		if (perf->fd[i] < 0) {
+			continue;
+		}
+
+		ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+		/* buf[0]: value, buf[1]: time enabled, buf[2]: time running */
+		if (read(perf->fd[i], buf, sizeof(buf)) == sizeof(buf)) {
+			values[i] = (buf[2] == 0) ? 0 :
+				(uint64_t)((double)buf[0] * (double)buf[1] / (double)buf[2]);
+			valid[i] = true;
+		}
+
+		close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+}
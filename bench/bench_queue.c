@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../scalable_queue.h"
+
+#define BENCH_MAX_QUEUE_NUM (32)
+
+/* Sublists per lane of scq-sublist */
+#define BENCH_SCQ_SUBLIST_NUM (4)
+
+static const struct bench_queue_ops *bench_queue_arr[BENCH_MAX_QUEUE_NUM];
+static int bench_queue_cnt;
+
+/*
+ * bench_scq_lib - Entry points of one scalable_queue library
+ *
+ * The linearizable library has no scq_init_ex(), scq_try_enqueue() and
+ * scq_get_stats(), so those stay NULL for it. Its scq_enqueue() returns
+ * nothing, so it is loaded into @enqueue_void instead of @enqueue.
+ */
+struct bench_scq_lib {
+	void *handle;
+	struct scalable_queue *(*init)(void);
+	struct scalable_queue *(*init_ex)(struct scq_init_context *ctx);
+	void (*destroy)(struct scalable_queue *scq);
+	bool (*enqueue)(struct scalable_queue *scq, uint64_t datum);
+	void (*enqueue_void)(struct scalable_queue *scq, uint64_t datum);
+	bool (*try_enqueue)(struct scalable_queue *scq, uint64_t datum);
+	bool (*dequeue)(struct scalable_queue *scq, uint64_t *datum);
+	bool (*get_stats)(struct scalable_queue *scq, struct scq_stats *stats);
+};
+
+static struct bench_scq_lib relaxed_lib;
+static struct bench_scq_lib linearizable_lib;
+
+/*
+ * Load a library without exporting its symbols, so that both libraries can be
+ * loaded at once. Returns false if it or a mandatory symbol is missing.
+ */
+static bool bench_scq_lib_load(struct bench_scq_lib *lib, const char *path,
+	bool enqueue_void)
+{
+	void *enqueue = NULL;
+
+	lib->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (lib->handle == NULL) {
+		fprintf(stderr, "bench: cannot load %s: %s\n", path, dlerror());
+		return false;
+	}
+
+	*(void **)&lib->init = dlsym(lib->handle, "scq_init");
+	*(void **)&lib->init_ex = dlsym(lib->handle, "scq_init_ex");
+	*(void **)&lib->destroy = dlsym(lib->handle, "scq_destroy");
+	enqueue = dlsym(lib->handle, "scq_enqueue");
+	*(void **)&lib->try_enqueue = dlsym(lib->handle, "scq_try_enqueue");
+	*(void **)&lib->dequeue = dlsym(lib->handle, "scq_dequeue");
+	*(void **)&lib->get_stats = dlsym(lib->handle, "scq_get_stats");
+
+	if (enqueue_void) {
+		*(void **)&lib->enqueue_void = enqueue;
+	} else {
+		*(void **)&lib->enqueue = enqueue;
+	}
+
+	if (lib->init == NULL || lib->destroy == NULL || enqueue == NULL ||
+			lib->dequeue == NULL) {
+		fprintf(stderr, "bench: %s is not a scalable_queue library\n", path);
+		dlclose(lib->handle);
+		lib->handle = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static struct scalable_queue *bench_scq_init_flags(uint32_t flags,
+	const struct bench_config *config)
+{
+	struct scq_init_context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.flags = flags;
+
+	if (flags & SCQ_FLAG_BOUNDED_RING) {
+		ctx.capacity = BENCH_RING_CAPACITY;
+	}
+
+	if (flags & SCQ_FLAG_SPSC_MATRIX) {
+		ctx.consumer_num = (uint32_t)config->consumer_num;
+	}
+
+	return relaxed_lib.init_ex(&ctx);
+}
+
+static void *bench_scq_init(const struct bench_config *config)
+{
+	(void)config;
+	return relaxed_lib.init();
+}
+
+static void *bench_scq_spsc_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_SPSC, config);
+}
+
+static void *bench_scq_mpsc_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_MPSC, config);
+}
+
+static void *bench_scq_bounded_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_BOUNDED_RING, config);
+}
+
+static void *bench_scq_matrix_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_SPSC_MATRIX, config);
+}
+
+static void *bench_scq_lease_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_LANE_LEASE, config);
+}
+
+static void *bench_scq_p2c_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_SCAN_P2C, config);
+}
+
+static void *bench_scq_handoff_init(const struct bench_config *config)
+{
+	return bench_scq_init_flags(SCQ_FLAG_HANDOFF, config);
+}
+
+static void *bench_scq_sublist_init(const struct bench_config *config)
+{
+	struct scq_init_context ctx;
+
+	(void)config;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.sublist_num = BENCH_SCQ_SUBLIST_NUM;
+
+	return relaxed_lib.init_ex(&ctx);
+}
+
+static void bench_scq_destroy(void *queue)
+{
+	relaxed_lib.destroy(queue);
+}
+
+/* False if a specialized engine could not allocate, retried by the caller */
+static bool bench_scq_enqueue(void *queue, uint64_t datum)
+{
+	return relaxed_lib.enqueue(queue, datum);
+}
+
+static bool bench_scq_try_enqueue(void *queue, uint64_t datum)
+{
+	return relaxed_lib.try_enqueue(queue, datum);
+}
+
+static bool bench_scq_dequeue(void *queue, uint64_t *datum)
+{
+	return relaxed_lib.dequeue(queue, datum);
+}
+
+/*
+ * Every node comes from malloc once (malloc_fallback_cnt) and is reused from
+ * then on, so the nodes not carrying a queued item are the difference.
+ */
+static int64_t bench_scq_held_nodes(void *queue)
+{
+	struct scq_stats stats;
+
+	if (relaxed_lib.get_stats == NULL ||
+			!relaxed_lib.get_stats(queue, &stats)) {
+		return -1;
+	}
+
+	return (int64_t)stats.malloc_fallback_cnt
+		- ((int64_t)stats.enqueue_cnt - (int64_t)stats.dequeue_cnt);
+}
+
+static int64_t bench_scq_detach_fails(void *queue)
+{
+	struct scq_stats stats;
+
+	if (relaxed_lib.get_stats == NULL ||
+			!relaxed_lib.get_stats(queue, &stats)) {
+		return -1;
+	}
+
+	return (int64_t)stats.detach_fail_cnt;
+}
+
+static void *bench_lin_init(const struct bench_config *config)
+{
+	(void)config;
+	return linearizable_lib.init();
+}
+
+static void bench_lin_destroy(void *queue)
+{
+	linearizable_lib.destroy(queue);
+}
+
+static bool bench_lin_enqueue(void *queue, uint64_t datum)
+{
+	linearizable_lib.enqueue_void(queue, datum);
+	return true;
+}
+
+static bool bench_lin_dequeue(void *queue, uint64_t *datum)
+{
+	return linearizable_lib.dequeue(queue, datum);
+}
+
+static bool bench_supports_spsc(int producer_num, int consumer_num)
+{
+	return producer_num == 1 && consumer_num == 1;
+}
+
+static bool bench_supports_mpsc(int producer_num, int consumer_num)
+{
+	(void)producer_num;
+	return consumer_num == 1;
+}
+
+static const struct bench_queue_ops bench_scq_ops = {
+	.name = "scq",
+	.init = bench_scq_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+	.held_nodes = bench_scq_held_nodes,
+	.detach_fails = bench_scq_detach_fails,
+};
+
+static const struct bench_queue_ops bench_scq_lease_ops = {
+	.name = "scq-lease",
+	.init = bench_scq_lease_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+	.held_nodes = bench_scq_held_nodes,
+	.detach_fails = bench_scq_detach_fails,
+};
+
+static const struct bench_queue_ops bench_scq_p2c_ops = {
+	.name = "scq-p2c",
+	.init = bench_scq_p2c_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+	.held_nodes = bench_scq_held_nodes,
+	.detach_fails = bench_scq_detach_fails,
+};
+
+static const struct bench_queue_ops bench_scq_sublist_ops = {
+	.name = "scq-sublist",
+	.init = bench_scq_sublist_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+	.held_nodes = bench_scq_held_nodes,
+	.detach_fails = bench_scq_detach_fails,
+};
+
+static const struct bench_queue_ops bench_scq_handoff_ops = {
+	.name = "scq-handoff",
+	.init = bench_scq_handoff_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+	.detach_fails = bench_scq_detach_fails,
+};
+
+static const struct bench_queue_ops bench_scq_spsc_ops = {
+	.name = "scq-spsc",
+	.supports = bench_supports_spsc,
+	.init = bench_scq_spsc_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+};
+
+static const struct bench_queue_ops bench_scq_mpsc_ops = {
+	.name = "scq-mpsc",
+	.supports = bench_supports_mpsc,
+	.init = bench_scq_mpsc_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+};
+
+static const struct bench_queue_ops bench_scq_bounded_ops = {
+	.name = "scq-bounded",
+	.init = bench_scq_bounded_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_try_enqueue,
+	.dequeue = bench_scq_dequeue,
+};
+
+static const struct bench_queue_ops bench_scq_matrix_ops = {
+	.name = "scq-matrix",
+	.init = bench_scq_matrix_init,
+	.destroy = bench_scq_destroy,
+	.enqueue = bench_scq_enqueue,
+	.dequeue = bench_scq_dequeue,
+};
+
+static const struct bench_queue_ops bench_lin_ops = {
+	.name = "scq-linearizable",
+	.init = bench_lin_init,
+	.destroy = bench_lin_destroy,
+	.enqueue = bench_lin_enqueue,
+	.dequeue = bench_lin_dequeue,
+};
+
+void bench_queue_add(const struct bench_queue_ops *ops)
+{
+	if (bench_queue_cnt == BENCH_MAX_QUEUE_NUM) {
+		fprintf(stderr, "bench: too many queues, %s skipped\n", ops->name);
+		return;
+	}
+
+	bench_queue_arr[bench_queue_cnt++] = ops;
+}
+
+void bench_queue_register(const char *relaxed_path,
+	const char *linearizable_path)
+{
+	if (bench_scq_lib_load(&relaxed_lib, relaxed_path, false)) {
+		bench_queue_add(&bench_scq_ops);
+
+		/* An older library without the engines only runs the default */
+		if (relaxed_lib.init_ex != NULL && relaxed_lib.try_enqueue != NULL) {
+			bench_queue_add(&bench_scq_spsc_ops);
+			bench_queue_add(&bench_scq_mpsc_ops);
+			bench_queue_add(&bench_scq_bounded_ops);
+			bench_queue_add(&bench_scq_matrix_ops);
+			bench_queue_add(&bench_scq_lease_ops);
+			bench_queue_add(&bench_scq_p2c_ops);
+			bench_queue_add(&bench_scq_sublist_ops);
+			bench_queue_add(&bench_scq_handoff_ops);
+		}
+	}
+
+	if (bench_scq_lib_load(&linearizable_lib, linearizable_path, true)) {
+		bench_queue_add(&bench_lin_ops);
+	}
+
+	bench_queue_add(&bench_ms_queue_ops);
+	bench_queue_add(&bench_mutex_queue_ops);
+	bench_queue_add(&bench_vyukov_ring_ops);
+	bench_queue_add(&bench_faa_array_queue_ops);
+}
+
+int bench_queue_num(void)
+{
+	return bench_queue_cnt;
+}
+
+const struct bench_queue_ops *bench_queue_get(int idx)
+{
+	return bench_queue_arr[idx];
+}
+
+const struct bench_queue_ops *bench_queue_find(const char *name)
+{
+	for (int i = 0; i < bench_queue_cnt; i++) {
+		if (strcmp(bench_queue_arr[i]->name, name) == 0) {
+			return bench_queue_arr[i];
+		}
+	}
+
+	return NULL;
+}
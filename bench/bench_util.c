@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_BACKOFF_SPIN_NUM (64)
+#define BENCH_TSC_CALIBRATION_NS (50000000ULL)
+#define BENCH_CGROUP_PERIOD_US (100000)
+#define BENCH_CGROUP2_SUPER_MAGIC (0x63677270)
+
+static char bench_cgroup_parent[PATH_MAX];
+static char bench_cgroup_dir[PATH_MAX];
+
+/*
+ * Same scheme as the library's latency histogram: values below 8 have their
+ * own bucket, every power of two above is split into 8.
+ */
+static int bench_hist_bucket(uint64_t value)
+{
+	int msb;
+
+	if (value < BENCH_HIST_SUB_BUCKET_NUM) {
+		return (int)value;
+	}
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - 2) * BENCH_HIST_SUB_BUCKET_NUM
+		+ (int)((value >> (msb - 3)) & (BENCH_HIST_SUB_BUCKET_NUM - 1));
+}
+
+static uint64_t bench_hist_bucket_max(int bucket)
+{
+	int msb = bucket / BENCH_HIST_SUB_BUCKET_NUM + 2;
+	uint64_t sub = (uint64_t)(bucket % BENCH_HIST_SUB_BUCKET_NUM);
+
+	if (bucket < BENCH_HIST_SUB_BUCKET_NUM) {
+		return (uint64_t)bucket;
+	}
+
+	return ((BENCH_HIST_SUB_BUCKET_NUM + sub + 1) << (msb - 3)) - 1;
+}
+
+void bench_hist_record(struct bench_hist *hist, uint64_t value)
+{
+	hist->bucket_cnt[bench_hist_bucket(value)]++;
+	hist->cnt++;
+
+	if (value > hist->max) {
+		hist->max = value;
+	}
+}
+
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src)
+{
+	for (int i = 0; i < BENCH_HIST_BUCKET_NUM; i++) {
+		dst->bucket_cnt[i] += src->bucket_cnt[i];
+	}
+
+	dst->cnt += src->cnt;
+
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+/*
+ * Value that the given fraction of the samples do not exceed, rounded up to
+ * the end of its bucket but never above the recorded maximum.
+ */
+uint64_t bench_hist_percentile(const struct bench_hist *hist, double percentile)
+{
+	uint64_t rank, seen = 0, value;
+
+	if (hist->cnt == 0) {
+		return 0;
+	}
+
+	rank = (uint64_t)(percentile * (double)hist->cnt);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (int i = 0; i < BENCH_HIST_BUCKET_NUM; i++) {
+		seen += hist->bucket_cnt[i];
+
+		if (seen >= rank) {
+			value = bench_hist_bucket_max(i);
+			return (value < hist->max) ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+double bench_tsc_per_ns(void)
+{
+	static double tsc_per_ns = 0.0;
+	uint64_t start_ns, start_tsc, now_ns;
+
+	if (tsc_per_ns != 0.0) {
+		return tsc_per_ns;
+	}
+
+	start_ns = bench_now_ns();
+	start_tsc = bench_rdtsc();
+
+	do {
+		now_ns = bench_now_ns();
+	} while (now_ns - start_ns < BENCH_TSC_CALIBRATION_NS);
+
+	tsc_per_ns = (double)(bench_rdtsc() - start_tsc)
+		/ (double)(now_ns - start_ns);
+
+	return tsc_per_ns;
+}
+
+void bench_backoff(int *spin_cnt)
+{
+	if (*spin_cnt < BENCH_BACKOFF_SPIN_NUM) {
+		(*spin_cnt)++;
+		__asm__ __volatile__("pause");
+	} else {
+		*spin_cnt = 0;
+		sched_yield();
+	}
+}
+
+void bench_pin_thread(int idx)
+{
+	cpu_set_t allowed, target;
+	int cpu_num, cpu = -1;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+
+	cpu_num = CPU_COUNT(&allowed);
+	if (cpu_num == 0) {
+		return;
+	}
+
+	idx %= cpu_num;
+
+	for (int i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &allowed) && idx-- == 0) {
+			cpu = i;
+			break;
+		}
+	}
+
+	CPU_ZERO(&target);
+	CPU_SET(cpu, &target);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(target), &target) != 0) {
+		fprintf(stderr, "bench: cannot pin to cpu %d\n", cpu);
+	}
+}
+
+int bench_restrict_cpus(int cpu_num)
+{
+	cpu_set_t allowed, target;
+	int cnt = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return -1;
+	}
+
+	CPU_ZERO(&target);
+
+	for (int i = 0; i < CPU_SETSIZE && cnt < cpu_num; i++) {
+		if (CPU_ISSET(i, &allowed)) {
+			CPU_SET(i, &target);
+			cnt++;
+		}
+	}
+
+	if (sched_setaffinity(0, sizeof(target), &target) != 0) {
+		fprintf(stderr, "bench: cannot restrict to %d cpus\n", cpu_num);
+		return -1;
+	}
+
+	return cnt;
+}
+
+static bool bench_write_file(const char *dir, const char *file,
+	const char *value)
+{
+	char path[PATH_MAX + 64];
+	FILE *fp;
+	bool ok;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		return false;
+	}
+
+	ok = fputs(value, fp) >= 0;
+
+	/* cgroupfs reports a rejected write on flush */
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+bool bench_cgroup_enter(int quota_pct)
+{
+	char line[PATH_MAX], value[64];
+	bool found = false;
+	struct statfs fs;
+	FILE *fp;
+
+	fp = fopen("/proc/self/cgroup", "r");
+	if (fp == NULL) {
+		return false;
+	}
+
+	/* The cgroup v2 entry is "0::<path>" */
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			found = true;
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	if (!found) {
+		fprintf(stderr, "bench: no cgroup v2 hierarchy\n");
+		return false;
+	}
+
+	snprintf(bench_cgroup_parent, sizeof(bench_cgroup_parent),
+		"/sys/fs/cgroup%.*s", PATH_MAX - 64, line + 3);
+	/* On a hybrid hierarchy /sys/fs/cgroup is a tmpfs, don't litter it */
+	if (statfs(bench_cgroup_parent, &fs) != 0 ||
+			fs.f_type != BENCH_CGROUP2_SUPER_MAGIC) {
+		fprintf(stderr, "bench: %s is not a cgroup v2 directory\n",
+			bench_cgroup_parent);
+		return false;
+	}
+
+	snprintf(bench_cgroup_dir, sizeof(bench_cgroup_dir), "%.*s/scq_bench.%d",
+		PATH_MAX - 32, bench_cgroup_parent, (int)getpid());
+
+	if (mkdir(bench_cgroup_dir, 0755) != 0) {
+		fprintf(stderr, "bench: cannot create %s: %s\n", bench_cgroup_dir,
+			strerror(errno));
+		bench_cgroup_dir[0] = '\0';
+		return false;
+	}
+
+	/* May fail if the controller is already enabled or not delegated */
+	bench_write_file(bench_cgroup_parent, "cgroup.subtree_control", "+cpu");
+
+	snprintf(value, sizeof(value), "%d %d",
+		quota_pct * (BENCH_CGROUP_PERIOD_US / 100), BENCH_CGROUP_PERIOD_US);
+
+	if (!bench_write_file(bench_cgroup_dir, "cpu.max", value)) {
+		fprintf(stderr, "bench: cannot set cpu.max in %s\n", bench_cgroup_dir);
+		bench_cgroup_leave();
+		return false;
+	}
+
+	snprintf(value, sizeof(value), "%d", (int)getpid());
+
+	if (!bench_write_file(bench_cgroup_dir, "cgroup.procs", value)) {
+		fprintf(stderr, "bench: cannot move into %s\n", bench_cgroup_dir);
+		bench_cgroup_leave();
+		return false;
+	}
+
+	return true;
+}
+
+void bench_cgroup_leave(void)
+{
+	char value[64];
+
+	if (bench_cgroup_dir[0] == '\0') {
+		return;
+	}
+
+	snprintf(value, sizeof(value), "%d", (int)getpid());
+	bench_write_file(bench_cgroup_parent, "cgroup.procs", value);
+
+	rmdir(bench_cgroup_dir);
+	bench_cgroup_dir[0] = '\0';
+}
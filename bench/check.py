@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Compare a scq_bench run against the baseline of this machine class.
+
+Every point (queue, producers, consumers, payload) of the current run is
+matched with the same point of the baseline. For each metric the ratio
+current / baseline is bootstrapped over the per-trial values:
+
+  - throughput: ratio of the mean of trials_mops, a regression if the upper
+    bound of its confidence interval is below 1 - --mops-tolerance
+  - tail latency: ratio of the median of trials_p99_ns, a regression if the
+    lower bound is above 1 + --p99-tolerance
+
+The confidence level is split over all tests (Bonferroni), so that a larger
+matrix does not fail more often by chance.
+
+Trials of one run share its process, placement and machine state, so they
+understate how much two runs of the same tree differ. A baseline therefore
+merges several scq_bench runs (--merge, see 'make baseline'), keeping each
+run's statistic in sessions_mops / sessions_p99_ns. The tolerance of a point
+is widened by the prediction interval of one more session drawn from that
+spread, so that a point which already moves between runs of an unchanged tree
+does not fail.
+
+Exits 1 on a regression, 0 otherwise, including when there is no baseline for
+this machine class yet.
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import statistics
+import sys
+
+
+def machine_class():
+    """CPU model and cpu count, e.g. intel-xeon-gold-6248-cpu-2-50ghz-40cpu"""
+    model = "unknown"
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1]
+                    break
+    except OSError:
+        pass
+
+    slug = re.sub(r"[^a-z0-9]+", "-", model.lower()).strip("-")
+    return "%s-%dcpu" % (slug, os.cpu_count() or 1)
+
+
+def point_key(result):
+    return (result["queue"], result["producers"], result["consumers"],
+            result["payload"], result["payload_size"])
+
+
+def point_name(key):
+    return "%s %dP/%dC %s" % key[:4]
+
+
+def bootstrap_ratio(base, cur, stat, confidence, resamples, rng):
+    """Confidence interval of stat(cur) / stat(base), resampling both"""
+    ratios = []
+    for _ in range(resamples):
+        b = stat(rng.choices(base, k=len(base)))
+        c = stat(rng.choices(cur, k=len(cur)))
+        if b > 0:
+            ratios.append(c / b)
+
+    if not ratios:
+        return None
+
+    ratios.sort()
+    tail = (1.0 - confidence) / 2.0
+    lo = ratios[int(tail * (len(ratios) - 1))]
+    hi = ratios[int((1.0 - tail) * (len(ratios) - 1))]
+    return stat(cur) / stat(base), lo, hi
+
+
+def load(path):
+    with open(path) as f:
+        return {point_key(r): r for r in json.load(f)["results"]}
+
+
+def session_stats(result, field, sessions_field, stat):
+    """Per-run statistics of a baseline point, one if it was never merged"""
+    if sessions_field in result:
+        return result[sessions_field]
+    if any(result.get(field, [])):
+        return [stat(result[field])]
+    return []
+
+
+def merge(paths):
+    """Merge scq_bench runs or baselines into one baseline on stdout"""
+    merged = {}
+    order = []
+    for path in paths:
+        with open(path) as f:
+            doc = json.load(f)
+        for r in doc["results"]:
+            key = point_key(r)
+            if key not in merged:
+                merged[key] = dict(r, trials_mops=[], trials_p99_ns=[],
+                                   sessions_mops=[], sessions_p99_ns=[])
+                order.append(key)
+            m = merged[key]
+            m["trials_mops"] += r["trials_mops"]
+            m["trials_p99_ns"] += r.get("trials_p99_ns", [])
+            m["sessions_mops"] += session_stats(
+                r, "trials_mops", "sessions_mops", statistics.mean)
+            m["sessions_p99_ns"] += session_stats(
+                r, "trials_p99_ns", "sessions_p99_ns", statistics.median)
+
+    json.dump({"machine": doc["machine"], "settings": doc["settings"],
+               "results": [merged[k] for k in order]}, sys.stdout, indent=1)
+    print()
+
+
+def session_tolerance(sessions, tolerance, confidence):
+    """Tolerance widened by the spread of the baseline's sessions"""
+    if len(sessions) < 2 or statistics.mean(sessions) <= 0:
+        return tolerance
+
+    spread = statistics.stdev(sessions) / statistics.mean(sessions)
+    z = statistics.NormalDist().inv_cdf(1.0 - (1.0 - confidence) / 2.0)
+    return tolerance + z * spread * (1.0 + 1.0 / len(sessions)) ** 0.5
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("current", nargs="?",
+                        help="scq_bench JSON output to check")
+    parser.add_argument("--baseline", help="baseline JSON (default: "
+                        "BASELINE_DIR/<machine class>.json)")
+    parser.add_argument("--baseline-dir", default="baselines")
+    parser.add_argument("--confidence", type=float, default=0.95)
+    parser.add_argument("--mops-tolerance", type=float, default=0.05)
+    parser.add_argument("--p99-tolerance", type=float, default=0.25)
+    parser.add_argument("--resamples", type=int, default=2000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--print-class", action="store_true",
+                        help="print the machine class and exit")
+    parser.add_argument("--merge", nargs="+", metavar="JSON",
+                        help="merge scq_bench runs or baselines into one "
+                        "baseline on stdout and exit")
+    args = parser.parse_args()
+
+    if args.print_class:
+        print(machine_class())
+        return 0
+
+    if args.merge:
+        merge(args.merge)
+        return 0
+
+    if args.current is None:
+        parser.error("the scq_bench output to check is required")
+
+    baseline_path = args.baseline or os.path.join(
+        args.baseline_dir, machine_class() + ".json")
+    if not os.path.exists(baseline_path):
+        print("check: no baseline %s for this machine class, record one "
+              "with 'make bench-baseline'" % baseline_path)
+        return 0
+
+    base = load(baseline_path)
+    cur = load(args.current)
+    rng = random.Random(args.seed)
+
+    tests = []
+    for key in sorted(cur):
+        if key not in base:
+            print("check: %s is not in the baseline, skipped"
+                  % point_name(key))
+            continue
+
+        tests.append((key, "mops", "trials_mops", "sessions_mops",
+                      statistics.mean, args.mops_tolerance))
+        if any(base[key].get("trials_p99_ns", [])) and \
+                any(cur[key].get("trials_p99_ns", [])):
+            tests.append((key, "p99", "trials_p99_ns", "sessions_p99_ns",
+                          statistics.median, args.p99_tolerance))
+
+    if not tests:
+        print("check: nothing to compare against %s" % baseline_path)
+        return 0
+
+    confidence = 1.0 - (1.0 - args.confidence) / len(tests)
+    failed = 0
+
+    print("%-36s %-5s %8s %18s %6s  %s" % ("point", "stat", "ratio",
+                                           "%.4g%% ci" % (confidence * 100),
+                                           "tol", "verdict"))
+    for key, metric, field, sessions_field, stat, tolerance in tests:
+        ci = bootstrap_ratio(base[key][field], cur[key][field], stat,
+                             confidence, args.resamples, rng)
+        if ci is None:
+            continue
+
+        tolerance = session_tolerance(
+            session_stats(base[key], field, sessions_field, stat),
+            tolerance, confidence)
+
+        ratio, lo, hi = ci
+        if metric == "mops":
+            regressed = hi < 1.0 - tolerance
+        else:
+            regressed = lo > 1.0 + tolerance
+
+        failed += regressed
+        print("%-36s %-5s %8.3f    [%6.3f, %6.3f] %6.3f  %s"
+              % (point_name(key), metric, ratio, lo, hi, tolerance,
+                 "REGRESSION" if regressed else "ok"))
+
+    if failed:
+        print("check: %d significant regression(s) against %s"
+              % (failed, baseline_path))
+        return 1
+
+    print("check: no significant regression against %s" % baseline_path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,669 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Costs paid when threads and queues come and go, rather than per item.
+ *
+ * The relaxed queue registers a lane (struct scq_tls_data) on the first
+ * operation of each thread and never releases it, so:
+ *
+ *  - threads: T short-lived threads enqueue a few items each and exit, in
+ *    waves that start together. The first enqueue of every thread (lane
+ *    allocation and registration under the queue's spinlock) is timed against
+ *    its second one. A fresh thread then drains the queue and polls it empty,
+ *    which scans all T dead lanes.
+ *
+ *  - queues: Q queues are kept alive while init/destroy pairs are timed, so
+ *    the linear id search under global_scq_id_flag walks past Q taken ids.
+ *    With --init-threads above one the pairs run concurrently.
+ *
+ * The relaxed queue has room for MAX_THREAD_NUM lanes per queue and
+ * MAX_SCQ_NUM queues (1024 each), so the counts stay below those.
+ */
+
+#define CHURN_MAX_LIST_NUM (32)
+#define CHURN_MAX_COUNT (1000)
+
+#define CHURN_FORMAT_JSON (0)
+#define CHURN_FORMAT_CSV (1)
+
+#define CHURN_EMPTY_POLL_NUM (10000)
+
+/* Consecutive misses after which a drain gives up on the remaining items */
+#define CHURN_DRAIN_MISS_LIMIT (10000000)
+
+/*
+ * churn_params - One run
+ * @thread_counts: short-lived threads per queue, one row each
+ * @queue_counts: queues kept alive while init is timed, one row each
+ * @wave: threads started together
+ * @items_per_thread: enqueued by each short-lived thread, at least 2
+ * @init_num: init/destroy pairs timed by each init thread
+ */
+struct churn_params {
+	int thread_counts[CHURN_MAX_LIST_NUM];
+	int thread_count_num;
+	int queue_counts[CHURN_MAX_LIST_NUM];
+	int queue_count_num;
+	int wave;
+	int items_per_thread;
+	int init_num;
+	int init_thread_num;
+	bool run_threads;
+	bool run_queues;
+};
+
+/*
+ * churn_thread_result - Row of the threads experiment, cycles
+ * @first: first enqueue of each thread
+ * @steady: second enqueue of each thread
+ * @drain_cycles: taking every item from a fresh thread
+ * @empty_cycles: CHURN_EMPTY_POLL_NUM dequeues on the empty queue
+ */
+struct churn_thread_result {
+	struct bench_hist first;
+	struct bench_hist steady;
+	uint64_t item_num;
+	uint64_t drained_num;
+	uint64_t drain_cycles;
+	uint64_t empty_cycles;
+};
+
+struct churn_queue_result {
+	struct bench_hist init;
+	struct bench_hist destroy;
+	uint64_t pair_num;
+	uint64_t failed_num;
+};
+
+struct churn_worker {
+	pthread_t thread;
+	const struct bench_queue_ops *ops;
+	void *queue;
+	pthread_barrier_t *barrier;
+	const struct churn_params *params;
+	int producer_num;
+	uint64_t first;
+	uint64_t steady;
+	uint64_t drained_num;
+	uint64_t drain_cycles;
+	uint64_t empty_cycles;
+	struct bench_hist init;
+	struct bench_hist destroy;
+	uint64_t failed_num;
+} __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+
+struct churn_options {
+	const char *queue_names[CHURN_MAX_LIST_NUM];
+	int queue_name_num;
+	struct churn_params params;
+	int format;
+	const char *relaxed_lib;
+	const char *linearizable_lib;
+};
+
+static void *churn_producer_main(void *arg)
+{
+	struct churn_worker *worker = arg;
+	uint64_t start, mid, end;
+
+	pthread_barrier_wait(worker->barrier);
+
+	start = bench_rdtscp();
+	worker->ops->enqueue(worker->queue, 0);
+	mid = bench_rdtscp();
+	worker->ops->enqueue(worker->queue, 1);
+	end = bench_rdtscp();
+
+	worker->first = mid - start;
+	worker->steady = end - mid;
+
+	for (int i = 2; i < worker->params->items_per_thread; i++) {
+		worker->ops->enqueue(worker->queue, (uint64_t)i);
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs on a thread of its own, so that the relaxed queue gives it a new lane
+ * like any consumer started after the producers are gone.
+ */
+static void *churn_consumer_main(void *arg)
+{
+	struct churn_worker *worker = arg;
+	uint64_t item_num = (uint64_t)worker->params->items_per_thread
+		* (uint64_t)worker->producer_num;
+	uint64_t start, datum;
+	int miss_cnt = 0;
+
+	start = bench_rdtscp();
+	while (worker->drained_num < item_num &&
+			miss_cnt < CHURN_DRAIN_MISS_LIMIT) {
+		if (worker->ops->dequeue(worker->queue, &datum)) {
+			worker->drained_num++;
+			miss_cnt = 0;
+		} else {
+			miss_cnt++;
+		}
+	}
+	worker->drain_cycles = bench_rdtscp() - start;
+
+	start = bench_rdtscp();
+	for (int i = 0; i < CHURN_EMPTY_POLL_NUM; i++) {
+		worker->ops->dequeue(worker->queue, &datum);
+	}
+	worker->empty_cycles = bench_rdtscp() - start;
+
+	return NULL;
+}
+
+static bool churn_run_threads(const struct churn_params *params,
+	const struct bench_queue_ops *ops, int thread_num,
+	struct churn_thread_result *result)
+{
+	struct churn_worker *workers, consumer;
+	struct bench_config config;
+	pthread_barrier_t barrier;
+	void *queue;
+	int wave_num;
+
+	memset(result, 0, sizeof(struct churn_thread_result));
+	memset(&config, 0, sizeof(config));
+	config.producer_num = thread_num;
+	config.consumer_num = 1;
+
+	workers = aligned_alloc(BENCH_CACHE_LINE_SIZE,
+		sizeof(struct churn_worker) * (size_t)params->wave);
+	if (workers == NULL) {
+		return false;
+	}
+
+	queue = ops->init(&config);
+	if (queue == NULL) {
+		fprintf(stderr, "churn: %s init failed\n", ops->name);
+		free(workers);
+		return false;
+	}
+
+	for (int done = 0; done < thread_num; done += wave_num) {
+		wave_num = (thread_num - done < params->wave) ?
+			thread_num - done : params->wave;
+
+		pthread_barrier_init(&barrier, NULL, (unsigned)wave_num);
+		memset(workers, 0, sizeof(struct churn_worker) * (size_t)wave_num);
+
+		for (int i = 0; i < wave_num; i++) {
+			workers[i].ops = ops;
+			workers[i].queue = queue;
+			workers[i].barrier = &barrier;
+			workers[i].params = params;
+			pthread_create(&workers[i].thread, NULL, churn_producer_main,
+				&workers[i]);
+		}
+
+		for (int i = 0; i < wave_num; i++) {
+			pthread_join(workers[i].thread, NULL);
+			bench_hist_record(&result->first, workers[i].first);
+			bench_hist_record(&result->steady, workers[i].steady);
+		}
+
+		pthread_barrier_destroy(&barrier);
+	}
+
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.ops = ops;
+	consumer.queue = queue;
+	consumer.params = params;
+	consumer.producer_num = thread_num;
+	pthread_create(&consumer.thread, NULL, churn_consumer_main, &consumer);
+	pthread_join(consumer.thread, NULL);
+
+	result->item_num = (uint64_t)thread_num * (uint64_t)params->items_per_thread;
+	result->drained_num = consumer.drained_num;
+	result->drain_cycles = consumer.drain_cycles;
+	result->empty_cycles = consumer.empty_cycles;
+
+	if (result->drained_num < result->item_num) {
+		fprintf(stderr, "churn: %s drained %lu of %lu items\n", ops->name,
+			result->drained_num, result->item_num);
+	}
+
+	ops->destroy(queue);
+	free(workers);
+
+	return true;
+}
+
+static void *churn_init_main(void *arg)
+{
+	struct churn_worker *worker = arg;
+	struct bench_config config;
+	uint64_t start, mid;
+	void *queue;
+
+	memset(&config, 0, sizeof(config));
+	config.producer_num = 1;
+	config.consumer_num = 1;
+
+	pthread_barrier_wait(worker->barrier);
+
+	for (int i = 0; i < worker->params->init_num; i++) {
+		start = bench_rdtscp();
+		queue = worker->ops->init(&config);
+		mid = bench_rdtscp();
+
+		if (queue == NULL) {
+			worker->failed_num++;
+			continue;
+		}
+
+		worker->ops->destroy(queue);
+		bench_hist_record(&worker->init, mid - start);
+		bench_hist_record(&worker->destroy, bench_rdtscp() - mid);
+	}
+
+	return NULL;
+}
+
+static bool churn_run_queues(const struct churn_params *params,
+	const struct bench_queue_ops *ops, int queue_num,
+	struct churn_queue_result *result)
+{
+	struct churn_worker *workers;
+	struct bench_config config;
+	pthread_barrier_t barrier;
+	void **live;
+	int live_num = 0;
+	bool ok = true;
+
+	memset(result, 0, sizeof(struct churn_queue_result));
+	memset(&config, 0, sizeof(config));
+	config.producer_num = 1;
+	config.consumer_num = 1;
+
+	live = malloc(sizeof(void *) * (size_t)queue_num);
+	workers = aligned_alloc(BENCH_CACHE_LINE_SIZE,
+		sizeof(struct churn_worker) * (size_t)params->init_thread_num);
+	if (live == NULL || workers == NULL) {
+		free(live);
+		free(workers);
+		return false;
+	}
+
+	/* Taken ids fill the bottom of the relaxed queue's id array */
+	for (; live_num < queue_num; live_num++) {
+		live[live_num] = ops->init(&config);
+		if (live[live_num] == NULL) {
+			fprintf(stderr, "churn: %s init failed at %d queues\n", ops->name,
+				live_num);
+			ok = false;
+			break;
+		}
+	}
+
+	if (ok) {
+		pthread_barrier_init(&barrier, NULL,
+			(unsigned)params->init_thread_num);
+		memset(workers, 0,
+			sizeof(struct churn_worker) * (size_t)params->init_thread_num);
+
+		for (int i = 0; i < params->init_thread_num; i++) {
+			workers[i].ops = ops;
+			workers[i].barrier = &barrier;
+			workers[i].params = params;
+			pthread_create(&workers[i].thread, NULL, churn_init_main,
+				&workers[i]);
+		}
+
+		for (int i = 0; i < params->init_thread_num; i++) {
+			pthread_join(workers[i].thread, NULL);
+			bench_hist_merge(&result->init, &workers[i].init);
+			bench_hist_merge(&result->destroy, &workers[i].destroy);
+			result->failed_num += workers[i].failed_num;
+		}
+
+		result->pair_num = result->init.cnt;
+		pthread_barrier_destroy(&barrier);
+	}
+
+	while (live_num > 0) {
+		ops->destroy(live[--live_num]);
+	}
+
+	free(live);
+	free(workers);
+
+	return ok;
+}
+
+static double churn_ns(uint64_t cycles)
+{
+	return (double)cycles / bench_tsc_per_ns();
+}
+
+static void churn_print_thread_row(const struct churn_options *options,
+	const struct bench_queue_ops *ops, int thread_num,
+	const struct churn_thread_result *result, bool first)
+{
+	double drain_ns = (result->drained_num == 0) ? 0.0
+		: churn_ns(result->drain_cycles) / (double)result->drained_num;
+	double empty_ns = churn_ns(result->empty_cycles) / CHURN_EMPTY_POLL_NUM;
+
+	if (options->format == CHURN_FORMAT_CSV) {
+		printf("%s,%d,%d,%.1f,%.1f,%.1f,%.1f,%lu,%lu,%.1f,%.1f\n", ops->name,
+			thread_num, options->params.wave,
+			churn_ns(bench_hist_percentile(&result->first, 0.50)),
+			churn_ns(bench_hist_percentile(&result->first, 0.99)),
+			churn_ns(result->first.max),
+			churn_ns(bench_hist_percentile(&result->steady, 0.50)),
+			result->item_num, result->drained_num, drain_ns, empty_ns);
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"queue\": \"%s\", \"threads\": %d, \"wave\": %d,\n",
+		first ? "" : ",", ops->name, thread_num, options->params.wave);
+	printf("     \"first_enqueue_ns\": {\"p50\": %.1f, \"p99\": %.1f, "
+		"\"max\": %.1f}, \"steady_enqueue_p50_ns\": %.1f,\n",
+		churn_ns(bench_hist_percentile(&result->first, 0.50)),
+		churn_ns(bench_hist_percentile(&result->first, 0.99)),
+		churn_ns(result->first.max),
+		churn_ns(bench_hist_percentile(&result->steady, 0.50)));
+	printf("     \"items\": %lu, \"drained\": %lu, \"drain_ns_per_item\": %.1f, "
+		"\"empty_dequeue_ns\": %.1f}", result->item_num, result->drained_num,
+		drain_ns, empty_ns);
+	fflush(stdout);
+}
+
+static void churn_print_queue_row(const struct churn_options *options,
+	const struct bench_queue_ops *ops, int queue_num,
+	const struct churn_queue_result *result, bool first)
+{
+	if (options->format == CHURN_FORMAT_CSV) {
+		printf("%s,%d,%d,%lu,%lu,%.1f,%.1f,%.1f,%.1f\n", ops->name, queue_num,
+			options->params.init_thread_num, result->pair_num,
+			result->failed_num,
+			churn_ns(bench_hist_percentile(&result->init, 0.50)),
+			churn_ns(bench_hist_percentile(&result->init, 0.99)),
+			churn_ns(bench_hist_percentile(&result->destroy, 0.50)),
+			churn_ns(bench_hist_percentile(&result->destroy, 0.99)));
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"queue\": \"%s\", \"live_queues\": %d, "
+		"\"init_threads\": %d, \"pairs\": %lu, \"failed\": %lu,\n",
+		first ? "" : ",", ops->name, queue_num,
+		options->params.init_thread_num, result->pair_num,
+		result->failed_num);
+	printf("     \"init_ns\": {\"p50\": %.1f, \"p99\": %.1f}, "
+		"\"destroy_ns\": {\"p50\": %.1f, \"p99\": %.1f}}",
+		churn_ns(bench_hist_percentile(&result->init, 0.50)),
+		churn_ns(bench_hist_percentile(&result->init, 0.99)),
+		churn_ns(bench_hist_percentile(&result->destroy, 0.50)),
+		churn_ns(bench_hist_percentile(&result->destroy, 0.99)));
+	fflush(stdout);
+}
+
+static void churn_threads(const struct churn_options *options,
+	const struct bench_queue_ops **ops_arr, int ops_num)
+{
+	const struct churn_params *params = &options->params;
+	struct churn_thread_result result;
+	bool first = true;
+
+	if (options->format == CHURN_FORMAT_CSV) {
+		printf("queue,threads,wave,first_enqueue_p50_ns,first_enqueue_p99_ns,"
+			"first_enqueue_max_ns,steady_enqueue_p50_ns,items,drained,"
+			"drain_ns_per_item,empty_dequeue_ns\n");
+	} else {
+		printf("  \"threads\": [");
+	}
+
+	for (int q = 0; q < ops_num; q++) {
+		for (int t = 0; t < params->thread_count_num; t++) {
+			if (churn_run_threads(params, ops_arr[q],
+					params->thread_counts[t], &result)) {
+				churn_print_thread_row(options, ops_arr[q],
+					params->thread_counts[t], &result, first);
+				first = false;
+			}
+		}
+	}
+
+	if (options->format == CHURN_FORMAT_JSON) {
+		printf("\n  ]");
+	}
+}
+
+static void churn_queues(const struct churn_options *options,
+	const struct bench_queue_ops **ops_arr, int ops_num)
+{
+	const struct churn_params *params = &options->params;
+	struct churn_queue_result result;
+	bool first = true;
+
+	if (options->format == CHURN_FORMAT_CSV) {
+		printf("queue,live_queues,init_threads,pairs,failed,init_p50_ns,"
+			"init_p99_ns,destroy_p50_ns,destroy_p99_ns\n");
+	} else {
+		printf("  \"queues\": [");
+	}
+
+	for (int q = 0; q < ops_num; q++) {
+		for (int c = 0; c < params->queue_count_num; c++) {
+			if (churn_run_queues(params, ops_arr[q],
+					params->queue_counts[c], &result)) {
+				churn_print_queue_row(options, ops_arr[q],
+					params->queue_counts[c], &result, first);
+				first = false;
+			}
+		}
+	}
+
+	if (options->format == CHURN_FORMAT_JSON) {
+		printf("\n  ]");
+	}
+}
+
+static int churn_parse_list(char *arg, int *values, int min)
+{
+	int num = 0;
+
+	for (char *tok = strtok(arg, ","); tok != NULL && num < CHURN_MAX_LIST_NUM;
+			tok = strtok(NULL, ",")) {
+		values[num] = atoi(tok);
+		if (values[num] < min || values[num] > CHURN_MAX_COUNT) {
+			fprintf(stderr, "churn: %s is out of range [%d, %d]\n", tok, min,
+				CHURN_MAX_COUNT);
+			exit(1);
+		}
+		num++;
+	}
+
+	return num;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --queues a,b,...     queues to run (default scq,scq-linearizable)\n"
+		"  --experiment E       threads, queues or all (default all)\n"
+		"  --threads a,b,...    short-lived threads per queue "
+		"(default 1,16,64,256,1000)\n"
+		"  --wave N             threads started together (default 8)\n"
+		"  --items N            items enqueued by each thread (default 16)\n"
+		"  --live-queues a,...  queues alive while init is timed "
+		"(default 0,16,64,256,1000)\n"
+		"  --init-num N         init/destroy pairs per init thread "
+		"(default 256)\n"
+		"  --init-threads N     threads doing init/destroy at once "
+		"(default 1)\n"
+		"  --format json|csv    output format (default json)\n"
+		"  --lib PATH           relaxed library (default ../libscq.so)\n"
+		"  --lin-lib PATH       linearizable library "
+		"(default ../linearizable/libscq.so)\n", prog);
+}
+
+static void churn_parse_options(int argc, char **argv,
+	struct churn_options *options)
+{
+	static const struct option long_options[] = {
+		{ "queues", required_argument, NULL, 'q' },
+		{ "experiment", required_argument, NULL, 'e' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "wave", required_argument, NULL, 'w' },
+		{ "items", required_argument, NULL, 'n' },
+		{ "live-queues", required_argument, NULL, 'l' },
+		{ "init-num", required_argument, NULL, 'i' },
+		{ "init-threads", required_argument, NULL, 'T' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "lib", required_argument, NULL, 'L' },
+		{ "lin-lib", required_argument, NULL, 'I' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	static const int default_thread_counts[] = { 1, 16, 64, 256, 1000 };
+	static const int default_queue_counts[] = { 0, 16, 64, 256, 1000 };
+	struct churn_params *params = &options->params;
+	char *tok;
+	int opt;
+
+	memset(options, 0, sizeof(struct churn_options));
+	params->wave = 8;
+	params->items_per_thread = 16;
+	params->init_num = 256;
+	params->init_thread_num = 1;
+	params->run_threads = true;
+	params->run_queues = true;
+	options->format = CHURN_FORMAT_JSON;
+	options->relaxed_lib = "../libscq.so";
+	options->linearizable_lib = "../linearizable/libscq.so";
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			for (tok = strtok(optarg, ","); tok != NULL &&
+					options->queue_name_num < CHURN_MAX_LIST_NUM;
+					tok = strtok(NULL, ",")) {
+				options->queue_names[options->queue_name_num++] = tok;
+			}
+			break;
+		case 'e':
+			params->run_threads = (strcmp(optarg, "queues") != 0);
+			params->run_queues = (strcmp(optarg, "threads") != 0);
+			break;
+		case 't':
+			params->thread_count_num = churn_parse_list(optarg,
+				params->thread_counts, 1);
+			break;
+		case 'w':
+			params->wave = atoi(optarg);
+			break;
+		case 'n':
+			params->items_per_thread = atoi(optarg);
+			break;
+		case 'l':
+			params->queue_count_num = churn_parse_list(optarg,
+				params->queue_counts, 0);
+			break;
+		case 'i':
+			params->init_num = atoi(optarg);
+			break;
+		case 'T':
+			params->init_thread_num = atoi(optarg);
+			break;
+		case 'f':
+			options->format = (strcmp(optarg, "csv") == 0) ?
+				CHURN_FORMAT_CSV : CHURN_FORMAT_JSON;
+			break;
+		case 'L':
+			options->relaxed_lib = optarg;
+			break;
+		case 'I':
+			options->linearizable_lib = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	/* Every init thread holds one more id while it runs */
+	if (params->wave < 1 || params->wave > BENCH_MAX_THREAD_NUM ||
+			params->items_per_thread < 2 || params->init_num < 1 ||
+			params->init_thread_num < 1 || params->init_thread_num > 16) {
+		fprintf(stderr, "churn: parameters out of range\n");
+		exit(1);
+	}
+
+	if (params->thread_count_num == 0) {
+		memcpy(params->thread_counts, default_thread_counts,
+			sizeof(default_thread_counts));
+		params->thread_count_num = 5;
+	}
+
+	if (params->queue_count_num == 0) {
+		memcpy(params->queue_counts, default_queue_counts,
+			sizeof(default_queue_counts));
+		params->queue_count_num = 5;
+	}
+
+	if (options->queue_name_num == 0) {
+		options->queue_names[0] = "scq";
+		options->queue_names[1] = "scq-linearizable";
+		options->queue_name_num = 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const struct bench_queue_ops *ops_arr[CHURN_MAX_LIST_NUM];
+	struct churn_options options;
+	int ops_num = 0;
+
+	churn_parse_options(argc, argv, &options);
+	bench_queue_register(options.relaxed_lib, options.linearizable_lib);
+
+	for (int q = 0; q < options.queue_name_num; q++) {
+		ops_arr[ops_num] = bench_queue_find(options.queue_names[q]);
+		if (ops_arr[ops_num] == NULL) {
+			fprintf(stderr, "churn: unknown queue %s\n",
+				options.queue_names[q]);
+			continue;
+		}
+		ops_num++;
+	}
+
+	if (options.format == CHURN_FORMAT_JSON) {
+		printf("{\n  \"tsc_per_ns\": %.4f,\n", bench_tsc_per_ns());
+	}
+
+	if (options.params.run_threads) {
+		churn_threads(&options, ops_arr, ops_num);
+	}
+
+	if (options.params.run_threads && options.params.run_queues) {
+		printf(options.format == CHURN_FORMAT_JSON ? ",\n" : "\n");
+	}
+
+	if (options.params.run_queues) {
+		churn_queues(&options, ops_arr, ops_num);
+	}
+
+	if (options.format == CHURN_FORMAT_JSON) {
+		printf("\n}\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * FAA array queue (Ramalhete and Correia), the simpler sibling of LCRQ: a
+ * linked list of segments, where enqueue and dequeue claim a slot of the
+ * current segment with one fetch-and-add and a new segment is appended
+ * Michael-Scott style once it is used up. Unlike LCRQ it needs no double-width
+ * CAS.
+ *
+ * The original frees segments with hazard pointers. Here dequeued segments are
+ * kept on a retired list until destroy, which costs 8 bytes per item that
+ * passed through the queue but keeps the fast path identical.
+ */
+
+#define FAA_SEGMENT_SIZE (1024)
+
+/* Slot values, items are stored as datum + 1 */
+#define FAA_SLOT_EMPTY (0ULL)
+#define FAA_SLOT_TAKEN (UINT64_MAX)
+
+/*
+ * faa_segment - Segment of the queue
+ * @deq_idx: next slot to dequeue, may run past FAA_SEGMENT_SIZE
+ * @enq_idx: next slot to enqueue, may run past FAA_SEGMENT_SIZE
+ * @next: next segment
+ * @retired_next: next retired segment
+ * @slots: items
+ */
+struct faa_segment {
+	_Atomic uint64_t deq_idx __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic uint64_t enq_idx __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic(struct faa_segment *) next
+		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	struct faa_segment *retired_next;
+	_Atomic uint64_t slots[FAA_SEGMENT_SIZE];
+};
+
+/*
+ * faa_array_queue - FAA array queue
+ * @head: segment being dequeued
+ * @tail: segment being enqueued
+ * @retired: segments already dequeued
+ */
+struct faa_array_queue {
+	_Atomic(struct faa_segment *) head
+		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic(struct faa_segment *) tail
+		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic(struct faa_segment *) retired
+		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+};
+
+static struct faa_segment *faa_segment_alloc(uint64_t first)
+{
+	struct faa_segment *seg = aligned_alloc(BENCH_CACHE_LINE_SIZE,
+		sizeof(struct faa_segment));
+
+	if (seg == NULL) {
+		return NULL;
+	}
+
+	memset(seg, 0, sizeof(struct faa_segment));
+
+	/* A segment appended by an enqueue already holds its item */
+	if (first != FAA_SLOT_EMPTY) {
+		atomic_init(&seg->slots[0], first);
+		atomic_init(&seg->enq_idx, 1);
+	}
+
+	return seg;
+}
+
+static void faa_segment_retire(struct faa_array_queue *q,
+	struct faa_segment *seg)
+{
+	seg->retired_next = atomic_load(&q->retired);
+	while (!atomic_compare_exchange_weak(&q->retired, &seg->retired_next,
+			seg)) {
+	}
+}
+
+static void *faa_array_queue_init(const struct bench_config *config)
+{
+	struct faa_array_queue *q;
+	struct faa_segment *seg;
+
+	(void)config;
+
+	q = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct faa_array_queue));
+	if (q == NULL) {
+		return NULL;
+	}
+
+	memset(q, 0, sizeof(struct faa_array_queue));
+
+	seg = faa_segment_alloc(FAA_SLOT_EMPTY);
+	if (seg == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	atomic_store(&q->head, seg);
+	atomic_store(&q->tail, seg);
+
+	return q;
+}
+
+static void faa_array_queue_destroy(void *queue)
+{
+	struct faa_array_queue *q = queue;
+	struct faa_segment *seg, *next;
+
+	seg = atomic_load(&q->head);
+	while (seg != NULL) {
+		next = atomic_load(&seg->next);
+		free(seg);
+		seg = next;
+	}
+
+	seg = atomic_load(&q->retired);
+	while (seg != NULL) {
+		next = seg->retired_next;
+		free(seg);
+		seg = next;
+	}
+
+	free(q);
+}
+
+static bool faa_array_queue_enqueue(void *queue, uint64_t datum)
+{
+	struct faa_array_queue *q = queue;
+	struct faa_segment *tail, *next, *seg;
+	uint64_t item = datum + 1, idx, empty;
+
+	while (true) {
+		tail = atomic_load(&q->tail);
+		idx = atomic_fetch_add(&tail->enq_idx, 1);
+
+		if (idx < FAA_SEGMENT_SIZE) {
+			empty = FAA_SLOT_EMPTY;
+			if (atomic_compare_exchange_strong(&tail->slots[idx], &empty,
+					item)) {
+				return true;
+			}
+
+			/* A dequeue gave up on this slot, take another one */
+			continue;
+		}
+
+		if (tail != atomic_load(&q->tail)) {
+			continue;
+		}
+
+		next = atomic_load(&tail->next);
+		if (next != NULL) {
+			atomic_compare_exchange_strong(&q->tail, &tail, next);
+			continue;
+		}
+
+		seg = faa_segment_alloc(item);
+		if (seg == NULL) {
+			return false;
+		}
+
+		if (atomic_compare_exchange_strong(&tail->next, &next, seg)) {
+			atomic_compare_exchange_strong(&q->tail, &tail, seg);
+			return true;
+		}
+
+		free(seg);
+	}
+}
+
+static bool faa_array_queue_dequeue(void *queue, uint64_t *datum)
+{
+	struct faa_array_queue *q = queue;
+	struct faa_segment *head, *next;
+	uint64_t idx, item;
+
+	while (true) {
+		head = atomic_load(&q->head);
+
+		if (atomic_load(&head->deq_idx) >= atomic_load(&head->enq_idx) &&
+				atomic_load(&head->next) == NULL) {
+			return false;
+		}
+
+		idx = atomic_fetch_add(&head->deq_idx, 1);
+
+		if (idx >= FAA_SEGMENT_SIZE) {
+			next = atomic_load(&head->next);
+			if (next == NULL) {
+				return false;
+			}
+
+			if (atomic_compare_exchange_strong(&q->head, &head, next)) {
+				faa_segment_retire(q, head);
+			}
+
+			continue;
+		}
+
+		item = atomic_exchange(&head->slots[idx], FAA_SLOT_TAKEN);
+		if (item != FAA_SLOT_EMPTY) {
+			*datum = item - 1;
+			return true;
+		}
+	}
+}
+
+const struct bench_queue_ops bench_faa_array_queue_ops = {
+	.name = "faa-array",
+	.init = faa_array_queue_init,
+	.destroy = faa_array_queue_destroy,
+	.enqueue = faa_array_queue_enqueue,
+	.dequeue = faa_array_queue_dequeue,
+};
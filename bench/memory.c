@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Memory footprint over burst, drain and idle cycles. The same threads run
+ * every cycle, so that per-thread recycling (the relaxed queue's free node
+ * lists) is exercised the way a long running service would.
+ *
+ * Heap numbers come from malloc_info(), which unlike mallinfo2() covers every
+ * arena and not only the main one.
+ */
+
+#define MEM_MAX_LIST_NUM (32)
+
+#define MEM_PHASE_BURST (0)
+#define MEM_PHASE_DRAIN (1)
+#define MEM_PHASE_IDLE (2)
+
+#define MEM_FORMAT_JSON (0)
+#define MEM_FORMAT_CSV (1)
+
+/*
+ * mem_snapshot - Memory of the process at one point
+ * @rss_kb: resident set size
+ * @peak_rss_kb: high water mark of the resident set size
+ * @heap_system_kb: obtained by malloc from the system, mmap'd chunks included
+ * @heap_free_kb: free bytes kept inside the malloc arenas
+ * @heap_used_kb: the rest, handed out to the program
+ * @held_nodes: see bench_queue_ops, -1 if unknown
+ */
+struct mem_snapshot {
+	uint64_t rss_kb;
+	uint64_t peak_rss_kb;
+	uint64_t heap_system_kb;
+	uint64_t heap_free_kb;
+	uint64_t heap_used_kb;
+	int64_t held_nodes;
+};
+
+/*
+ * mem_params - One run
+ * @item_num: items enqueued by each burst, over all producers
+ * @cycle_num: burst, drain and idle cycles
+ * @idle_ms: length of the idle phase
+ */
+struct mem_params {
+	int producer_num;
+	int consumer_num;
+	uint64_t item_num;
+	int cycle_num;
+	int idle_ms;
+	bool pin;
+};
+
+struct mem_worker {
+	pthread_t thread;
+	struct mem_run *run;
+	int idx;
+	bool producer;
+} __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+
+/*
+ * mem_run - Threads of one queue
+ * @barrier: separates the phases, the main thread measures between them
+ * @queued_cnt: items enqueued by the current burst, less than item_num if a
+ * bounded queue filled up
+ * @consumed_cnt: items taken in the current drain
+ */
+struct mem_run {
+	const struct bench_queue_ops *ops;
+	const struct mem_params *params;
+	void *queue;
+	pthread_barrier_t barrier;
+	_Atomic uint64_t queued_cnt;
+	_Atomic uint64_t consumed_cnt;
+	struct mem_worker workers[2 * BENCH_MAX_THREAD_NUM];
+};
+
+struct mem_options {
+	const char *queue_names[MEM_MAX_LIST_NUM];
+	int queue_name_num;
+	struct mem_params params;
+	int format;
+	const char *relaxed_lib;
+	const char *linearizable_lib;
+};
+
+static const char *mem_phase_names[] = { "burst", "drain", "idle" };
+
+static uint64_t mem_status_kb(const char *key)
+{
+	char line[256];
+	uint64_t value = 0;
+	size_t len = strlen(key);
+	FILE *fp = fopen("/proc/self/status", "r");
+
+	if (fp == NULL) {
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, key, len) == 0 && line[len] == ':') {
+			value = strtoull(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	return value;
+}
+
+/*
+ * The global totals are the last <total>, <system> and <aspace> elements of
+ * malloc_info(), after the per-arena ones.
+ */
+static uint64_t mem_xml_last(const char *xml, const char *prefix)
+{
+	const char *p = xml, *found = NULL, *size;
+
+	while ((p = strstr(p, prefix)) != NULL) {
+		found = p;
+		p += strlen(prefix);
+	}
+
+	if (found == NULL || (size = strstr(found, "size=\"")) == NULL) {
+		return 0;
+	}
+
+	return strtoull(size + 6, NULL, 10);
+}
+
+static void mem_snapshot_take(const struct mem_run *run,
+	struct mem_snapshot *snap)
+{
+	uint64_t free_bytes, system_bytes, mmap_bytes;
+	char *xml = NULL;
+	size_t xml_len = 0;
+	FILE *fp;
+
+	memset(snap, 0, sizeof(struct mem_snapshot));
+	snap->rss_kb = mem_status_kb("VmRSS");
+	snap->peak_rss_kb = mem_status_kb("VmHWM");
+	snap->held_nodes = (run->ops->held_nodes != NULL) ?
+		run->ops->held_nodes(run->queue) : -1;
+
+	fp = open_memstream(&xml, &xml_len);
+	if (fp == NULL) {
+		return;
+	}
+
+	malloc_info(0, fp);
+	fclose(fp);
+
+	free_bytes = mem_xml_last(xml, "<total type=\"fast\"")
+		+ mem_xml_last(xml, "<total type=\"rest\"");
+	mmap_bytes = mem_xml_last(xml, "<total type=\"mmap\"");
+	system_bytes = mem_xml_last(xml, "<system type=\"current\"");
+
+	snap->heap_system_kb = (system_bytes + mmap_bytes) / 1024;
+	snap->heap_free_kb = free_bytes / 1024;
+	snap->heap_used_kb = snap->heap_system_kb - snap->heap_free_kb;
+
+	free(xml);
+}
+
+static void *mem_worker_main(void *arg)
+{
+	struct mem_worker *worker = arg;
+	struct mem_run *run = worker->run;
+	const struct mem_params *params = run->params;
+	uint64_t share, datum, queued_cnt;
+	int spin_cnt;
+
+	if (params->pin) {
+		bench_pin_thread(worker->idx);
+	}
+
+	/* The first producers take the remainder */
+	share = params->item_num / (uint64_t)params->producer_num;
+	if ((uint64_t)worker->idx < params->item_num % (uint64_t)params->producer_num) {
+		share++;
+	}
+
+	for (int cycle = 0; cycle < params->cycle_num; cycle++) {
+		pthread_barrier_wait(&run->barrier);
+
+		/* Nobody dequeues during a burst, so a full queue stays full */
+		if (worker->producer) {
+			for (uint64_t i = 0; i < share; i++) {
+				if (!run->ops->enqueue(run->queue, i)) {
+					break;
+				}
+				atomic_fetch_add(&run->queued_cnt, 1);
+			}
+		}
+
+		pthread_barrier_wait(&run->barrier);
+		pthread_barrier_wait(&run->barrier);
+
+		if (!worker->producer) {
+			spin_cnt = 0;
+			queued_cnt = atomic_load(&run->queued_cnt);
+			while (atomic_load(&run->consumed_cnt) < queued_cnt) {
+				if (run->ops->dequeue(run->queue, &datum)) {
+					atomic_fetch_add(&run->consumed_cnt, 1);
+					spin_cnt = 0;
+				} else {
+					bench_backoff(&spin_cnt);
+				}
+			}
+		}
+
+		pthread_barrier_wait(&run->barrier);
+
+		/* The idle phase passes while the main thread sleeps */
+	}
+
+	return NULL;
+}
+
+static void mem_print_header(const struct mem_options *options)
+{
+	if (options->format == MEM_FORMAT_CSV) {
+		printf("queue,producers,consumers,items,cycle,phase,rss_kb,"
+			"peak_rss_kb,heap_system_kb,heap_used_kb,heap_free_kb,"
+			"fragmentation,heap_bytes_per_item,rss_bytes_per_item,"
+			"held_nodes\n");
+		return;
+	}
+
+	printf("{\n  \"results\": [");
+}
+
+/*
+ * Print one phase. Per item numbers compare against the start of the cycle,
+ * so a burst shows what queued items cost and a drain or idle shows what is
+ * kept after they are gone.
+ */
+static void mem_print_row(const struct mem_options *options,
+	const struct mem_run *run, int cycle, int phase,
+	const struct mem_snapshot *base, const struct mem_snapshot *snap,
+	bool first)
+{
+	const struct mem_params *params = run->params;
+	uint64_t item_num = atomic_load(&run->queued_cnt);
+	double divisor = (item_num == 0) ? 1.0 : (double)item_num;
+	double heap_per_item = ((double)snap->heap_used_kb
+		- (double)base->heap_used_kb) * 1024.0 / divisor;
+	double rss_per_item = ((double)snap->rss_kb - (double)base->rss_kb)
+		* 1024.0 / divisor;
+	double fragmentation = (snap->heap_system_kb == 0) ? 0.0
+		: (double)snap->heap_free_kb / (double)snap->heap_system_kb;
+	char held[32];
+
+	if (snap->held_nodes >= 0) {
+		snprintf(held, sizeof(held), "%ld", snap->held_nodes);
+	} else {
+		snprintf(held, sizeof(held), "%s",
+			(options->format == MEM_FORMAT_CSV) ? "" : "null");
+	}
+
+	if (options->format == MEM_FORMAT_CSV) {
+		printf("%s,%d,%d,%lu,%d,%s,%lu,%lu,%lu,%lu,%lu,%.4f,%.2f,%.2f,%s\n",
+			run->ops->name, params->producer_num, params->consumer_num,
+			item_num, cycle, mem_phase_names[phase], snap->rss_kb,
+			snap->peak_rss_kb, snap->heap_system_kb, snap->heap_used_kb,
+			snap->heap_free_kb, fragmentation, heap_per_item, rss_per_item,
+			held);
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"queue\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+		"\"items\": %lu, \"cycle\": %d, \"phase\": \"%s\",\n",
+		first ? "" : ",", run->ops->name, params->producer_num,
+		params->consumer_num, item_num, cycle,
+		mem_phase_names[phase]);
+	printf("     \"rss_kb\": %lu, \"peak_rss_kb\": %lu, \"heap_system_kb\": %lu, "
+		"\"heap_used_kb\": %lu, \"heap_free_kb\": %lu,\n",
+		snap->rss_kb, snap->peak_rss_kb, snap->heap_system_kb,
+		snap->heap_used_kb, snap->heap_free_kb);
+	printf("     \"fragmentation\": %.4f, \"heap_bytes_per_item\": %.2f, "
+		"\"rss_bytes_per_item\": %.2f, \"held_nodes\": %s}",
+		fragmentation, heap_per_item, rss_per_item, held);
+	fflush(stdout);
+}
+
+static bool mem_run_queue(const struct mem_options *options,
+	const struct bench_queue_ops *ops, bool *first)
+{
+	const struct mem_params *params = &options->params;
+	struct timespec idle = { params->idle_ms / 1000,
+		(long)(params->idle_ms % 1000) * 1000000L };
+	struct mem_snapshot base, snap;
+	struct bench_config config;
+	struct mem_run *run;
+	int thread_num = params->producer_num + params->consumer_num;
+	FILE *fp;
+
+	run = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct mem_run));
+	if (run == NULL) {
+		return false;
+	}
+
+	memset(run, 0, sizeof(struct mem_run));
+	memset(&config, 0, sizeof(config));
+	config.producer_num = params->producer_num;
+	config.consumer_num = params->consumer_num;
+
+	run->ops = ops;
+	run->params = params;
+
+	/* Reset the peak RSS, so that it belongs to this queue (Linux 4.0+) */
+	fp = fopen("/proc/self/clear_refs", "w");
+	if (fp != NULL) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+
+	run->queue = ops->init(&config);
+	if (run->queue == NULL) {
+		fprintf(stderr, "memory: %s init failed\n", ops->name);
+		free(run);
+		return false;
+	}
+
+	pthread_barrier_init(&run->barrier, NULL, (unsigned)thread_num + 1);
+
+	for (int i = 0; i < thread_num; i++) {
+		run->workers[i].run = run;
+		run->workers[i].producer = (i < params->producer_num);
+		run->workers[i].idx = run->workers[i].producer ? i
+			: i - params->producer_num;
+		pthread_create(&run->workers[i].thread, NULL, mem_worker_main,
+			&run->workers[i]);
+	}
+
+	for (int cycle = 0; cycle < params->cycle_num; cycle++) {
+		mem_snapshot_take(run, &base);
+		atomic_store(&run->queued_cnt, 0);
+		atomic_store(&run->consumed_cnt, 0);
+
+		pthread_barrier_wait(&run->barrier);
+		pthread_barrier_wait(&run->barrier);
+		mem_snapshot_take(run, &snap);
+		mem_print_row(options, run, cycle, MEM_PHASE_BURST, &base, &snap,
+			*first);
+		*first = false;
+
+		pthread_barrier_wait(&run->barrier);
+		pthread_barrier_wait(&run->barrier);
+		mem_snapshot_take(run, &snap);
+		mem_print_row(options, run, cycle, MEM_PHASE_DRAIN, &base, &snap,
+			false);
+
+		nanosleep(&idle, NULL);
+		mem_snapshot_take(run, &snap);
+		mem_print_row(options, run, cycle, MEM_PHASE_IDLE, &base, &snap,
+			false);
+	}
+
+	for (int i = 0; i < thread_num; i++) {
+		pthread_join(run->workers[i].thread, NULL);
+	}
+
+	pthread_barrier_destroy(&run->barrier);
+	ops->destroy(run->queue);
+	free(run);
+
+	/* Give the next queue a clean start */
+	malloc_trim(0);
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --queues a,b,...     queues to run (default scq,scq-linearizable)\n"
+		"  --producers N        producer threads (default 4)\n"
+		"  --consumers N        consumer threads (default 4)\n"
+		"  --items N            items per burst (default 1000000)\n"
+		"  --cycles N           burst/drain/idle cycles (default 3)\n"
+		"  --idle-ms N          length of the idle phase (default 200)\n"
+		"  --no-pin             do not pin threads\n"
+		"  --format json|csv    output format (default json)\n"
+		"  --lib PATH           relaxed library (default ../libscq.so)\n"
+		"  --lin-lib PATH       linearizable library "
+		"(default ../linearizable/libscq.so)\n", prog);
+}
+
+static void mem_parse_options(int argc, char **argv,
+	struct mem_options *options)
+{
+	static const struct option long_options[] = {
+		{ "queues", required_argument, NULL, 'q' },
+		{ "producers", required_argument, NULL, 'p' },
+		{ "consumers", required_argument, NULL, 'c' },
+		{ "items", required_argument, NULL, 'n' },
+		{ "cycles", required_argument, NULL, 'C' },
+		{ "idle-ms", required_argument, NULL, 'i' },
+		{ "no-pin", no_argument, NULL, 'N' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "lib", required_argument, NULL, 'L' },
+		{ "lin-lib", required_argument, NULL, 'I' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct mem_params *params = &options->params;
+	char *tok;
+	int opt;
+
+	memset(options, 0, sizeof(struct mem_options));
+	params->producer_num = 4;
+	params->consumer_num = 4;
+	params->item_num = 1000000;
+	params->cycle_num = 3;
+	params->idle_ms = 200;
+	params->pin = true;
+	options->format = MEM_FORMAT_JSON;
+	options->relaxed_lib = "../libscq.so";
+	options->linearizable_lib = "../linearizable/libscq.so";
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			for (tok = strtok(optarg, ","); tok != NULL &&
+					options->queue_name_num < MEM_MAX_LIST_NUM;
+					tok = strtok(NULL, ",")) {
+				options->queue_names[options->queue_name_num++] = tok;
+			}
+			break;
+		case 'p':
+			params->producer_num = atoi(optarg);
+			break;
+		case 'c':
+			params->consumer_num = atoi(optarg);
+			break;
+		case 'n':
+			params->item_num = strtoull(optarg, NULL, 10);
+			break;
+		case 'C':
+			params->cycle_num = atoi(optarg);
+			break;
+		case 'i':
+			params->idle_ms = atoi(optarg);
+			break;
+		case 'N':
+			params->pin = false;
+			break;
+		case 'f':
+			options->format = (strcmp(optarg, "csv") == 0) ?
+				MEM_FORMAT_CSV : MEM_FORMAT_JSON;
+			break;
+		case 'L':
+			options->relaxed_lib = optarg;
+			break;
+		case 'I':
+			options->linearizable_lib = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (params->producer_num < 1 || params->producer_num > BENCH_MAX_THREAD_NUM ||
+			params->consumer_num < 1 ||
+			params->consumer_num > BENCH_MAX_THREAD_NUM ||
+			params->item_num == 0 || params->cycle_num < 1) {
+		fprintf(stderr, "memory: parameters out of range\n");
+		exit(1);
+	}
+
+	if (options->queue_name_num == 0) {
+		options->queue_names[0] = "scq";
+		options->queue_names[1] = "scq-linearizable";
+		options->queue_name_num = 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const struct bench_queue_ops *ops;
+	struct mem_options options;
+	bool first = true;
+
+	mem_parse_options(argc, argv, &options);
+	bench_queue_register(options.relaxed_lib, options.linearizable_lib);
+
+	mem_print_header(&options);
+
+	for (int q = 0; q < options.queue_name_num; q++) {
+		ops = bench_queue_find(options.queue_names[q]);
+		if (ops == NULL) {
+			fprintf(stderr, "memory: unknown queue %s\n",
+				options.queue_names[q]);
+			continue;
+		}
+
+		if (ops->supports != NULL && !ops->supports(
+				options.params.producer_num, options.params.consumer_num)) {
+			continue;
+		}
+
+		mem_run_queue(&options, ops, &first);
+	}
+
+	if (options.format == MEM_FORMAT_JSON) {
+		printf("\n  ]\n}\n");
+	}
+
+	return 0;
+}
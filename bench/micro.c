@@ -0,0 +1,616 @@
+/*
+ * The hot path functions are static, so the relaxed queue is compiled into
+ * this file instead of being loaded like in the other tools.
+ */
+#include "../scalable_queue.c"
+
+#include <getopt.h>
+
+#include "bench.h"
+
+/*
+ * Single thread, cycle counts of the relaxed queue's hot path components.
+ *
+ * Each sample times one call between two rdtscp, minus the median cost of an
+ * empty rdtscp pair. The thread plays both the enqueue and the dequeue thread
+ * of its own lane, so nothing is shared with other cpus and only the work of
+ * the component itself shows up.
+ *
+ * Hot samples run back to back after a warmup. Cold samples first walk an
+ * eviction buffer larger than the last level cache, so the queue, the lane
+ * and the nodes all come from memory.
+ */
+
+#define MICRO_MAX_LIST_NUM (16)
+
+#define MICRO_FORMAT_JSON (0)
+#define MICRO_FORMAT_CSV (1)
+
+/* Nodes moved around by the free list components */
+#define MICRO_POOL_NUM (1024)
+
+/* Items enqueued before each detach, the batch pops are taken from */
+#define MICRO_BATCH_NUM (64)
+
+#define MICRO_WARMUP_NUM (10000)
+
+/*
+ * micro_ctx - State shared by the components
+ * @scq: relaxed queue whose lane is this thread's
+ * @tls_data: this thread's lane of @scq
+ * @queued_num: items micro_enqueue() left in the lane
+ * @sublist: private sublist, appended to without touching @scq
+ * @pool: nodes appended to @sublist
+ * @pool_idx: next node of @pool
+ * @pile: nodes from malloc, freed once the component is done
+ * @pile_num: nodes in @pile
+ * @evict_buf: walked before every cold sample
+ */
+struct micro_ctx {
+	struct scalable_queue *scq;
+	struct scq_tls_data *tls_data;
+	int queued_num;
+	struct scq_sublist sublist;
+	struct scq_node pool[MICRO_POOL_NUM];
+	int pool_idx;
+	struct scq_node **pile;
+	int pile_num;
+	volatile uint8_t *evict_buf;
+	size_t evict_size;
+	uint64_t overhead;
+};
+
+/*
+ * micro_component - One component
+ * @name: reported name
+ * @sample: prepares the state, calls micro_begin() and returns micro_end()
+ * @finish: releases whatever the samples left behind, may be NULL
+ */
+struct micro_component {
+	const char *name;
+	uint64_t (*sample)(struct micro_ctx *ctx, bool cold);
+	void (*finish)(struct micro_ctx *ctx);
+};
+
+struct micro_options {
+	const char *component_names[MICRO_MAX_LIST_NUM];
+	int component_name_num;
+	int hot_num;
+	int cold_num;
+	int evict_mb;
+	int format;
+	bool pin;
+};
+
+static void micro_evict(struct micro_ctx *ctx)
+{
+	for (size_t i = 0; i < ctx->evict_size; i += BENCH_CACHE_LINE_SIZE) {
+		ctx->evict_buf[i]++;
+	}
+}
+
+/*
+ * Start a sample, after evicting the caches if it is a cold one. Everything
+ * the component needs must be set up before this.
+ */
+static inline uint64_t micro_begin(struct micro_ctx *ctx, bool cold)
+{
+	if (cold) {
+		micro_evict(ctx);
+	}
+
+	return bench_rdtscp();
+}
+
+static inline uint64_t micro_end(struct micro_ctx *ctx, uint64_t start)
+{
+	uint64_t cycles = bench_rdtscp() - start;
+
+	return (cycles > ctx->overhead) ? cycles - ctx->overhead : 0;
+}
+
+static uint64_t micro_check_init(struct micro_ctx *ctx, bool cold)
+{
+	uint64_t start = micro_begin(ctx, cold);
+
+	check_and_init_scq_tls_data(ctx->scq);
+
+	return micro_end(ctx, start);
+}
+
+/*
+ * The node goes straight back through the shared free list, so the local list
+ * is refilled once every MICRO_POOL_NUM samples, like a steady enqueue thread.
+ */
+static uint64_t micro_alloc_hit(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_node *node;
+	uint64_t start, cycles;
+
+	start = micro_begin(ctx, cold);
+	node = scq_allocate_node(ctx->scq, ctx->tls_data);
+	cycles = micro_end(ctx, start);
+
+	scq_free_nodes(ctx->scq, node, node, 1, ctx->tls_data->thread_idx);
+
+	return cycles;
+}
+
+/*
+ * The free list is emptied for the call and restored after it. Nodes are kept
+ * until the component is done, so malloc keeps carving new chunks as it does
+ * while a backlog builds up.
+ */
+static uint64_t micro_alloc_malloc(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_free_node_list *free_node_list
+		= &ctx->tls_data->free_node_list;
+	struct scq_free_node_list saved = *free_node_list;
+	struct scq_node *node;
+	uint64_t start, cycles;
+
+	free_node_list->local_head = NULL;
+	free_node_list->local_tail = NULL;
+	free_node_list->shared_sentinel.next = NULL;
+
+	start = micro_begin(ctx, cold);
+	node = scq_allocate_node(ctx->scq, ctx->tls_data);
+	cycles = micro_end(ctx, start);
+
+	free_node_list->local_head = saved.local_head;
+	free_node_list->local_tail = saved.local_tail;
+	free_node_list->shared_sentinel.next = saved.shared_sentinel.next;
+
+	ctx->pile[ctx->pile_num++] = node;
+
+	return cycles;
+}
+
+static void micro_alloc_malloc_finish(struct micro_ctx *ctx)
+{
+	while (ctx->pile_num > 0) {
+		free(ctx->pile[--ctx->pile_num]);
+	}
+}
+
+static void micro_sublist_reset(struct micro_ctx *ctx)
+{
+	ctx->sublist.shared_sentinel.next = NULL;
+	ctx->sublist.shared_tail = &ctx->sublist.shared_sentinel;
+	ctx->pool_idx = 0;
+}
+
+/*
+ * scq_sublist_append(), the fence, exchange and link of scq_enqueue(). The
+ * sublist is reset once every MICRO_POOL_NUM samples, so one of them finds it
+ * empty and stamps its head.
+ */
+static uint64_t micro_exchange_fence(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_node *node;
+	uint64_t start;
+
+	if (ctx->pool_idx == MICRO_POOL_NUM) {
+		micro_sublist_reset(ctx);
+	}
+
+	node = &ctx->pool[ctx->pool_idx++];
+	node->next = NULL;
+
+	start = micro_begin(ctx, cold);
+	scq_sublist_append(&ctx->sublist, node);
+
+	return micro_end(ctx, start);
+}
+
+/* Drain the lane, so the nodes go back to the free list */
+static void micro_drain(struct micro_ctx *ctx)
+{
+	uint64_t datum;
+
+	while (scq_dequeue(ctx->scq, &datum)) {
+	}
+
+	ctx->queued_num = 0;
+}
+
+/*
+ * The whole scq_enqueue(), node allocation included. The lane is drained
+ * outside the samples once every MICRO_BATCH_NUM enqueues, so one enqueue of a
+ * batch finds the sublist empty and stamps its head.
+ */
+static uint64_t micro_enqueue(struct micro_ctx *ctx, bool cold)
+{
+	uint64_t start, cycles;
+
+	if (ctx->queued_num == MICRO_BATCH_NUM) {
+		micro_drain(ctx);
+	}
+
+	start = micro_begin(ctx, cold);
+	scq_enqueue(ctx->scq, (uint64_t)ctx->queued_num);
+	cycles = micro_end(ctx, start);
+
+	ctx->queued_num++;
+
+	return cycles;
+}
+
+static void micro_fill_lane(struct micro_ctx *ctx)
+{
+	for (int i = 0; i < MICRO_BATCH_NUM; i++) {
+		scq_enqueue(ctx->scq, (uint64_t)i);
+	}
+}
+
+/*
+ * The last pop of every batch also returns it with scq_free_nodes(), which
+ * shows up in the tail.
+ */
+static uint64_t micro_pop(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_tls_data *tls_data = ctx->tls_data;
+	uint64_t start, cycles, datum;
+
+	if (tls_data->dequeued_node_list.local_head == NULL) {
+		micro_fill_lane(ctx);
+		scq_detach_lane(ctx->scq, tls_data, tls_data->thread_idx, &datum);
+	}
+
+	start = micro_begin(ctx, cold);
+	pop_from_dequeued_list(ctx->scq, tls_data, &datum,
+		tls_data->thread_idx);
+	cycles = micro_end(ctx, start);
+
+	return cycles;
+}
+
+/*
+ * Detaching includes popping the first node of the batch.
+ */
+static uint64_t micro_detach(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_tls_data *tls_data = ctx->tls_data;
+	uint64_t start, cycles, datum;
+
+	micro_fill_lane(ctx);
+
+	start = micro_begin(ctx, cold);
+	scq_detach_lane(ctx->scq, tls_data, tls_data->thread_idx, &datum);
+	cycles = micro_end(ctx, start);
+
+	while (pop_from_dequeued_list(ctx->scq, tls_data, &datum,
+			tls_data->thread_idx)) {
+	}
+
+	return cycles;
+}
+
+static uint64_t micro_free_nodes(struct micro_ctx *ctx, bool cold)
+{
+	struct scq_node *node = scq_allocate_node(ctx->scq, ctx->tls_data);
+	uint64_t start;
+
+	node->next = NULL;
+
+	start = micro_begin(ctx, cold);
+	scq_free_nodes(ctx->scq, node, node, 1, ctx->tls_data->thread_idx);
+
+	return micro_end(ctx, start);
+}
+
+static const struct micro_component micro_components[] = {
+	{ "check_init", micro_check_init, NULL },
+	{ "alloc_hit", micro_alloc_hit, NULL },
+	{ "alloc_malloc", micro_alloc_malloc, micro_alloc_malloc_finish },
+	{ "exchange_fence", micro_exchange_fence, NULL },
+	{ "enqueue", micro_enqueue, micro_drain },
+	{ "pop_dequeued", micro_pop, micro_drain },
+	{ "detach", micro_detach, NULL },
+	{ "free_nodes", micro_free_nodes, NULL },
+};
+
+#define MICRO_COMPONENT_NUM \
+	((int)(sizeof(micro_components) / sizeof(micro_components[0])))
+
+static int micro_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t micro_percentile(const uint64_t *sorted, int num,
+	double percentile)
+{
+	int idx = (int)(percentile * (double)(num - 1));
+
+	return sorted[idx];
+}
+
+/*
+ * Median cost of an empty rdtscp pair, subtracted from every sample.
+ */
+static uint64_t micro_overhead(int num, uint64_t *samples)
+{
+	uint64_t start;
+
+	for (int i = 0; i < num; i++) {
+		start = bench_rdtscp();
+		samples[i] = bench_rdtscp() - start;
+	}
+
+	qsort(samples, (size_t)num, sizeof(uint64_t), micro_cmp_u64);
+
+	return samples[num / 2];
+}
+
+static void micro_print_row(const struct micro_options *options,
+	const char *name, bool cold, uint64_t *samples, int num, bool first)
+{
+	double sum = 0.0, tsc_per_ns = bench_tsc_per_ns();
+	uint64_t p50, p90, p99;
+
+	qsort(samples, (size_t)num, sizeof(uint64_t), micro_cmp_u64);
+
+	for (int i = 0; i < num; i++) {
+		sum += (double)samples[i];
+	}
+
+	p50 = micro_percentile(samples, num, 0.50);
+	p90 = micro_percentile(samples, num, 0.90);
+	p99 = micro_percentile(samples, num, 0.99);
+
+	if (options->format == MICRO_FORMAT_CSV) {
+		printf("%s,%s,%d,%lu,%lu,%lu,%.1f,%.1f\n", name,
+			cold ? "cold" : "hot", num, p50, p90, p99, sum / num,
+			(double)p50 / tsc_per_ns);
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"component\": \"%s\", \"cache\": \"%s\", "
+		"\"samples\": %d,\n", first ? "" : ",", name, cold ? "cold" : "hot",
+		num);
+	printf("     \"cycles\": {\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, "
+		"\"mean\": %.1f}, \"p50_ns\": %.1f}", p50, p90, p99, sum / num,
+		(double)p50 / tsc_per_ns);
+	fflush(stdout);
+}
+
+static bool micro_selected(const struct micro_options *options,
+	const char *name)
+{
+	if (options->component_name_num == 0) {
+		return true;
+	}
+
+	for (int i = 0; i < options->component_name_num; i++) {
+		if (strcmp(options->component_names[i], name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void micro_run(const struct micro_options *options,
+	struct micro_ctx *ctx, uint64_t *samples)
+{
+	const struct micro_component *component;
+	bool first = true;
+
+	for (int c = 0; c < MICRO_COMPONENT_NUM; c++) {
+		component = &micro_components[c];
+		if (!micro_selected(options, component->name)) {
+			continue;
+		}
+
+		for (int i = 0; i < MICRO_WARMUP_NUM; i++) {
+			component->sample(ctx, false);
+		}
+
+		if (component->finish != NULL) {
+			component->finish(ctx);
+		}
+
+		for (int i = 0; i < options->hot_num; i++) {
+			samples[i] = component->sample(ctx, false);
+		}
+
+		if (component->finish != NULL) {
+			component->finish(ctx);
+		}
+
+		micro_print_row(options, component->name, false, samples,
+			options->hot_num, first);
+		first = false;
+
+		for (int i = 0; i < options->cold_num; i++) {
+			samples[i] = component->sample(ctx, true);
+		}
+
+		if (component->finish != NULL) {
+			component->finish(ctx);
+		}
+
+		micro_print_row(options, component->name, true, samples,
+			options->cold_num, false);
+	}
+}
+
+/*
+ * Register this thread's lane and stock its free list, so that every
+ * component starts from a lane in steady state.
+ */
+static bool micro_ctx_init(struct micro_ctx *ctx,
+	const struct micro_options *options)
+{
+	struct scq_node *head = NULL, *tail = NULL, *node;
+	int pile_max = MICRO_WARMUP_NUM;
+
+	if (options->hot_num > pile_max) {
+		pile_max = options->hot_num;
+	}
+
+	if (options->cold_num > pile_max) {
+		pile_max = options->cold_num;
+	}
+
+	memset(ctx, 0, sizeof(struct micro_ctx));
+	micro_sublist_reset(ctx);
+
+	ctx->scq = scq_init();
+	ctx->pile = malloc(sizeof(struct scq_node *) * (size_t)pile_max);
+	ctx->evict_size = (size_t)options->evict_mb << 20;
+	ctx->evict_buf = calloc(1, ctx->evict_size);
+
+	if (ctx->scq == NULL || ctx->pile == NULL || ctx->evict_buf == NULL) {
+		fprintf(stderr, "micro: out of memory\n");
+		return false;
+	}
+
+	check_and_init_scq_tls_data(ctx->scq);
+	ctx->tls_data = tls_data_ptr_arr[ctx->scq->scq_id];
+
+	for (int i = 0; i < MICRO_POOL_NUM; i++) {
+		node = scq_allocate_node(ctx->scq, ctx->tls_data);
+		node->next = head;
+		head = node;
+		if (tail == NULL) {
+			tail = node;
+		}
+	}
+
+	scq_free_nodes(ctx->scq, head, tail, MICRO_POOL_NUM,
+		ctx->tls_data->thread_idx);
+
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --components a,b,... components to run (default: all)\n"
+		"  --samples N          hot samples per component (default 100000)\n"
+		"  --cold-samples N     cold samples per component (default 200)\n"
+		"  --evict-mb N         eviction buffer, above the LLC (default 64)\n"
+		"  --no-pin             do not pin the thread\n"
+		"  --format json|csv    output format (default json)\n"
+		"components:", prog);
+
+	for (int i = 0; i < MICRO_COMPONENT_NUM; i++) {
+		fprintf(stderr, " %s", micro_components[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void micro_parse_options(int argc, char **argv,
+	struct micro_options *options)
+{
+	static const struct option long_options[] = {
+		{ "components", required_argument, NULL, 'C' },
+		{ "samples", required_argument, NULL, 's' },
+		{ "cold-samples", required_argument, NULL, 'c' },
+		{ "evict-mb", required_argument, NULL, 'e' },
+		{ "no-pin", no_argument, NULL, 'N' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	char *tok;
+	int opt;
+
+	memset(options, 0, sizeof(struct micro_options));
+	options->hot_num = 100000;
+	options->cold_num = 200;
+	options->evict_mb = 64;
+	options->format = MICRO_FORMAT_JSON;
+	options->pin = true;
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'C':
+			for (tok = strtok(optarg, ","); tok != NULL &&
+					options->component_name_num < MICRO_MAX_LIST_NUM;
+					tok = strtok(NULL, ",")) {
+				options->component_names[options->component_name_num++]
+					= tok;
+			}
+			break;
+		case 's':
+			options->hot_num = atoi(optarg);
+			break;
+		case 'c':
+			options->cold_num = atoi(optarg);
+			break;
+		case 'e':
+			options->evict_mb = atoi(optarg);
+			break;
+		case 'N':
+			options->pin = false;
+			break;
+		case 'f':
+			options->format = (strcmp(optarg, "csv") == 0) ?
+				MICRO_FORMAT_CSV : MICRO_FORMAT_JSON;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (options->hot_num < 1 || options->cold_num < 1 ||
+			options->evict_mb < 1) {
+		fprintf(stderr, "micro: parameters out of range\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct micro_options options;
+	struct micro_ctx *ctx;
+	uint64_t *samples;
+	int sample_max;
+
+	micro_parse_options(argc, argv, &options);
+
+	if (options.pin) {
+		bench_pin_thread(0);
+	}
+
+	sample_max = (options.hot_num > options.cold_num) ?
+		options.hot_num : options.cold_num;
+	samples = malloc(sizeof(uint64_t) * (size_t)sample_max);
+	ctx = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct micro_ctx));
+
+	if (samples == NULL || ctx == NULL || !micro_ctx_init(ctx, &options)) {
+		return 1;
+	}
+
+	ctx->overhead = micro_overhead(options.hot_num, samples);
+
+	if (options.format == MICRO_FORMAT_CSV) {
+		printf("component,cache,samples,p50_cycles,p90_cycles,p99_cycles,"
+			"mean_cycles,p50_ns\n");
+	} else {
+		printf("{\n  \"tsc_per_ns\": %.4f, \"timer_overhead_cycles\": %lu,\n"
+			"  \"results\": [", bench_tsc_per_ns(), ctx->overhead);
+	}
+
+	micro_run(&options, ctx, samples);
+
+	if (options.format == MICRO_FORMAT_JSON) {
+		printf("\n  ]\n}\n");
+	}
+
+	scq_destroy(ctx->scq);
+	free((void *)ctx->evict_buf);
+	free(ctx->pile);
+	free(ctx);
+	free(samples);
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * Michael-Scott queue, as in "Simple, Fast, and Practical Non-Blocking and
+ * Blocking Concurrent Queue Algorithms" (PODC '96).
+ *
+ * Like the paper, nodes are recycled through a free list instead of being
+ * returned to malloc, so a node can be read after it was dequeued and ABA is
+ * caught by a modification counter next to the pointer. x86-64 pointers use
+ * 48 bits, so the counter lives in the upper 16 bits of the same word and a
+ * plain 64-bit CAS is enough. Nodes come from the free list first and from
+ * malloc when it is empty.
+ *
+ * The free list is a single Treiber stack shared by every thread, as in the
+ * paper, so it is a contended point of its own. scalable_queue instead hands
+ * each dequeued batch back to its enqueue thread's list. The two are not the
+ * same allocation scheme. Per-thread lists would not keep the nodes
+ * type-stable for the dequeue threads still reading them, which the
+ * algorithm relies on.
+ */
+
+#define MS_PTR_BITS (48)
+#define MS_PTR_MASK ((1ULL << MS_PTR_BITS) - 1)
+
+/*
+ * ms_node - Queue node
+ * @next: tagged pointer to the next node
+ * @free_next: tagged pointer to the next free node, while on the free list
+ * @datum: the item
+ * @alloc_next: every node ever allocated, for destroy
+ */
+struct ms_node {
+	_Atomic uint64_t next;
+	_Atomic uint64_t free_next;
+	uint64_t datum;
+	struct ms_node *alloc_next;
+};
+
+/*
+ * ms_queue - Michael-Scott queue
+ * @head: tagged pointer to the dummy node
+ * @tail: tagged pointer to the last or second last node
+ * @free_top: tagged top of the free node stack
+ * @alloc_list: every node ever allocated
+ */
+struct ms_queue {
+	_Atomic uint64_t head __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic uint64_t tail __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic uint64_t free_top __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic(struct ms_node *) alloc_list
+		__attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+};
+
+static inline struct ms_node *ms_ptr(uint64_t tagged)
+{
+	return (struct ms_node *)(uintptr_t)(tagged & MS_PTR_MASK);
+}
+
+static inline uint64_t ms_pack(struct ms_node *node, uint64_t tagged_old)
+{
+	return (uint64_t)(uintptr_t)node
+		| (((tagged_old >> MS_PTR_BITS) + 1) << MS_PTR_BITS);
+}
+
+static struct ms_node *ms_alloc_node(struct ms_queue *q)
+{
+	uint64_t top = atomic_load(&q->free_top), next;
+	struct ms_node *node;
+
+	while (ms_ptr(top) != NULL) {
+		next = atomic_load(&ms_ptr(top)->free_next);
+		if (atomic_compare_exchange_weak(&q->free_top, &top,
+				ms_pack(ms_ptr(next), top))) {
+			return ms_ptr(top);
+		}
+	}
+
+	node = malloc(sizeof(struct ms_node));
+	if (node == NULL) {
+		return NULL;
+	}
+
+	atomic_init(&node->next, 0);
+	atomic_init(&node->free_next, 0);
+	node->alloc_next = atomic_load(&q->alloc_list);
+	while (!atomic_compare_exchange_weak(&q->alloc_list, &node->alloc_next,
+			node)) {
+	}
+
+	return node;
+}
+
+static void ms_free_node(struct ms_queue *q, struct ms_node *node)
+{
+	uint64_t top = atomic_load(&q->free_top);
+
+	do {
+		atomic_store(&node->free_next, top);
+	} while (!atomic_compare_exchange_weak(&q->free_top, &top,
+		ms_pack(node, top)));
+}
+
+static void *ms_queue_init(const struct bench_config *config)
+{
+	struct ms_queue *q;
+	struct ms_node *dummy;
+
+	(void)config;
+
+	q = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct ms_queue));
+	if (q == NULL) {
+		return NULL;
+	}
+
+	memset(q, 0, sizeof(struct ms_queue));
+
+	dummy = ms_alloc_node(q);
+	if (dummy == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	atomic_store(&q->head, ms_pack(dummy, 0));
+	atomic_store(&q->tail, ms_pack(dummy, 0));
+
+	return q;
+}
+
+static void ms_queue_destroy(void *queue)
+{
+	struct ms_queue *q = queue;
+	struct ms_node *node = atomic_load(&q->alloc_list), *next;
+
+	while (node != NULL) {
+		next = node->alloc_next;
+		free(node);
+		node = next;
+	}
+
+	free(q);
+}
+
+static bool ms_queue_enqueue(void *queue, uint64_t datum)
+{
+	struct ms_queue *q = queue;
+	struct ms_node *node = ms_alloc_node(q);
+	uint64_t tail, next;
+
+	if (node == NULL) {
+		return false;
+	}
+
+	node->datum = datum;
+	atomic_store(&node->next, ms_pack(NULL, atomic_load(&node->next)));
+
+	while (true) {
+		tail = atomic_load(&q->tail);
+		next = atomic_load(&ms_ptr(tail)->next);
+
+		if (tail != atomic_load(&q->tail)) {
+			continue;
+		}
+
+		if (ms_ptr(next) == NULL) {
+			if (atomic_compare_exchange_weak(&ms_ptr(tail)->next, &next,
+					ms_pack(node, next))) {
+				break;
+			}
+		} else {
+			atomic_compare_exchange_weak(&q->tail, &tail,
+				ms_pack(ms_ptr(next), tail));
+		}
+	}
+
+	atomic_compare_exchange_strong(&q->tail, &tail, ms_pack(node, tail));
+
+	return true;
+}
+
+static bool ms_queue_dequeue(void *queue, uint64_t *datum)
+{
+	struct ms_queue *q = queue;
+	uint64_t head, tail, next, value;
+
+	while (true) {
+		head = atomic_load(&q->head);
+		tail = atomic_load(&q->tail);
+		next = atomic_load(&ms_ptr(head)->next);
+
+		if (head != atomic_load(&q->head)) {
+			continue;
+		}
+
+		if (ms_ptr(head) == ms_ptr(tail)) {
+			if (ms_ptr(next) == NULL) {
+				return false;
+			}
+
+			atomic_compare_exchange_weak(&q->tail, &tail,
+				ms_pack(ms_ptr(next), tail));
+		} else {
+			/* The node may be recycled meanwhile, the CAS tells */
+			value = ms_ptr(next)->datum;
+
+			if (atomic_compare_exchange_weak(&q->head, &head,
+					ms_pack(ms_ptr(next), head))) {
+				break;
+			}
+		}
+	}
+
+	ms_free_node(q, ms_ptr(head));
+	*datum = value;
+
+	return true;
+}
+
+const struct bench_queue_ops bench_ms_queue_ops = {
+	.name = "ms-queue",
+	.init = ms_queue_init,
+	.destroy = ms_queue_destroy,
+	.enqueue = ms_queue_enqueue,
+	.dequeue = ms_queue_dequeue,
+};
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * A deque behind one mutex: a ring buffer that doubles when full. This is
+ * what a queue without any lock-free technique costs.
+ */
+
+#define MUTEX_QUEUE_INIT_CAPACITY (1024)
+
+/*
+ * mutex_queue - Mutex protected ring buffer
+ * @lock: protects everything below
+ * @buf: items
+ * @capacity: size of buf, a power of two
+ * @head: index of the oldest item
+ * @cnt: number of items
+ */
+struct mutex_queue {
+	pthread_mutex_t lock;
+	uint64_t *buf;
+	size_t capacity;
+	size_t head;
+	size_t cnt;
+};
+
+static void *mutex_queue_init(const struct bench_config *config)
+{
+	struct mutex_queue *q;
+
+	(void)config;
+
+	q = malloc(sizeof(struct mutex_queue));
+	if (q == NULL) {
+		return NULL;
+	}
+
+	memset(q, 0, sizeof(struct mutex_queue));
+
+	q->buf = malloc(sizeof(uint64_t) * MUTEX_QUEUE_INIT_CAPACITY);
+	if (q->buf == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	q->capacity = MUTEX_QUEUE_INIT_CAPACITY;
+	pthread_mutex_init(&q->lock, NULL);
+
+	return q;
+}
+
+static void mutex_queue_destroy(void *queue)
+{
+	struct mutex_queue *q = queue;
+
+	pthread_mutex_destroy(&q->lock);
+	free(q->buf);
+	free(q);
+}
+
+/*
+ * Double the buffer, unrolling the wrapped part so that the items stay in
+ * order from index 0. Called with the lock held.
+ */
+static bool mutex_queue_grow(struct mutex_queue *q)
+{
+	uint64_t *buf = malloc(sizeof(uint64_t) * q->capacity * 2);
+	size_t first = q->capacity - q->head;
+
+	if (buf == NULL) {
+		return false;
+	}
+
+	memcpy(buf, q->buf + q->head, sizeof(uint64_t) * first);
+	memcpy(buf + first, q->buf, sizeof(uint64_t) * q->head);
+
+	free(q->buf);
+	q->buf = buf;
+	q->head = 0;
+	q->capacity *= 2;
+
+	return true;
+}
+
+static bool mutex_queue_enqueue(void *queue, uint64_t datum)
+{
+	struct mutex_queue *q = queue;
+
+	pthread_mutex_lock(&q->lock);
+
+	if (q->cnt == q->capacity && !mutex_queue_grow(q)) {
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+
+	q->buf[(q->head + q->cnt) & (q->capacity - 1)] = datum;
+	q->cnt++;
+
+	pthread_mutex_unlock(&q->lock);
+
+	return true;
+}
+
+static bool mutex_queue_dequeue(void *queue, uint64_t *datum)
+{
+	struct mutex_queue *q = queue;
+
+	pthread_mutex_lock(&q->lock);
+
+	if (q->cnt == 0) {
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+
+	*datum = q->buf[q->head];
+	q->head = (q->head + 1) & (q->capacity - 1);
+	q->cnt--;
+
+	pthread_mutex_unlock(&q->lock);
+
+	return true;
+}
+
+const struct bench_queue_ops bench_mutex_queue_ops = {
+	.name = "mutex-deque",
+	.init = mutex_queue_init,
+	.destroy = mutex_queue_destroy,
+	.enqueue = mutex_queue_enqueue,
+	.dequeue = mutex_queue_dequeue,
+};
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Oversubscription scenarios: producers and consumers at 1x, 2x and 4x the
+# cpus of the run, for the relaxed queue as built and with preemption injected
+# between the shared_tail exchange and the link store. Prints one CSV, look at
+# lat_p999_ns and lat_max_ns next to the throughput. Fails if a run with more
+# threads than cpus counted no context switch, the counter would be broken.
+#
+# Environment:
+#   CPUS       cpus to run on (default: all of the affinity mask)
+#   CPU_QUOTA  percent of one cpu the run may use (default: no quota)
+#   OPS        items per producer per trial (default 200000)
+#   QUEUES     queues to run (default scq,scq-linearizable,ms-queue)
+#   EXTRA      more scq_bench arguments
+
+set -e
+cd "$(dirname "$0")"
+
+CPUS=${CPUS:-$(nproc)}
+OPS=${OPS:-200000}
+QUEUES=${QUEUES:-scq,scq-linearizable,ms-queue}
+
+ARGS="--cpus $CPUS --ops $OPS --trials 3 --payload scalar --format csv $EXTRA"
+if [ -n "$CPU_QUOTA" ]; then
+	ARGS="$ARGS --cpu-quota $CPU_QUOTA"
+fi
+
+# Each side gets half the threads
+HALF=$(( (CPUS + 1) / 2 ))
+COUNTS="$HALF,$(( HALF * 2 )),$(( HALF * 4 ))"
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+header=1
+run() {
+	if [ $header -eq 1 ]; then
+		./scq_bench $ARGS "$@" > "$OUT"
+		header=0
+	else
+		./scq_bench $ARGS "$@" | tail -n +2 >> "$OUT"
+	fi
+}
+
+run --label baseline --queues "$QUEUES" \
+	--producers "$COUNTS" --consumers "$COUNTS"
+run --label preempt-yield --lib ./libscq-preempt-yield.so --queues scq \
+	--producers "$COUNTS" --consumers "$COUNTS"
+run --label preempt-sleep --lib ./libscq-preempt-sleep.so --queues scq \
+	--producers "$COUNTS" --consumers "$COUNTS"
+
+cat "$OUT"
+
+# An empty column means the counters were turned off with --no-perf
+awk -F, -v cpus="$CPUS" '
+NR == 1 {
+	for (i = 1; i <= NF; i++) {
+		if ($i == "producers") p = i
+		if ($i == "consumers") c = i
+		if ($i == "context_switches_per_op") cs = i
+	}
+	next
+}
+$p + $c > cpus && $cs != "" && $cs + 0 == 0 {
+	printf "oversub: %s %s %sP/%sC counted no context switch\n",
+		$1, $2, $p, $c > "/dev/stderr"
+	bad = 1
+}
+END { exit bad }
+' "$OUT"
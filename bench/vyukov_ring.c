@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * Dmitry Vyukov's bounded MPMC queue. Every cell carries a sequence number
+ * telling whether it is ready for the enqueue or the dequeue of a given
+ * position, so both sides only CAS their own position counter. It has the
+ * same capacity as scq-bounded.
+ */
+
+/*
+ * vyukov_cell - One slot of the ring
+ * @seq: position this cell expects next, pos for an enqueue, pos + 1 for a
+ * dequeue
+ * @datum: the item
+ */
+struct vyukov_cell {
+	_Atomic uint64_t seq;
+	uint64_t datum;
+};
+
+/*
+ * vyukov_ring - Bounded MPMC ring
+ * @cells: capacity cells
+ * @mask: capacity - 1
+ * @enqueue_pos: next position to enqueue
+ * @dequeue_pos: next position to dequeue
+ */
+struct vyukov_ring {
+	struct vyukov_cell *cells;
+	uint64_t mask;
+	_Atomic uint64_t enqueue_pos __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+	_Atomic uint64_t dequeue_pos __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+};
+
+static void *vyukov_ring_init(const struct bench_config *config)
+{
+	struct vyukov_ring *ring;
+
+	(void)config;
+
+	ring = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct vyukov_ring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	memset(ring, 0, sizeof(struct vyukov_ring));
+
+	ring->cells = aligned_alloc(BENCH_CACHE_LINE_SIZE,
+		sizeof(struct vyukov_cell) * BENCH_RING_CAPACITY);
+	if (ring->cells == NULL) {
+		free(ring);
+		return NULL;
+	}
+
+	for (uint64_t i = 0; i < BENCH_RING_CAPACITY; i++) {
+		atomic_init(&ring->cells[i].seq, i);
+	}
+
+	ring->mask = BENCH_RING_CAPACITY - 1;
+
+	return ring;
+}
+
+static void vyukov_ring_destroy(void *queue)
+{
+	struct vyukov_ring *ring = queue;
+
+	free(ring->cells);
+	free(ring);
+}
+
+static bool vyukov_ring_enqueue(void *queue, uint64_t datum)
+{
+	struct vyukov_ring *ring = queue;
+	uint64_t pos = atomic_load_explicit(&ring->enqueue_pos,
+		memory_order_relaxed);
+	struct vyukov_cell *cell;
+	int64_t diff;
+
+	while (true) {
+		cell = &ring->cells[pos & ring->mask];
+		diff = (int64_t)(atomic_load_explicit(&cell->seq,
+			memory_order_acquire) - pos);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos,
+					&pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* The cell still holds the item of the previous lap */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&ring->enqueue_pos,
+				memory_order_relaxed);
+		}
+	}
+
+	cell->datum = datum;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+	return true;
+}
+
+static bool vyukov_ring_dequeue(void *queue, uint64_t *datum)
+{
+	struct vyukov_ring *ring = queue;
+	uint64_t pos = atomic_load_explicit(&ring->dequeue_pos,
+		memory_order_relaxed);
+	struct vyukov_cell *cell;
+	int64_t diff;
+
+	while (true) {
+		cell = &ring->cells[pos & ring->mask];
+		diff = (int64_t)(atomic_load_explicit(&cell->seq,
+			memory_order_acquire) - (pos + 1));
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos,
+					&pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = atomic_load_explicit(&ring->dequeue_pos,
+				memory_order_relaxed);
+		}
+	}
+
+	*datum = cell->datum;
+	atomic_store_explicit(&cell->seq, pos + ring->mask + 1,
+		memory_order_release);
+
+	return true;
+}
+
+const struct bench_queue_ops bench_vyukov_ring_ops = {
+	.name = "vyukov-ring",
+	.init = vyukov_ring_init,
+	.destroy = vyukov_ring_destroy,
+	.enqueue = vyukov_ring_enqueue,
+	.dequeue = vyukov_ring_dequeue,
+};
@@ -0,0 +1,779 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Open-loop workloads: producers send at a given rate instead of as fast as
+ * they can, and every item is stamped with the time it was *scheduled* to be
+ * sent. A producer that falls behind sends at once but keeps the scheduled
+ * stamp, so stalls show up in the latency instead of silently lowering the
+ * offered load.
+ */
+
+#define WL_MAX_LIST_NUM (32)
+#define WL_MAX_STAGE_NUM (8)
+
+/* Waits longer than this sleep, shorter ones spin */
+#define WL_SLEEP_THRESHOLD_NS (100000)
+
+/* How often the main thread checks whether the last stage is done */
+#define WL_POLL_NS (1000000)
+
+#define WL_ARRIVAL_POISSON (0)
+#define WL_ARRIVAL_BURSTY (1)
+
+#define WL_FORMAT_JSON (0)
+#define WL_FORMAT_CSV (1)
+
+/*
+ * wl_params - One workload
+ * @scenario: preset it came from
+ * @producer_num: producer threads
+ * @consumer_num: consumer threads per stage
+ * @stage_num: queues chained one after another, workers of a middle stage
+ * dequeue from one and enqueue into the next
+ * @arrival: WL_ARRIVAL_*
+ * @rate: items per second offered by all producers together
+ * @zipf_s: producer i gets a share of the rate proportional to 1 / (i + 1)^s,
+ * 0 for equal shares
+ * @burst_on_us: mean length of a burst
+ * @burst_off_us: mean pause between bursts
+ * @poll_us: consumers sleep this long after an empty dequeue, 0 to poll with
+ * the harness backoff
+ * @duration_ms: how long producers send
+ * @pin: pin threads to cpus round-robin
+ */
+struct wl_params {
+	const char *scenario;
+	int producer_num;
+	int consumer_num;
+	int stage_num;
+	int arrival;
+	double rate;
+	double zipf_s;
+	double burst_on_us;
+	double burst_off_us;
+	double poll_us;
+	int duration_ms;
+	bool pin;
+};
+
+/*
+ * wl_worker - One producer or stage worker
+ * @rate: items per second, producers only
+ * @rng: xorshift state
+ * @sent_cnt: items sent, producers only
+ * @consumed_cnt: items finished, last stage only, polled by the main thread
+ * @empty_cnt: dequeues that found nothing
+ * @hist: end-to-end latency in TSC cycles, last stage only
+ */
+struct wl_worker {
+	pthread_t thread;
+	struct wl_run *run;
+	int stage;
+	int cpu_idx;
+	double rate;
+	uint64_t rng;
+	uint64_t sent_cnt;
+	_Atomic uint64_t consumed_cnt;
+	uint64_t empty_cnt;
+	struct bench_hist *hist;
+} __attribute__((aligned(BENCH_CACHE_LINE_SIZE)));
+
+/*
+ * wl_run - One workload on one queue
+ * @queues: stage_num queues
+ * @start_tsc: when producers start sending
+ * @end_tsc: when they stop
+ * @done: set once the last stage has finished every item
+ */
+struct wl_run {
+	const struct bench_queue_ops *ops;
+	const struct wl_params *params;
+	struct bench_config configs[WL_MAX_STAGE_NUM];
+	void *queues[WL_MAX_STAGE_NUM];
+	pthread_barrier_t barrier;
+	uint64_t start_tsc;
+	uint64_t end_tsc;
+	_Atomic bool done;
+	struct wl_worker producers[BENCH_MAX_THREAD_NUM];
+	struct wl_worker consumers[WL_MAX_STAGE_NUM][BENCH_MAX_THREAD_NUM];
+};
+
+/*
+ * wl_result - What a run reports
+ */
+struct wl_result {
+	const char *queue_name;
+	uint64_t item_cnt;
+	uint64_t empty_cnt;
+	double achieved_rate;
+	struct bench_hist hist;
+};
+
+static uint64_t wl_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Exponentially distributed value with the given mean */
+static double wl_rand_exp(uint64_t *state, double mean)
+{
+	double u = ((double)(wl_rand(state) >> 11) + 1.0) / 9007199254740993.0;
+
+	return -log(u) * mean;
+}
+
+static void wl_wait_until(uint64_t target_tsc)
+{
+	double tsc_per_ns = bench_tsc_per_ns();
+	struct timespec ts;
+	uint64_t now_tsc;
+	double wait_ns;
+
+	while ((now_tsc = bench_rdtsc()) < target_tsc) {
+		wait_ns = (double)(target_tsc - now_tsc) / tsc_per_ns;
+
+		if (wait_ns > WL_SLEEP_THRESHOLD_NS) {
+			/* Wake up a little early, timers are late rather than early */
+			wait_ns -= WL_SLEEP_THRESHOLD_NS / 2;
+			ts.tv_sec = (time_t)(wait_ns / 1e9);
+			ts.tv_nsec = (long)(wait_ns - (double)ts.tv_sec * 1e9);
+			nanosleep(&ts, NULL);
+		} else {
+			__asm__ __volatile__("pause");
+		}
+	}
+}
+
+static void *wl_producer(void *arg)
+{
+	struct wl_worker *worker = arg;
+	struct wl_run *run = worker->run;
+	const struct wl_params *params = run->params;
+	double tsc_per_sec = bench_tsc_per_ns() * 1e9;
+	double duty = 1.0, gap_mean, on_mean = 0.0, off_mean = 0.0;
+	uint64_t next, on_end = UINT64_MAX;
+	int spin_cnt;
+
+	if (params->pin) {
+		bench_pin_thread(worker->cpu_idx);
+	}
+
+	/* Bursts send faster, so that the average stays at the given rate */
+	if (params->arrival == WL_ARRIVAL_BURSTY) {
+		duty = params->burst_on_us
+			/ (params->burst_on_us + params->burst_off_us);
+		on_mean = params->burst_on_us * tsc_per_sec / 1e6;
+		off_mean = params->burst_off_us * tsc_per_sec / 1e6;
+	}
+
+	gap_mean = tsc_per_sec * duty / worker->rate;
+
+	pthread_barrier_wait(&run->barrier);
+
+	next = run->start_tsc;
+	if (params->arrival == WL_ARRIVAL_BURSTY) {
+		/* Producers start at random points of their cycle */
+		next += (uint64_t)wl_rand_exp(&worker->rng, off_mean);
+		on_end = next + (uint64_t)wl_rand_exp(&worker->rng, on_mean);
+	}
+
+	while (true) {
+		next += (uint64_t)wl_rand_exp(&worker->rng, gap_mean);
+
+		if (next > on_end) {
+			next = on_end + (uint64_t)wl_rand_exp(&worker->rng, off_mean);
+			on_end = next + (uint64_t)wl_rand_exp(&worker->rng, on_mean);
+		}
+
+		if (next >= run->end_tsc) {
+			break;
+		}
+
+		wl_wait_until(next);
+
+		spin_cnt = 0;
+		while (!run->ops->enqueue(run->queues[0], (next << 1) | 1)) {
+			bench_backoff(&spin_cnt);
+		}
+
+		worker->sent_cnt++;
+	}
+
+	return NULL;
+}
+
+static void *wl_consumer(void *arg)
+{
+	struct wl_worker *worker = arg;
+	struct wl_run *run = worker->run;
+	const struct wl_params *params = run->params;
+	bool last = (worker->stage == params->stage_num - 1);
+	void *queue = run->queues[worker->stage];
+	uint64_t datum, consumed_cnt = 0;
+	struct timespec poll;
+	int spin_cnt = 0;
+
+	poll.tv_sec = 0;
+	poll.tv_nsec = (long)(params->poll_us * 1000.0);
+
+	if (params->pin) {
+		bench_pin_thread(worker->cpu_idx);
+	}
+
+	pthread_barrier_wait(&run->barrier);
+
+	while (!atomic_load_explicit(&run->done, memory_order_relaxed)) {
+		if (!run->ops->dequeue(queue, &datum)) {
+			worker->empty_cnt++;
+
+			if (poll.tv_nsec > 0) {
+				nanosleep(&poll, NULL);
+			} else {
+				bench_backoff(&spin_cnt);
+			}
+			continue;
+		}
+
+		spin_cnt = 0;
+
+		if (!last) {
+			while (!run->ops->enqueue(run->queues[worker->stage + 1], datum)) {
+				bench_backoff(&spin_cnt);
+			}
+			continue;
+		}
+
+		bench_hist_record(worker->hist, bench_rdtsc() - (datum >> 1));
+		atomic_store_explicit(&worker->consumed_cnt, ++consumed_cnt,
+			memory_order_relaxed);
+	}
+
+	return NULL;
+}
+
+/*
+ * Split the rate over the producers, following a Zipf distribution if
+ * zipf_s is set.
+ */
+static void wl_assign_rates(struct wl_run *run)
+{
+	const struct wl_params *params = run->params;
+	double weight_sum = 0.0;
+
+	for (int i = 0; i < params->producer_num; i++) {
+		run->producers[i].rate = pow((double)(i + 1), -params->zipf_s);
+		weight_sum += run->producers[i].rate;
+	}
+
+	for (int i = 0; i < params->producer_num; i++) {
+		run->producers[i].rate *= params->rate / weight_sum;
+	}
+}
+
+/*
+ * Whether every stage of the pipeline suits the queue.
+ */
+static bool wl_supports(const struct bench_queue_ops *ops,
+	const struct wl_params *params)
+{
+	if (ops->supports == NULL) {
+		return true;
+	}
+
+	if (!ops->supports(params->producer_num, params->consumer_num)) {
+		return false;
+	}
+
+	return params->stage_num == 1 ||
+		ops->supports(params->consumer_num, params->consumer_num);
+}
+
+static bool wl_run_workload(const struct bench_queue_ops *ops,
+	const struct wl_params *params, struct wl_result *result)
+{
+	struct timespec poll = { 0, WL_POLL_NS };
+	struct wl_run *run = NULL;
+	int thread_num, cpu_idx = 0;
+	uint64_t total = 0, consumed_cnt;
+	struct wl_worker *worker;
+	bool ok = false;
+
+	memset(result, 0, sizeof(struct wl_result));
+	result->queue_name = ops->name;
+
+	run = aligned_alloc(BENCH_CACHE_LINE_SIZE, sizeof(struct wl_run));
+	if (run == NULL) {
+		return false;
+	}
+
+	memset(run, 0, sizeof(struct wl_run));
+	run->ops = ops;
+	run->params = params;
+
+	for (int s = 0; s < params->stage_num; s++) {
+		run->configs[s].producer_num = (s == 0) ? params->producer_num
+			: params->consumer_num;
+		run->configs[s].consumer_num = params->consumer_num;
+
+		run->queues[s] = ops->init(&run->configs[s]);
+		if (run->queues[s] == NULL) {
+			fprintf(stderr, "workload: %s init failed\n", ops->name);
+			goto out;
+		}
+	}
+
+	thread_num = params->producer_num + params->stage_num * params->consumer_num;
+	pthread_barrier_init(&run->barrier, NULL, (unsigned)thread_num + 1);
+
+	wl_assign_rates(run);
+
+	for (int s = 0; s < params->stage_num; s++) {
+		for (int i = 0; i < params->consumer_num; i++) {
+			worker = &run->consumers[s][i];
+			worker->run = run;
+			worker->stage = s;
+			worker->cpu_idx = cpu_idx++;
+			worker->hist = calloc(1, sizeof(struct bench_hist));
+			pthread_create(&worker->thread, NULL, wl_consumer, worker);
+		}
+	}
+
+	for (int i = 0; i < params->producer_num; i++) {
+		worker = &run->producers[i];
+		worker->run = run;
+		worker->cpu_idx = cpu_idx++;
+		worker->rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+		pthread_create(&worker->thread, NULL, wl_producer, worker);
+	}
+
+	/* Leave the threads a moment to get going before the first item */
+	run->start_tsc = bench_rdtsc()
+		+ (uint64_t)(bench_tsc_per_ns() * WL_POLL_NS);
+	run->end_tsc = run->start_tsc + (uint64_t)(bench_tsc_per_ns()
+		* 1e6 * params->duration_ms);
+
+	pthread_barrier_wait(&run->barrier);
+
+	for (int i = 0; i < params->producer_num; i++) {
+		pthread_join(run->producers[i].thread, NULL);
+		total += run->producers[i].sent_cnt;
+	}
+
+	do {
+		consumed_cnt = 0;
+		for (int i = 0; i < params->consumer_num; i++) {
+			consumed_cnt += atomic_load_explicit(
+				&run->consumers[params->stage_num - 1][i].consumed_cnt,
+				memory_order_relaxed);
+		}
+
+		if (consumed_cnt < total) {
+			nanosleep(&poll, NULL);
+		}
+	} while (consumed_cnt < total);
+
+	atomic_store(&run->done, true);
+
+	for (int s = 0; s < params->stage_num; s++) {
+		for (int i = 0; i < params->consumer_num; i++) {
+			worker = &run->consumers[s][i];
+			pthread_join(worker->thread, NULL);
+
+			bench_hist_merge(&result->hist, worker->hist);
+			result->empty_cnt += worker->empty_cnt;
+			free(worker->hist);
+		}
+	}
+
+	pthread_barrier_destroy(&run->barrier);
+
+	result->item_cnt = total;
+	result->achieved_rate = (double)total / (params->duration_ms / 1000.0);
+	ok = true;
+
+out:
+	for (int s = 0; s < params->stage_num; s++) {
+		if (run->queues[s] != NULL) {
+			ops->destroy(run->queues[s]);
+		}
+	}
+
+	free(run);
+
+	return ok;
+}
+
+/*
+ * Scenario presets. Options given on the command line override them.
+ */
+static const struct wl_params wl_scenarios[] = {
+	{ .scenario = "poisson", .producer_num = 4, .consumer_num = 2,
+	  .stage_num = 1, .arrival = WL_ARRIVAL_POISSON, .rate = 1e6 },
+	{ .scenario = "bursty", .producer_num = 4, .consumer_num = 2,
+	  .stage_num = 1, .arrival = WL_ARRIVAL_BURSTY, .rate = 1e6,
+	  .burst_on_us = 200, .burst_off_us = 1800 },
+	{ .scenario = "zipf", .producer_num = 8, .consumer_num = 2,
+	  .stage_num = 1, .arrival = WL_ARRIVAL_POISSON, .rate = 1e6,
+	  .zipf_s = 1.1 },
+	{ .scenario = "polling", .producer_num = 2, .consumer_num = 4,
+	  .stage_num = 1, .arrival = WL_ARRIVAL_POISSON, .rate = 1e4 },
+	{ .scenario = "pipeline", .producer_num = 2, .consumer_num = 2,
+	  .stage_num = 3, .arrival = WL_ARRIVAL_POISSON, .rate = 5e5 },
+};
+
+#define WL_SCENARIO_NUM ((int)(sizeof(wl_scenarios) / sizeof(wl_scenarios[0])))
+
+/*
+ * wl_options - Command line, negative numbers are unset
+ */
+struct wl_options {
+	const char *scenario_names[WL_MAX_LIST_NUM];
+	int scenario_name_num;
+	const char *queue_names[WL_MAX_LIST_NUM];
+	int queue_name_num;
+	struct wl_params overrides;
+	int format;
+	const char *relaxed_lib;
+	const char *linearizable_lib;
+};
+
+static uint64_t wl_latency_ns(const struct bench_hist *hist, double percentile)
+{
+	return (uint64_t)((double)bench_hist_percentile(hist, percentile)
+		/ bench_tsc_per_ns());
+}
+
+static void wl_print_header(const struct wl_options *options)
+{
+	if (options->format == WL_FORMAT_CSV) {
+		printf("scenario,queue,producers,consumers,stages,offered_rate,"
+			"achieved_rate,items,empty_polls_per_item,lat_p50_ns,lat_p90_ns,"
+			"lat_p99_ns,lat_p999_ns,lat_max_ns\n");
+		return;
+	}
+
+	printf("{\n  \"machine\": {\"cpus\": %ld, \"tsc_per_ns\": %.4f},\n",
+		sysconf(_SC_NPROCESSORS_ONLN), bench_tsc_per_ns());
+	printf("  \"results\": [");
+}
+
+static void wl_print_result(const struct wl_options *options,
+	const struct wl_params *params, const struct wl_result *result,
+	bool first)
+{
+	const struct bench_hist *hist = &result->hist;
+	double empty_per_item = (result->item_cnt == 0) ? 0.0
+		: (double)result->empty_cnt / (double)result->item_cnt;
+
+	if (options->format == WL_FORMAT_CSV) {
+		printf("%s,%s,%d,%d,%d,%.0f,%.0f,%lu,%.3f,%lu,%lu,%lu,%lu,%lu\n",
+			params->scenario, result->queue_name, params->producer_num,
+			params->consumer_num, params->stage_num, params->rate,
+			result->achieved_rate, result->item_cnt, empty_per_item,
+			wl_latency_ns(hist, 0.5), wl_latency_ns(hist, 0.9),
+			wl_latency_ns(hist, 0.99), wl_latency_ns(hist, 0.999),
+			wl_latency_ns(hist, 1.0));
+		fflush(stdout);
+		return;
+	}
+
+	printf("%s\n    {\"scenario\": \"%s\", \"queue\": \"%s\", \"producers\": %d, "
+		"\"consumers\": %d, \"stages\": %d,\n",
+		first ? "" : ",", params->scenario, result->queue_name,
+		params->producer_num, params->consumer_num, params->stage_num);
+	printf("     \"offered_rate\": %.0f, \"achieved_rate\": %.0f, "
+		"\"items\": %lu, \"empty_polls_per_item\": %.3f,\n",
+		params->rate, result->achieved_rate, result->item_cnt, empty_per_item);
+	printf("     \"latency_ns\": {\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, "
+		"\"p999\": %lu, \"max\": %lu}}",
+		wl_latency_ns(hist, 0.5), wl_latency_ns(hist, 0.9),
+		wl_latency_ns(hist, 0.99), wl_latency_ns(hist, 0.999),
+		wl_latency_ns(hist, 1.0));
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --scenario a,b,...   poisson, bursty, zipf, polling, pipeline "
+		"(default: all)\n"
+		"  --queues a,b,...     queues to run (default scq,scq-linearizable)\n"
+		"  --producers N        producer threads\n"
+		"  --consumers N        consumer threads per stage\n"
+		"  --stages N           queues chained into a pipeline\n"
+		"  --rate N             items per second over all producers\n"
+		"  --zipf S             skew of the producer rates, 0 for equal\n"
+		"  --burst-on-us N      mean burst length\n"
+		"  --burst-off-us N     mean pause between bursts\n"
+		"  --poll-us N          consumer sleep after an empty dequeue\n"
+		"  --duration-ms N      how long producers send (default 2000)\n"
+		"  --no-pin             do not pin threads\n"
+		"  --format json|csv    output format (default json)\n"
+		"  --lib PATH           relaxed library (default ../libscq.so)\n"
+		"  --lin-lib PATH       linearizable library "
+		"(default ../linearizable/libscq.so)\n", prog);
+}
+
+static int wl_split(char *str, const char **items, int max)
+{
+	int n = 0;
+
+	for (char *tok = strtok(str, ","); tok != NULL && n < max;
+			tok = strtok(NULL, ",")) {
+		items[n++] = tok;
+	}
+
+	return n;
+}
+
+static void wl_parse_options(int argc, char **argv, struct wl_options *options)
+{
+	static const struct option long_options[] = {
+		{ "scenario", required_argument, NULL, 'S' },
+		{ "queues", required_argument, NULL, 'q' },
+		{ "producers", required_argument, NULL, 'p' },
+		{ "consumers", required_argument, NULL, 'c' },
+		{ "stages", required_argument, NULL, 's' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "zipf", required_argument, NULL, 'z' },
+		{ "burst-on-us", required_argument, NULL, 'o' },
+		{ "burst-off-us", required_argument, NULL, 'O' },
+		{ "poll-us", required_argument, NULL, 'P' },
+		{ "duration-ms", required_argument, NULL, 'd' },
+		{ "no-pin", no_argument, NULL, 'N' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "lib", required_argument, NULL, 'L' },
+		{ "lin-lib", required_argument, NULL, 'I' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct wl_params *o = &options->overrides;
+	int opt;
+
+	memset(options, 0, sizeof(struct wl_options));
+	o->producer_num = o->consumer_num = o->stage_num = -1;
+	o->rate = o->zipf_s = o->burst_on_us = o->burst_off_us = o->poll_us = -1.0;
+	o->duration_ms = 2000;
+	o->pin = true;
+	options->format = WL_FORMAT_JSON;
+	options->relaxed_lib = "../libscq.so";
+	options->linearizable_lib = "../linearizable/libscq.so";
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'S':
+			options->scenario_name_num = wl_split(optarg,
+				options->scenario_names, WL_MAX_LIST_NUM);
+			break;
+		case 'q':
+			options->queue_name_num = wl_split(optarg,
+				options->queue_names, WL_MAX_LIST_NUM);
+			break;
+		case 'p':
+			o->producer_num = atoi(optarg);
+			break;
+		case 'c':
+			o->consumer_num = atoi(optarg);
+			break;
+		case 's':
+			o->stage_num = atoi(optarg);
+			break;
+		case 'r':
+			o->rate = atof(optarg);
+			break;
+		case 'z':
+			o->zipf_s = atof(optarg);
+			break;
+		case 'o':
+			o->burst_on_us = atof(optarg);
+			break;
+		case 'O':
+			o->burst_off_us = atof(optarg);
+			break;
+		case 'P':
+			o->poll_us = atof(optarg);
+			break;
+		case 'd':
+			o->duration_ms = atoi(optarg);
+			break;
+		case 'N':
+			o->pin = false;
+			break;
+		case 'f':
+			options->format = (strcmp(optarg, "csv") == 0) ?
+				WL_FORMAT_CSV : WL_FORMAT_JSON;
+			break;
+		case 'L':
+			options->relaxed_lib = optarg;
+			break;
+		case 'I':
+			options->linearizable_lib = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (options->queue_name_num == 0) {
+		options->queue_names[0] = "scq";
+		options->queue_names[1] = "scq-linearizable";
+		options->queue_name_num = 2;
+	}
+}
+
+/*
+ * Apply the command line on top of a preset. Returns false if the result is
+ * out of range.
+ */
+static bool wl_make_params(const struct wl_params *preset,
+	const struct wl_params *o, struct wl_params *params)
+{
+	*params = *preset;
+
+	if (o->producer_num > 0) {
+		params->producer_num = o->producer_num;
+	}
+
+	if (o->consumer_num > 0) {
+		params->consumer_num = o->consumer_num;
+	}
+
+	if (o->stage_num > 0) {
+		params->stage_num = o->stage_num;
+	}
+
+	if (o->rate > 0.0) {
+		params->rate = o->rate;
+	}
+
+	if (o->zipf_s >= 0.0) {
+		params->zipf_s = o->zipf_s;
+	}
+
+	/* Overriding the burst shape of a non-bursty scenario makes it bursty */
+	if (o->burst_on_us > 0.0) {
+		params->burst_on_us = o->burst_on_us;
+		params->arrival = WL_ARRIVAL_BURSTY;
+	}
+
+	if (o->burst_off_us >= 0.0) {
+		params->burst_off_us = o->burst_off_us;
+	}
+
+	if (o->poll_us >= 0.0) {
+		params->poll_us = o->poll_us;
+	}
+
+	params->duration_ms = o->duration_ms;
+	params->pin = o->pin;
+
+	if (params->producer_num > BENCH_MAX_THREAD_NUM ||
+			params->consumer_num > BENCH_MAX_THREAD_NUM ||
+			params->stage_num > WL_MAX_STAGE_NUM ||
+			params->poll_us >= 1e6) {
+		fprintf(stderr, "workload: %s parameters out of range\n",
+			params->scenario);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const struct wl_params *presets[WL_SCENARIO_NUM];
+	struct wl_options options;
+	struct wl_params params;
+	struct wl_result *result = NULL;
+	const struct bench_queue_ops *ops;
+	int preset_num = 0;
+	bool first = true;
+
+	wl_parse_options(argc, argv, &options);
+	bench_queue_register(options.relaxed_lib, options.linearizable_lib);
+
+	if (options.scenario_name_num == 0) {
+		for (int i = 0; i < WL_SCENARIO_NUM; i++) {
+			presets[preset_num++] = &wl_scenarios[i];
+		}
+	} else {
+		for (int i = 0; i < options.scenario_name_num; i++) {
+			for (int j = 0; j < WL_SCENARIO_NUM; j++) {
+				if (strcmp(options.scenario_names[i],
+						wl_scenarios[j].scenario) == 0 &&
+						preset_num < WL_SCENARIO_NUM) {
+					presets[preset_num++] = &wl_scenarios[j];
+					break;
+				}
+			}
+		}
+
+		if (preset_num != options.scenario_name_num) {
+			fprintf(stderr, "workload: unknown scenario\n");
+			return 1;
+		}
+	}
+
+	result = malloc(sizeof(struct wl_result));
+	if (result == NULL) {
+		return 1;
+	}
+
+	wl_print_header(&options);
+
+	for (int i = 0; i < preset_num; i++) {
+		if (!wl_make_params(presets[i], &options.overrides, &params)) {
+			continue;
+		}
+
+		for (int q = 0; q < options.queue_name_num; q++) {
+			ops = bench_queue_find(options.queue_names[q]);
+			if (ops == NULL) {
+				fprintf(stderr, "workload: unknown queue %s\n",
+					options.queue_names[q]);
+				continue;
+			}
+
+			if (!wl_supports(ops, &params)) {
+				continue;
+			}
+
+			if (!wl_run_workload(ops, &params, result)) {
+				fprintf(stderr, "workload: %s on %s failed\n",
+					params.scenario, ops->name);
+				continue;
+			}
+
+			wl_print_result(&options, &params, result, first);
+			first = false;
+		}
+	}
+
+	if (options.format == WL_FORMAT_JSON) {
+		printf("\n  ]\n}\n");
+	}
+
+	free(result);
+
+	return 0;
+}
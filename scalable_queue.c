@@ -1,15 +1,170 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdatomic.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#if !defined(SCQ_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define SCQ_HAVE_USDT
+#endif
+#endif
 
 #include "scalable_queue.h"
+#include "scq_spsc_ring.h"
+#include "scq_bounded_ring.h"
+#include "scq_shm.h"
 
 #define MAX_SCQ_NUM (1024)
 #define MAX_THREAD_NUM (1024)
 
+#define MAX_SUBLIST_NUM (64)
+#define SCQ_CACHE_LINE_SIZE (64)
+
+/*
+ * Engines behind scq_enqueue() and scq_dequeue(), selected by the engine
+ * flags given to scq_init_ex(). The relaxed engine is the linked list design
+ * described in this file. SPSC and MPSC are specialized for a known number of
+ * enqueue/dequeue threads and are built on scq_spsc_ring, as is MATRIX, which
+ * keeps one ring per (enqueue thread, dequeue thread) pair. BOUNDED is the
+ * fixed-capacity scq_bounded_ring.
+ */
+#define SCQ_ENGINE_RELAXED (0)
+#define SCQ_ENGINE_SPSC (1)
+#define SCQ_ENGINE_MPSC (2)
+#define SCQ_ENGINE_BOUNDED (3)
+#define SCQ_ENGINE_MATRIX (4)
+
+#define SCQ_ENGINE_FLAGS (SCQ_FLAG_SPSC | SCQ_FLAG_MPSC | \
+	SCQ_FLAG_BOUNDED_RING | SCQ_FLAG_SPSC_MATRIX)
+
+/* scq_tls_data's matrix_column before it is claimed, and when none was left */
+#define SCQ_MATRIX_COLUMN_NONE (-1)
+#define SCQ_MATRIX_COLUMN_EXHAUSTED (-2)
+
+#define SCQ_DEFAULT_RING_CAPACITY (65536)
+
+/* pause iterations before a waiting enqueue thread starts to sched_yield() */
+#define SCQ_BACKOFF_SPIN_NUM (128)
+
+/*
+ * SCQ_FLAG_LANE_LEASE takes a leased lane away from its owner only if the owner
+ * has not taken a batch for this long, or the lane's backlog is over this many
+ * data. The coarse clock ticks every few milliseconds.
+ */
+#define SCQ_LEASE_IDLE_NS (10000000ULL)
+#define SCQ_LEASE_STEAL_BACKLOG (256)
+
+/*
+ * Operation statistics are per-thread counters written without any atomic
+ * read-modify-write, and summed by scq_get_stats(). Building with
+ * -DSCQ_NO_STATS removes them entirely.
+ */
+#ifndef SCQ_NO_STATS
+#define SCQ_STAT_ADD(tls_data, field, n) \
+	atomic_store_explicit(&(tls_data)->stats->field, \
+		atomic_load_explicit(&(tls_data)->stats->field, \
+			memory_order_relaxed) + (n), memory_order_relaxed)
+#define SCQ_STAT_SET(tls_data, field, n) \
+	atomic_store_explicit(&(tls_data)->stats->field, (n), memory_order_relaxed)
+#define SCQ_STAT_GET(tls_data, field) \
+	atomic_load_explicit(&(tls_data)->stats->field, memory_order_relaxed)
+#else
+#define SCQ_STAT_ADD(tls_data, field, n) ((void)0)
+#define SCQ_STAT_SET(tls_data, field, n) ((void)0)
+#define SCQ_STAT_GET(tls_data, field) (0)
+#endif /* SCQ_NO_STATS */
+
+/*
+ * USDT probes of the relaxed engine, provider "scq". Each one is a single nop
+ * until perf or bpftrace attaches to it. Without <sys/sdt.h>, or with
+ * -DSCQ_NO_USDT, they are compiled out.
+ *
+ * scq:enqueue(scq_id, lane, datum)
+ * scq:detach(scq_id, lane, estimated batch length)
+ * scq:free_return(scq_id, lane, node count)
+ * scq:malloc_fallback(scq_id, lane)
+ * scq:spin(scq_id, SCQ_SPIN_*), once when a wait loop is entered
+ *
+ * Each probe has a semaphore, which the tracer raises while it is attached, so
+ * that arguments costing more than a register move are only computed then,
+ * under SCQ_PROBE_ENABLED().
+ */
+#ifdef SCQ_HAVE_USDT
+#define SCQ_PROBE2(name, a1, a2) DTRACE_PROBE2(scq, name, a1, a2)
+#define SCQ_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(scq, name, a1, a2, a3)
+#define SCQ_PROBE_ENABLED(name) __builtin_expect(scq_##name##_semaphore, 0)
+
+#define SCQ_PROBE_SEMAPHORE(name) \
+	volatile unsigned short scq_##name##_semaphore \
+		__attribute__((unused, section(".probes")))
+
+SCQ_PROBE_SEMAPHORE(enqueue);
+SCQ_PROBE_SEMAPHORE(detach);
+SCQ_PROBE_SEMAPHORE(free_return);
+SCQ_PROBE_SEMAPHORE(malloc_fallback);
+SCQ_PROBE_SEMAPHORE(spin);
+#else
+/* sizeof keeps the arguments used without evaluating them */
+#define SCQ_PROBE2(name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#define SCQ_PROBE3(name, a1, a2, a3) \
+	((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+#define SCQ_PROBE_ENABLED(name) (0)
+#endif /* SCQ_HAVE_USDT */
+
+/* Wait loops reported by the scq:spin probe */
+#define SCQ_SPIN_FREE_LIST (0)
+#define SCQ_SPIN_DEQUEUED_LIST (1)
+#define SCQ_SPIN_BACKOFF (2)
+
+/*
+ * Flight recorder events, see scq_record(). Each thread keeps the last
+ * recorder_event_num of them in its own ring.
+ */
+#define SCQ_EVENT_ENQUEUE (0)
+#define SCQ_EVENT_DETACH (1)
+#define SCQ_EVENT_FREE_RETURN (2)
+#define SCQ_EVENT_SPIN_ENTER (3)
+#define SCQ_EVENT_SPIN_EXIT (4)
+
+#define SCQ_DEFAULT_RECORDER_EVENT_NUM (256)
+
+/* scq_get_latency_hist() waits at least this long to calibrate the TSC */
+#define SCQ_TSC_CALIBRATION_NS (1000000ULL)
+
+/*
+ * Preemption injection, for the oversubscription benchmarks only. Building with
+ * -DSCQ_PREEMPT_INJECT=N gives the cpu away on every N'th shared_tail exchange
+ * of a thread, before the link store. That is the window in which a preempted
+ * enqueue thread leaves dequeue threads spinning on a NULL next, and a
+ * preempted dequeue thread returning nodes does the same to the owner of the
+ * free list.
+ * The cpu is given away with sched_yield(), or by sleeping
+ * SCQ_PREEMPT_INJECT_SLEEP_NS nanoseconds if that is defined too.
+ */
+#ifdef SCQ_PREEMPT_INJECT
+#define SCQ_PREEMPT_POINT() scq_preempt_point()
+#else
+#define SCQ_PREEMPT_POINT() ((void)0)
+#endif /* SCQ_PREEMPT_INJECT */
+
+#define SCQ_ARENA_CHUNK_SIZE (2UL * 1024 * 1024)
+#define SCQ_ARENA_MAX_NUMA_NODE (1024)
+
 /*
  * scq_node - Linked list node
  * @next: pointer to the next inserted node
@@ -24,6 +179,20 @@ struct scq_node {
 	uint64_t datum;
 };
 
+/*
+ * scq_stamped_node - Node of a queue with latency sampling
+ * @node: the node itself, first so that either type points to the other
+ * @tsc: TSC when a sampled datum was enqueued, 0 if it is not a sample
+ *
+ * A queue uses these instead of 16-byte nodes only when it samples latency,
+ * see scalable_queue.node_size. The stamp travels with the datum, so the
+ * dequeue thread reads it from the node it pops anyway.
+ */
+struct scq_stamped_node {
+	struct scq_node node;
+	uint64_t tsc;
+};
+
 /* 
  * During initialization, the scalable_queue is assigned a unique ID. 
  * This ID is later used when threads access the dequeued nodes.
@@ -34,11 +203,20 @@ static int global_scq_id_arr[MAX_SCQ_NUM];
 /*
  * Dequeue thread detaches nodes from the shared linked list and brings them
  * into its thread-local linked list.
+ *
+ * batch_len counts the nodes popped from the current batch, so that the
+ * enqueue thread's dequeue_cnt can be advanced once per batch. It is only
+ * written by this thread, and read by scq_queued_estimate().
+ *
+ * batch_enqueue_ns is when the oldest node of the current batch was enqueued,
+ * or 0 without a batch. It is only read by scq_oldest_age_ns().
  */
 struct scq_dequeued_node_list {
 	struct scq_node *local_head;
 	struct scq_node *local_tail;
 	struct scq_node *local_initial_head;
+	_Atomic uint64_t batch_len;
+	_Atomic uint64_t batch_enqueue_ns;
 };
 
 /*
@@ -47,370 +225,2877 @@ struct scq_dequeued_node_list {
  *
  * local_head and local_tail are used for enqueue thread only. The thread will
  * detach the nodes from shared linked list into the local list.
+ *
+ * dequeue_cnt is the number of nodes returned by dequeue threads. It lives
+ * next to shared_tail, whose cache line they are writing anyway.
  */
 struct scq_free_node_list {
 	struct scq_node shared_sentinel;
 	struct scq_node *shared_tail;
+	_Atomic uint64_t dequeue_cnt;
 	struct scq_node *local_head;
 	struct scq_node *local_tail;
 };
 
 /*
- * New nodes are inserted into tail.
+ * scq_arena_chunk - Header placed at the start of every arena chunk
+ * @next: previously mapped chunk of the same arena
+ * @size: mapped length, including this header
+ */
+struct scq_arena_chunk {
+	struct scq_arena_chunk *next;
+	size_t size;
+};
+
+/*
+ * scq_node_arena - Producer-owned node memory (SCQ_FLAG_NUMA_ARENA)
+ * @chunk_list: every chunk mapped by this arena
+ * @bump_ptr: next unused node in the newest chunk
+ * @bump_end: end of the newest chunk
+ * @numa_node: node the chunks are bound to, -1 if unknown
+ *
+ * Only the owning producer allocates from the arena. Dequeued nodes always
+ * come back through the producer's free_node_list, so a node never leaves the
+ * arena it was carved from until the queue is destroyed.
+ */
+struct scq_node_arena {
+	struct scq_arena_chunk *chunk_list;
+	char *bump_ptr;
+	char *bump_end;
+	int numa_node;
+};
+
+/*
+ * scq_handoff_slot - Dequeue thread's slot for SCQ_FLAG_HANDOFF
+ * @state: SCQ_HANDOFF_EMPTY, SCQ_HANDOFF_WAITING or SCQ_HANDOFF_FULL in the
+ * low bits, the number of fills above them
+ * @datum: datum handed over by an enqueue thread
+ * @lane: index of the enqueue thread that handed it over
+ *
+ * A dequeue thread that found nothing marks its slot as waiting and advertises
+ * itself in the queue's handoff_waiter. The enqueue thread that wins the CAS on
+ * handoff_waiter owns the slot and fills it, so only the dequeue thread moves
+ * the slot out of the waiting state otherwise.
+ *
+ * A full slot is claimed with a CAS on @state, by its dequeue thread or by any
+ * other that finds the queue empty, so a datum is not stranded when its dequeue
+ * thread stops polling. Each fill advances the count in @state, so a claim that
+ * read @datum before the slot was emptied and filled again fails.
+ */
+#define SCQ_HANDOFF_EMPTY (0)
+#define SCQ_HANDOFF_WAITING (1)
+#define SCQ_HANDOFF_FULL (2)
+
+#define SCQ_HANDOFF_KIND_MASK (3ULL)
+#define SCQ_HANDOFF_FILL (4ULL)
+
+struct scq_handoff_slot {
+	_Atomic uint64_t state;
+	_Atomic uint64_t datum;
+	_Atomic int lane;
+};
+
+/*
+ * scq_transfer_counter - What a dequeue thread took from one enqueue thread
+ * @batch_cnt: batches detached from the enqueue thread's lane
+ * @item_cnt: nodes of those batches, added when a batch is used up
+ *
+ * Only the dequeue thread owning the row writes it.
+ */
+struct scq_transfer_counter {
+	_Atomic uint64_t batch_cnt;
+	_Atomic uint64_t item_cnt;
+};
+
+/*
+ * scq_recorder_event - One flight recorder entry
+ * @tsc: TSC when the event was recorded
+ * @arg: datum (ENQUEUE), estimated batch length (DETACH), node count
+ * (FREE_RETURN), SCQ_SPIN_* site (SPIN_ENTER) or pause iterations (SPIN_EXIT)
+ * @type: SCQ_EVENT_*
+ * @lane: lane the event is about
+ */
+struct scq_recorder_event {
+	uint64_t tsc;
+	uint64_t arg;
+	uint32_t type;
+	int32_t lane;
+};
+
+/*
+ * scq_recorder - Per-thread ring of recent events
+ * @pos: number of events ever recorded, published after each event
+ * @mask: number of entries - 1, a power of two minus one
+ * @events: the ring
+ *
+ * Only the owning thread writes it. A dump while the thread runs may show the
+ * entry being overwritten torn, the rest is consistent.
+ */
+struct scq_recorder {
+	_Atomic uint64_t pos;
+	uint64_t mask;
+	struct scq_recorder_event events[];
+};
+
+/*
+ * scq_sublist - Shared linked list of an enqueue thread
+ * @shared_tail: where the enqueue thread inserts new nodes
+ * @shared_sentinel: dequeue threads detach everything after it
+ * @head_enqueue_ns: when the first node after the sentinel was enqueued
+ *
+ * The enqueue thread stamps head_enqueue_ns only when it links a node right
+ * after the sentinel, i.e. once per batch, with the coarse monotonic clock.
+ * That is cheap and precise enough to tell how long data has been waiting.
+ *
+ * An enqueue thread owns one sublist by default. With sublist_num > 1 it
+ * stripes its nodes round-robin over several cache-line-aligned sublists, so
+ * that multiple dequeue threads can detach disjoint batches of the same
+ * enqueue thread in parallel. The order within each sublist is preserved.
+ */
+struct scq_sublist {
+	struct scq_node *shared_tail;
+	struct scq_node shared_sentinel;
+	_Atomic uint64_t head_enqueue_ns;
+} __attribute__((aligned(SCQ_CACHE_LINE_SIZE)));
+
+/*
+ * New nodes are inserted into the tail of the sublist at next_sublist_idx.
  * thread idx is used to determine the start index of round-robin.
+ *
+ * sublist_arr points to the embedded sublist, or to sublist_num separately
+ * allocated sublists when the queue stripes its lanes. sublist_cursor is the
+ * dequeue thread's rotating start position within a lane's sublists.
+ *
+ * lease_owner is the index of the dequeue thread currently leasing this
+ * thread's shared list, or -1. lease_active_ns is the coarse time this thread
+ * last took a batch as a dequeue thread. Both are only used with
+ * SCQ_FLAG_LANE_LEASE.
+ *
+ * enqueue_cnt is written by the enqueue thread only. Together with the
+ * free_node_list's dequeue_cnt it gives the estimated backlog of this thread's
+ * shared list, see scq_lane_backlog_estimate().
+ *
+ * enqueue_credit is how many more nodes this enqueue thread may insert before
+ * it has to compare the queue's estimated size against its capacity again.
+ *
+ * handoff_slot is this dequeue thread's slot for SCQ_FLAG_HANDOFF. As an
+ * enqueue thread, handoff_pending is the slot it last filled, with the state
+ * and datum it stored, until it has seen the datum claimed.
+ *
+ * rand_state is the dequeue thread's xorshift state for SCQ_FLAG_SCAN_P2C.
+ *
+ * spsc_ring is this enqueue thread's ring in the MPSC engine. It is not used by
+ * the relaxed engine.
+ *
+ * In the MATRIX engine, matrix_row holds this enqueue thread's consumer_num
+ * rings, allocated on its first enqueue. matrix_rr picks the ring when no key
+ * is given. matrix_column is the ring index this thread reads from every
+ * enqueue thread's row when it dequeues.
+ *
+ * latency_countdown is the number of enqueues left until the next latency
+ * sample, UINT64_MAX when this thread does not sample. latency is the
+ * histogram this thread fills as a dequeue thread, allocated only when
+ * sampling is on.
+ *
+ * recorder is this thread's flight recorder, allocated only with
+ * SCQ_FLAG_FLIGHT_RECORDER.
+ *
+ * transfer_row is this dequeue thread's row of the transfer matrix, one counter
+ * per lane, allocated only with SCQ_FLAG_TRANSFER_MATRIX. numa_node is the
+ * node this thread was running on when it registered, or -1 if not recorded.
+ *
+ * stats points to stats_buf, which is on its own cache lines so that
+ * scq_get_stats() readers do not disturb the fields above. When the queue
+ * exports its statistics, stats and latency point into this thread's slot of
+ * the shared memory segment, shm_lane, instead.
  */
 struct scq_tls_data {
 	struct scq_dequeued_node_list dequeued_node_list;
 	struct scq_free_node_list free_node_list;
-	struct scq_node *shared_tail;
-	struct scq_node shared_sentinel;
+	struct scq_sublist sublist;
+	struct scq_sublist *sublist_arr;
+	int sublist_num;
+	int next_sublist_idx;
+	int sublist_cursor;
+	_Atomic uint64_t enqueue_cnt;
+	uint64_t enqueue_credit;
+	_Atomic int lease_owner;
+	_Atomic uint64_t lease_active_ns;
+	struct scq_handoff_slot handoff_slot;
+	struct scq_handoff_slot *handoff_pending;
+	uint64_t handoff_pending_state;
+	uint64_t handoff_pending_datum;
+	struct scq_node_arena arena;
+	struct scq_spsc_ring *spsc_ring;
+	_Atomic(struct scq_spsc_ring **) matrix_row;
+	uint64_t matrix_rr;
+	int matrix_column;
+	uint64_t rand_state;
+	uint64_t latency_countdown;
+	struct scq_thread_latency *latency;
+	struct scq_shm_lane *shm_lane;
+	struct scq_transfer_counter *transfer_row;
+	struct scq_recorder *recorder;
+	int numa_node;
 	int last_dequeued_thread_idx;
+	int thread_idx;
+#ifndef SCQ_NO_STATS
+	struct scq_thread_stats *stats;
+	struct scq_thread_stats stats_buf;
+#endif /* SCQ_NO_STATS */
 };
 
 _Thread_local static struct scq_tls_data *tls_data_ptr_arr[MAX_SCQ_NUM];
 
+/*
+ * Queues with a flight recorder, by scq_id, for the fatal signal handler, and
+ * the file descriptor it dumps them to.
+ */
+static _Atomic(struct scalable_queue *) recorder_scq_arr[MAX_SCQ_NUM];
+static int recorder_signal_fd = -1;
+
 /*
  * scalable_queue - main data structure to manage queue
  * @tls_data_ptr_list: each thread's scq_tls_data pointers
  * @spinlock: spinlock to manage thread-local data structures
+ * @flags: SCQ_FLAG_* values given to scq_init_ex()
+ * @engine: SCQ_ENGINE_* selected by the topology flags
+ * @spsc_ring: the ring of the SPSC engine
+ * @bounded_ring: the ring of the BOUNDED engine
+ * @mpsc_cursor: lane the MPSC engine's dequeue thread last took data from
+ * @consumer_num: number of dequeue threads of the MATRIX engine
+ * @matrix_column_cnt: number of MATRIX columns claimed by dequeue threads
+ * @sublist_num: number of shared sublists per enqueue thread
+ * @capacity: approximate limit on queued data of the relaxed engine, or 0
+ * @overflow_policy: SCQ_OVERFLOW_* applied when capacity is reached
+ * @block_timeout_ns: how long scq_try_enqueue() waits under SCQ_OVERFLOW_BLOCK
+ * @drop_func: called with data discarded by the DROP policies, may be NULL
+ * @drop_arg: second argument of drop_func
+ * @latency_sample_rate: one enqueue out of this many is latency-sampled, or 0
+ * @node_size: bytes of each node, a struct scq_stamped_node when sampling
+ * @calib_tsc: TSC when the queue was created, to calibrate the TSC rate
+ * @calib_ns: CLOCK_MONOTONIC time when the queue was created
+ * @shm: statistics segment shared with scqstat, or NULL
+ * @shm_name: name the segment was created with, unlinked on destroy
+ * @recorder_event_num: entries of each thread's flight recorder, or 0
  * @scq_id: global id of the scalable_queue
  * @thread_num: number of threads
+ * @handoff_waiter: 1 + index of the dequeue thread waiting for a handoff, or 0
  */
 struct scalable_queue {
 	struct scq_tls_data *tls_data_ptr_list[MAX_THREAD_NUM];
 	pthread_spinlock_t spinlock;
+	uint32_t flags;
+	int engine;
+	struct scq_spsc_ring *spsc_ring;
+	struct scq_bounded_ring *bounded_ring;
+	int mpsc_cursor;
+	int consumer_num;
+	_Atomic int matrix_column_cnt;
+	int sublist_num;
+	uint64_t capacity;
+	int overflow_policy;
+	uint64_t block_timeout_ns;
+	void (*drop_func)(uint64_t datum, void *drop_arg);
+	void *drop_arg;
+	uint64_t latency_sample_rate;
+	size_t node_size;
+	uint64_t calib_tsc;
+	uint64_t calib_ns;
+	struct scq_shm_header *shm;
+	char *shm_name;
+	uint64_t recorder_event_num;
 	int scq_id;
 	int thread_num;
+	_Atomic int handoff_waiter __attribute__((aligned(SCQ_CACHE_LINE_SIZE)));
 };
 
 _Thread_local static struct scalable_queue *tls_scq_ptr_arr[MAX_SCQ_NUM];
 
 /*
- * Returns pointer to an scalable_queue, or NULL on failure.
+ * Read the time stamp counter. It only orders against itself, which is enough
+ * for latency samples that are far longer than the instruction window.
  */
-struct scalable_queue *scq_init(void)
+static inline uint64_t scq_rdtsc(void)
 {
-	struct scalable_queue *scq = calloc(1, sizeof(struct scalable_queue));
+	uint32_t lo, hi;
 
-	if (scq == NULL) {
-		fprintf(stderr, "scalable_queue_init: queue allocation failed\n");
-		return NULL;
-	}
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
 
-	scq->thread_num = 0;
+	return ((uint64_t)hi << 32) | lo;
+}
 
-	if (pthread_spin_init(&scq->spinlock, PTHREAD_PROCESS_PRIVATE) != 0) {
-		fprintf(stderr, "scalable_queue_init: spinlock init failed\n");
-		free(scq);
-		return NULL;
-	}
+/*
+ * Append an event to this thread's flight recorder, if it has one. Callers
+ * rely on the NULL check being the only cost without the recorder.
+ */
+static inline void scq_record(struct scq_tls_data *tls_data, uint32_t type,
+	int lane, uint64_t arg)
+{
+	struct scq_recorder *recorder = tls_data->recorder;
+	struct scq_recorder_event *event = NULL;
+	uint64_t pos;
 
-	/* Get the spinlock to assign scq id */
-	while (atomic_exchange(&global_scq_id_flag, 1) == 1) {
-		__asm__ __volatile__("pause");
+	if (recorder == NULL) {
+		return;
 	}
 
-	scq->scq_id = -1;
-	for (int i = 0; i < MAX_SCQ_NUM; i++) {
-		if (atomic_load(&global_scq_id_arr[i]) == 0) {
-			atomic_store(&global_scq_id_arr[i], 1);
-			scq->scq_id = i;
-			break;
-		}
-	}
+	pos = atomic_load_explicit(&recorder->pos, memory_order_relaxed);
+	event = &recorder->events[pos & recorder->mask];
 
-	atomic_store(&global_scq_id_flag, 0);
+	event->tsc = scq_rdtsc();
+	event->arg = arg;
+	event->type = type;
+	event->lane = lane;
 
-	/* Invalid id */
-	if (scq->scq_id == -1) {
-		fprintf(stderr, "scalable_queue_init: invalid scq id\n");
-		free(scq);
-		return NULL;
+	atomic_store_explicit(&recorder->pos, pos + 1, memory_order_release);
+}
+
+#ifdef SCQ_PREEMPT_INJECT
+static void scq_preempt_point(void)
+{
+	static _Thread_local uint32_t exchange_cnt;
+#ifdef SCQ_PREEMPT_INJECT_SLEEP_NS
+	struct timespec ts = { 0, SCQ_PREEMPT_INJECT_SLEEP_NS };
+#endif
+
+	if (++exchange_cnt < SCQ_PREEMPT_INJECT) {
+		return;
 	}
 
-	return scq;
+	exchange_cnt = 0;
+
+#ifdef SCQ_PREEMPT_INJECT_SLEEP_NS
+	nanosleep(&ts, NULL);
+#else
+	sched_yield();
+#endif
 }
+#endif /* SCQ_PREEMPT_INJECT */
 
 /*
- * Destroy the given scalable_queue.
+ * Precise monotonic clock, in nanoseconds. Only used to calibrate the TSC.
  */
-void scq_destroy(struct scalable_queue *scq)
+static uint64_t scq_now_ns(void)
 {
-	struct scq_tls_data *tls_data_ptr;
-	struct scq_dequeued_node_list *dequeued_node_list;
-	struct scq_free_node_list *free_node_list;
-	struct scq_node *node, *prev_node;
+	struct timespec ts;
 
-	if (scq == NULL) {
-		return;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	assert(scq->scq_id >= 0 && scq->scq_id < MAX_SCQ_NUM);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
-	/* Get the spinlock to return scq id */
-	while (atomic_exchange(&global_scq_id_flag, 1) == 1) {
-		__asm__ __volatile__("pause");
+/*
+ * Log-linear bucket of a latency, like an HDR histogram with 3 significant
+ * bits. Values below 8 have their own bucket, above that each power of two is
+ * split into 8 buckets, so the relative error is at most 12.5%.
+ */
+static inline int scq_latency_bucket(uint64_t value)
+{
+	int msb;
+
+	if (value < SCQ_LATENCY_SUB_BUCKET_NUM) {
+		return (int)value;
 	}
 
-	atomic_store(&global_scq_id_arr[scq->scq_id], 0);
+	msb = 63 - __builtin_clzll(value);
 
-	atomic_store(&global_scq_id_flag, 0);
+	return (msb - 2) * SCQ_LATENCY_SUB_BUCKET_NUM
+		+ (int)((value >> (msb - 3)) & (SCQ_LATENCY_SUB_BUCKET_NUM - 1));
+}
 
-	/* Free thread-local linked lists */
-	for (int i = 0; i < scq->thread_num; i++) {
-		tls_data_ptr = scq->tls_data_ptr_list[i];
-		dequeued_node_list = &tls_data_ptr->dequeued_node_list;
-		free_node_list = &tls_data_ptr->free_node_list;
+/*
+ * Stamp the node with the TSC if it is this enqueue thread's next sample, or
+ * clear the stamp a recycled node may still carry. Called before the node is
+ * linked, which publishes the stamp along with the datum.
+ */
+static inline void scq_latency_stamp(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, struct scq_node *node)
+{
+	struct scq_stamped_node *stamped = (struct scq_stamped_node *)node;
 
-		if (dequeued_node_list->local_initial_head != NULL) {
-			node = dequeued_node_list->local_initial_head;
-			while (node != dequeued_node_list->local_tail) {
-				prev_node = node;
-				node = node->next;
-				free(prev_node);
-			}
-			free(dequeued_node_list->local_tail);
-		}
+	if (--tls_data->latency_countdown == 0) {
+		tls_data->latency_countdown = scq->latency_sample_rate;
+		stamped->tsc = scq_rdtsc();
+	} else {
+		stamped->tsc = 0;
+	}
+}
 
-		if (free_node_list->local_head != NULL) {
-			node = free_node_list->local_head;
-			while (node != free_node_list->local_tail) {
-				prev_node = node;
-				node = node->next;
-				free(prev_node);
-			}
-			free(free_node_list->local_tail);
-		}
+/*
+ * Largest value that falls into the given bucket.
+ */
+static uint64_t scq_latency_bucket_max(int bucket)
+{
+	int msb = bucket / SCQ_LATENCY_SUB_BUCKET_NUM + 2;
+	uint64_t sub = (uint64_t)(bucket % SCQ_LATENCY_SUB_BUCKET_NUM);
 
-		node = free_node_list->shared_sentinel.next;
-		while (node != NULL) {
-			prev_node = node;
-			node = node->next;
-			free(prev_node);
-		}
+	if (bucket < SCQ_LATENCY_SUB_BUCKET_NUM) {
+		return (uint64_t)bucket;
+	}
 
-		node = tls_data_ptr->shared_sentinel.next;
-		while (node != NULL) {
-			prev_node = node;
-			node = node->next;
-			free(prev_node);
-		}
+	return ((SCQ_LATENCY_SUB_BUCKET_NUM + sub + 1) << (msb - 3)) - 1;
+}
 
-		free(tls_data_ptr);
-	}
+/*
+ * Returns the NUMA node of the cpu this thread is running on, or -1.
+ */
+static int scq_current_numa_node(void)
+{
+	unsigned int cpu = 0, node = 0;
 
-	pthread_spin_destroy(&scq->spinlock);
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		return -1;
+	}
 
-	free(scq);
+	return (int)node;
 }
 
 /*
- * Has this scalable_queue been accessed by this thread before?
- * If not, initialize thread local data.
+ * Map a new chunk for the arena. Explicit huge pages are tried first. If none
+ * are reserved, a regular mapping aligned to the chunk size is used so that
+ * transparent huge pages can back it. The chunk is bound to the arena's NUMA
+ * node before any page is touched.
  */
-static void check_and_init_scq_tls_data(struct scalable_queue *scq)
+static struct scq_arena_chunk *scq_arena_map_chunk(
+	struct scq_node_arena *arena)
 {
-	struct scq_tls_data *tls_data = NULL;
+	unsigned long nodemask[SCQ_ARENA_MAX_NUMA_NODE / (8 * sizeof(long))];
+	size_t size = SCQ_ARENA_CHUNK_SIZE;
+	struct scq_arena_chunk *chunk = NULL;
+	char *addr = NULL, *aligned = NULL;
 
-	if (tls_scq_ptr_arr[scq->scq_id] == scq) {
-		return;
-	}
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
 
-	tls_data = (struct scq_tls_data *)calloc(1, sizeof(struct scq_tls_data));
-	tls_data_ptr_arr[scq->scq_id] = tls_data;
+	if (addr == MAP_FAILED) {
+		addr = mmap(NULL, size * 2, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	tls_data->dequeued_node_list.local_head = NULL;
-	tls_data->dequeued_node_list.local_tail = NULL;
-	tls_data->dequeued_node_list.local_initial_head = NULL;
+		if (addr == MAP_FAILED) {
+			return NULL;
+		}
 
-	tls_data->free_node_list.local_head = NULL;
-	tls_data->free_node_list.local_tail = NULL;
+		aligned = (char *)(((uintptr_t)addr + size - 1) & ~(size - 1));
 
-	tls_data->free_node_list.shared_sentinel.next = NULL;
-	tls_data->free_node_list.shared_tail
-		= &tls_data->free_node_list.shared_sentinel;
+		if (aligned != addr) {
+			munmap(addr, aligned - addr);
+		}
 
-	tls_data->shared_sentinel.next = NULL;
-	tls_data->shared_tail = &tls_data->shared_sentinel;
+		munmap(aligned + size, (addr + size * 2) - (aligned + size));
 
-	tls_data->last_dequeued_thread_idx = 0;
+		addr = aligned;
+		madvise(addr, size, MADV_HUGEPAGE);
+	}
 
-	pthread_spin_lock(&scq->spinlock);
-	scq->tls_data_ptr_list[scq->thread_num] = tls_data;
-	scq->thread_num++;
-	pthread_spin_unlock(&scq->spinlock);
+	/* A failed bind only costs locality, so it is not an error */
+	if (arena->numa_node >= 0 && arena->numa_node < SCQ_ARENA_MAX_NUMA_NODE) {
+		memset(nodemask, 0, sizeof(nodemask));
+		nodemask[arena->numa_node / (8 * sizeof(long))]
+			|= 1UL << (arena->numa_node % (8 * sizeof(long)));
 
-	tls_scq_ptr_arr[scq->scq_id] = scq;
+		syscall(SYS_mbind, addr, size, MPOL_BIND, nodemask,
+			SCQ_ARENA_MAX_NUMA_NODE + 1, 0);
+	}
+
+	chunk = (struct scq_arena_chunk *)addr;
+	chunk->next = arena->chunk_list;
+	chunk->size = size;
+
+	return chunk;
 }
 
 /*
- * If there is free node, return it.
- * Otherwise call malloc().
+ * Carve a node out of the arena, mapping a new chunk when the current one is
+ * used up. Returns NULL if no memory could be mapped.
  */
-static struct scq_node *scq_allocate_node(struct scq_tls_data *tls_data)
+static struct scq_node *scq_arena_alloc_node(struct scq_node_arena *arena,
+	size_t node_size)
 {
+	size_t header_size = (sizeof(struct scq_arena_chunk) + node_size - 1)
+		/ node_size * node_size;
+	struct scq_arena_chunk *chunk = NULL;
 	struct scq_node *node = NULL;
-	struct scq_free_node_list *free_node_list = &tls_data->free_node_list;
 
-	if (free_node_list->local_head == NULL) {
-		if (free_node_list->shared_sentinel.next == NULL) {
-			return (struct scq_node *)malloc(sizeof(struct scq_node));
+	if (arena->bump_ptr == arena->bump_end) {
+		if (arena->chunk_list == NULL) {
+			arena->numa_node = scq_current_numa_node();
 		}
 
-		free_node_list->local_head
-			= atomic_exchange(&free_node_list->shared_sentinel.next, NULL);
-
-		if (free_node_list->local_head == NULL) {
-			return (struct scq_node *)malloc(sizeof(struct scq_node));
+		chunk = scq_arena_map_chunk(arena);
+		if (chunk == NULL) {
+			return NULL;
 		}
 
-		free_node_list->local_tail
-			= atomic_exchange(&free_node_list->shared_tail,
-				&free_node_list->shared_sentinel);
+		arena->chunk_list = chunk;
+		arena->bump_ptr = (char *)chunk + header_size;
+		arena->bump_end = arena->bump_ptr
+			+ (chunk->size - header_size) / node_size * node_size;
 	}
 
-	node = free_node_list->local_head;
-
-	if (free_node_list->local_head == free_node_list->local_tail) {
-		free_node_list->local_head = NULL;
-		free_node_list->local_tail = NULL;
-	} else {
-		while (node->next == NULL) {
-			__asm__ __volatile__("pause");
-		}
-
-		free_node_list->local_head = node->next;
-	}
+	node = (struct scq_node *)arena->bump_ptr;
+	arena->bump_ptr += node_size;
 
 	return node;
 }
 
 /*
- * Enqueue the given datum into the queue.
+ * Unmap every chunk of the arena.
  */
-void scq_enqueue(struct scalable_queue *scq, uint64_t datum)
+static void scq_arena_release(struct scq_node_arena *arena)
+{
+	struct scq_arena_chunk *chunk = arena->chunk_list, *next_chunk = NULL;
+
+	while (chunk != NULL) {
+		next_chunk = chunk->next;
+		munmap(chunk, chunk->size);
+		chunk = next_chunk;
+	}
+
+	arena->chunk_list = NULL;
+	arena->bump_ptr = NULL;
+	arena->bump_end = NULL;
+}
+
+#ifndef SCQ_NO_STATS
+/*
+ * Is the segment under this name left by a process that has exited? Only a
+ * complete segment of ours is, anything else belongs to someone else or is
+ * still being set up.
+ */
+static bool scq_shm_is_stale(const char *name)
+{
+	struct scq_shm_header *header = NULL;
+	struct stat st;
+	bool is_stale = false;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size != SCQ_SHM_SIZE) {
+		close(fd);
+		return false;
+	}
+
+	header = mmap(NULL, SCQ_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (header == MAP_FAILED) {
+		return false;
+	}
+
+	if (atomic_load(&header->magic) == SCQ_SHM_MAGIC &&
+			header->version == SCQ_SHM_VERSION &&
+			kill(header->pid, 0) != 0 && errno == ESRCH) {
+		is_stale = true;
+	}
+
+	munmap(header, SCQ_SHM_SIZE);
+
+	return is_stale;
+}
+
+/*
+ * Create the statistics segment under /dev/shm. Per-thread counters are placed
+ * in its lane slots as threads register. A segment already under the name is
+ * only replaced if its process has exited. Returns false on failure.
+ */
+static bool scq_shm_create(struct scalable_queue *scq, const char *name)
+{
+	struct scq_shm_header *header = NULL;
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1 && errno == EEXIST && scq_shm_is_stale(name)) {
+		shm_unlink(name);
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	}
+
+	if (fd == -1) {
+		if (errno == EEXIST) {
+			fprintf(stderr, "scalable_queue_init: shm segment %s is in "
+				"use\n", name);
+		} else {
+			fprintf(stderr, "scalable_queue_init: shm_open failed\n");
+		}
+		return false;
+	}
+
+	if (ftruncate(fd, SCQ_SHM_SIZE) != 0) {
+		fprintf(stderr, "scalable_queue_init: ftruncate failed\n");
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+
+	header = mmap(NULL, SCQ_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+
+	if (header == MAP_FAILED) {
+		fprintf(stderr, "scalable_queue_init: shm mmap failed\n");
+		shm_unlink(name);
+		return false;
+	}
+
+	scq->shm_name = strdup(name);
+	if (scq->shm_name == NULL) {
+		fprintf(stderr, "scalable_queue_init: shm name allocation failed\n");
+		munmap(header, SCQ_SHM_SIZE);
+		shm_unlink(name);
+		return false;
+	}
+
+	header->version = SCQ_SHM_VERSION;
+	header->lane_max = SCQ_SHM_LANE_MAX;
+	atomic_store(&header->lane_num, 0);
+	header->pid = (int32_t)getpid();
+	header->latency_sample_rate = scq->latency_sample_rate;
+	header->calib_tsc = scq->calib_tsc;
+	header->calib_ns = scq->calib_ns;
+	atomic_store(&header->magic, SCQ_SHM_MAGIC);
+
+	scq->shm = header;
+
+	return true;
+}
+#endif /* SCQ_NO_STATS */
+
+/*
+ * Unmap and unlink the statistics segment, if the queue has one.
+ */
+static void scq_shm_release(struct scalable_queue *scq)
+{
+	if (scq->shm == NULL) {
+		return;
+	}
+
+	munmap(scq->shm, SCQ_SHM_SIZE);
+	shm_unlink(scq->shm_name);
+	free(scq->shm_name);
+
+	scq->shm = NULL;
+	scq->shm_name = NULL;
+}
+
+/*
+ * Returns pointer to an scalable_queue, or NULL on failure.
+ */
+struct scalable_queue *scq_init(void)
+{
+	return scq_init_ex(NULL);
+}
+
+/*
+ * Same as scq_init(), but the queue is configured by the given context.
+ * A NULL context gives the default queue.
+ */
+struct scalable_queue *scq_init_ex(struct scq_init_context *ctx)
+{
+	/* handoff_waiter has a cache line of its own, which calloc() ignores */
+	struct scalable_queue *scq = aligned_alloc(SCQ_CACHE_LINE_SIZE,
+		sizeof(struct scalable_queue));
+
+	if (scq == NULL) {
+		fprintf(stderr, "scalable_queue_init: queue allocation failed\n");
+		return NULL;
+	}
+
+	memset(scq, 0, sizeof(struct scalable_queue));
+	scq->thread_num = 0;
+	scq->flags = (ctx != NULL) ? ctx->flags : 0;
+	scq->sublist_num = (ctx != NULL && ctx->sublist_num > 1) ?
+		(int)ctx->sublist_num : 1;
+
+	if (scq->sublist_num > MAX_SUBLIST_NUM) {
+		scq->sublist_num = MAX_SUBLIST_NUM;
+	}
+
+	if (ctx != NULL) {
+		scq->overflow_policy = ctx->overflow_policy;
+		scq->block_timeout_ns = ctx->block_timeout_ns;
+		scq->drop_func = ctx->drop_func;
+		scq->drop_arg = ctx->drop_arg;
+		scq->latency_sample_rate = ctx->latency_sample_rate;
+	}
+
+	/* Only a sampling queue pays for the stamp in every node */
+	scq->node_size = (scq->latency_sample_rate != 0) ?
+		sizeof(struct scq_stamped_node) : sizeof(struct scq_node);
+
+	if (scq->flags & SCQ_FLAG_FLIGHT_RECORDER) {
+		scq->recorder_event_num = SCQ_DEFAULT_RECORDER_EVENT_NUM;
+		if (ctx->recorder_event_num > 1) {
+			scq->recorder_event_num = 1ULL
+				<< (64 - __builtin_clzll(ctx->recorder_event_num - 1));
+		}
+	}
+
+	if (scq->latency_sample_rate != 0 ||
+			(ctx != NULL && ctx->stats_shm_name != NULL)) {
+		scq->calib_ns = scq_now_ns();
+		scq->calib_tsc = scq_rdtsc();
+	}
+
+	if (__builtin_popcount(scq->flags & SCQ_ENGINE_FLAGS) > 1) {
+		fprintf(stderr, "scalable_queue_init: conflicting engine flags\n");
+		free(scq);
+		return NULL;
+	}
+
+	scq->engine = SCQ_ENGINE_RELAXED;
+	scq->mpsc_cursor = 0;
+
+	/* Only the relaxed engine enforces it with the overflow policy */
+	if (ctx != NULL && (scq->flags & SCQ_ENGINE_FLAGS) == 0) {
+		scq->capacity = ctx->capacity;
+	}
+
+	if (scq->flags & SCQ_FLAG_SPSC) {
+		scq->engine = SCQ_ENGINE_SPSC;
+		scq->spsc_ring = scq_spsc_ring_init();
+
+		if (scq->spsc_ring == NULL) {
+			fprintf(stderr, "scalable_queue_init: ring init failed\n");
+			free(scq);
+			return NULL;
+		}
+	} else if (scq->flags & SCQ_FLAG_MPSC) {
+		scq->engine = SCQ_ENGINE_MPSC;
+	} else if (scq->flags & SCQ_FLAG_SPSC_MATRIX) {
+		if (ctx->consumer_num == 0 || ctx->consumer_num > MAX_THREAD_NUM) {
+			fprintf(stderr, "scalable_queue_init: invalid consumer_num\n");
+			free(scq);
+			return NULL;
+		}
+
+		scq->engine = SCQ_ENGINE_MATRIX;
+		scq->consumer_num = (int)ctx->consumer_num;
+		atomic_store(&scq->matrix_column_cnt, 0);
+	} else if (scq->flags & SCQ_FLAG_BOUNDED_RING) {
+		scq->engine = SCQ_ENGINE_BOUNDED;
+		scq->bounded_ring = scq_bounded_ring_init(
+			(ctx->capacity != 0) ? ctx->capacity : SCQ_DEFAULT_RING_CAPACITY);
+
+		if (scq->bounded_ring == NULL) {
+			fprintf(stderr, "scalable_queue_init: ring init failed\n");
+			free(scq);
+			return NULL;
+		}
+	}
+
+	if (pthread_spin_init(&scq->spinlock, PTHREAD_PROCESS_PRIVATE) != 0) {
+		fprintf(stderr, "scalable_queue_init: spinlock init failed\n");
+		scq_spsc_ring_destroy(scq->spsc_ring);
+		scq_bounded_ring_destroy(scq->bounded_ring);
+		free(scq);
+		return NULL;
+	}
+
+	/* Get the spinlock to assign scq id */
+	while (atomic_exchange(&global_scq_id_flag, 1) == 1) {
+		__asm__ __volatile__("pause");
+	}
+
+	scq->scq_id = -1;
+	for (int i = 0; i < MAX_SCQ_NUM; i++) {
+		if (atomic_load(&global_scq_id_arr[i]) == 0) {
+			atomic_store(&global_scq_id_arr[i], 1);
+			scq->scq_id = i;
+			break;
+		}
+	}
+
+	atomic_store(&global_scq_id_flag, 0);
+
+	/* Invalid id */
+	if (scq->scq_id == -1) {
+		fprintf(stderr, "scalable_queue_init: invalid scq id\n");
+		pthread_spin_destroy(&scq->spinlock);
+		scq_spsc_ring_destroy(scq->spsc_ring);
+		scq_bounded_ring_destroy(scq->bounded_ring);
+		free(scq);
+		return NULL;
+	}
+
+	if (ctx != NULL && ctx->stats_shm_name != NULL) {
+#ifdef SCQ_NO_STATS
+		fprintf(stderr, "scalable_queue_init: built without statistics\n");
+		scq_destroy(scq);
+		return NULL;
+#else
+		if (scq->engine != SCQ_ENGINE_RELAXED ||
+				!scq_shm_create(scq, ctx->stats_shm_name)) {
+			fprintf(stderr, "scalable_queue_init: stats export failed\n");
+			scq_destroy(scq);
+			return NULL;
+		}
+#endif /* SCQ_NO_STATS */
+	}
+
+	if (scq->recorder_event_num != 0) {
+		atomic_store(&recorder_scq_arr[scq->scq_id], scq);
+	}
+
+	return scq;
+}
+
+/*
+ * Destroy the given scalable_queue.
+ */
+void scq_destroy(struct scalable_queue *scq)
+{
+	struct scq_tls_data *tls_data_ptr;
+	struct scq_dequeued_node_list *dequeued_node_list;
+	struct scq_free_node_list *free_node_list;
+	struct scq_spsc_ring **matrix_row;
+	struct scq_node *node, *prev_node;
+	uint64_t handoff_state;
+
+	if (scq == NULL) {
+		return;
+	}
+
+	assert(scq->scq_id >= 0 && scq->scq_id < MAX_SCQ_NUM);
+
+	atomic_store(&recorder_scq_arr[scq->scq_id], NULL);
+
+	/* Get the spinlock to return scq id */
+	while (atomic_exchange(&global_scq_id_flag, 1) == 1) {
+		__asm__ __volatile__("pause");
+	}
+
+	atomic_store(&global_scq_id_arr[scq->scq_id], 0);
+
+	atomic_store(&global_scq_id_flag, 0);
+
+	/* Free thread-local linked lists */
+	for (int i = 0; i < scq->thread_num; i++) {
+		tls_data_ptr = scq->tls_data_ptr_list[i];
+		dequeued_node_list = &tls_data_ptr->dequeued_node_list;
+		free_node_list = &tls_data_ptr->free_node_list;
+
+		/* Handed over, but no dequeue thread came back for it */
+		handoff_state = atomic_load(&tls_data_ptr->handoff_slot.state);
+		if ((handoff_state & SCQ_HANDOFF_KIND_MASK) == SCQ_HANDOFF_FULL &&
+				scq->drop_func != NULL) {
+			scq->drop_func(atomic_load(&tls_data_ptr->handoff_slot.datum),
+				scq->drop_arg);
+		}
+
+		/* Arena nodes are released together with their chunks below */
+		if (scq->flags & SCQ_FLAG_NUMA_ARENA) {
+			goto release_arena;
+		}
+
+		if (dequeued_node_list->local_initial_head != NULL) {
+			node = dequeued_node_list->local_initial_head;
+			while (node != dequeued_node_list->local_tail) {
+				prev_node = node;
+				node = node->next;
+				free(prev_node);
+			}
+			free(dequeued_node_list->local_tail);
+		}
+
+		if (free_node_list->local_head != NULL) {
+			node = free_node_list->local_head;
+			while (node != free_node_list->local_tail) {
+				prev_node = node;
+				node = node->next;
+				free(prev_node);
+			}
+			free(free_node_list->local_tail);
+		}
+
+		node = free_node_list->shared_sentinel.next;
+		while (node != NULL) {
+			prev_node = node;
+			node = node->next;
+			free(prev_node);
+		}
+
+		for (int j = 0; j < tls_data_ptr->sublist_num; j++) {
+			node = tls_data_ptr->sublist_arr[j].shared_sentinel.next;
+			while (node != NULL) {
+				prev_node = node;
+				node = node->next;
+				free(prev_node);
+			}
+		}
+
+release_arena:
+		scq_arena_release(&tls_data_ptr->arena);
+		scq_spsc_ring_destroy(tls_data_ptr->spsc_ring);
+
+		matrix_row = atomic_load(&tls_data_ptr->matrix_row);
+		if (matrix_row != NULL) {
+			for (int j = 0; j < scq->consumer_num; j++) {
+				scq_spsc_ring_destroy(matrix_row[j]);
+			}
+			free(matrix_row);
+		}
+
+		if (tls_data_ptr->sublist_arr != &tls_data_ptr->sublist) {
+			free(tls_data_ptr->sublist_arr);
+		}
+
+		if (tls_data_ptr->shm_lane == NULL) {
+			free(tls_data_ptr->latency);
+		}
+
+		free(tls_data_ptr->transfer_row);
+		free(tls_data_ptr->recorder);
+		free(tls_data_ptr);
+	}
+
+	scq_spsc_ring_destroy(scq->spsc_ring);
+	scq_bounded_ring_destroy(scq->bounded_ring);
+	scq_shm_release(scq);
+
+	pthread_spin_destroy(&scq->spinlock);
+
+	free(scq);
+}
+
+/*
+ * Has this scalable_queue been accessed by this thread before?
+ * If not, initialize thread local data.
+ */
+static void check_and_init_scq_tls_data(struct scalable_queue *scq)
+{
+	struct scq_tls_data *tls_data = NULL;
+	struct scq_sublist *sublist_arr = NULL;
+
+	if (tls_scq_ptr_arr[scq->scq_id] == scq) {
+		return;
+	}
+
+	tls_data = (struct scq_tls_data *)aligned_alloc(SCQ_CACHE_LINE_SIZE,
+		sizeof(struct scq_tls_data));
+	memset(tls_data, 0, sizeof(struct scq_tls_data));
+	tls_data_ptr_arr[scq->scq_id] = tls_data;
+
+	tls_data->dequeued_node_list.local_head = NULL;
+	tls_data->dequeued_node_list.local_tail = NULL;
+	tls_data->dequeued_node_list.local_initial_head = NULL;
+	atomic_store(&tls_data->dequeued_node_list.batch_len, 0);
+	atomic_store(&tls_data->dequeued_node_list.batch_enqueue_ns, 0);
+
+	tls_data->free_node_list.local_head = NULL;
+	tls_data->free_node_list.local_tail = NULL;
+
+	tls_data->free_node_list.shared_sentinel.next = NULL;
+	tls_data->free_node_list.shared_tail
+		= &tls_data->free_node_list.shared_sentinel;
+	atomic_store(&tls_data->free_node_list.dequeue_cnt, 0);
+
+	tls_data->sublist_arr = &tls_data->sublist;
+	tls_data->sublist_num = 1;
+
+	if (scq->sublist_num > 1) {
+		sublist_arr = aligned_alloc(SCQ_CACHE_LINE_SIZE,
+			sizeof(struct scq_sublist) * scq->sublist_num);
+
+		/* Without the array this lane just is not striped */
+		if (sublist_arr != NULL) {
+			tls_data->sublist_arr = sublist_arr;
+			tls_data->sublist_num = scq->sublist_num;
+		}
+	}
+
+	for (int i = 0; i < tls_data->sublist_num; i++) {
+		tls_data->sublist_arr[i].shared_sentinel.next = NULL;
+		tls_data->sublist_arr[i].shared_tail
+			= &tls_data->sublist_arr[i].shared_sentinel;
+		atomic_store(&tls_data->sublist_arr[i].head_enqueue_ns, 0);
+	}
+
+	tls_data->next_sublist_idx = 0;
+	atomic_store(&tls_data->enqueue_cnt, 0);
+	tls_data->enqueue_credit = (scq->capacity != 0) ? 0 : UINT64_MAX;
+	atomic_store(&tls_data->lease_owner, -1);
+	atomic_store(&tls_data->lease_active_ns, 0);
+	atomic_store(&tls_data->handoff_slot.state, SCQ_HANDOFF_EMPTY);
+	tls_data->handoff_pending = NULL;
+
+	tls_data->arena.chunk_list = NULL;
+	tls_data->arena.bump_ptr = NULL;
+	tls_data->arena.bump_end = NULL;
+	tls_data->arena.numa_node = -1;
+
+	/* Without a ring this thread's enqueues fail, the consumer skips it */
+	tls_data->spsc_ring = NULL;
+	if (scq->engine == SCQ_ENGINE_MPSC) {
+		tls_data->spsc_ring = scq_spsc_ring_init();
+	}
+
+	atomic_store(&tls_data->matrix_row, NULL);
+	tls_data->matrix_rr = 0;
+	tls_data->matrix_column = SCQ_MATRIX_COLUMN_NONE;
+
+	tls_data->rand_state = ((uint64_t)(uintptr_t)tls_data
+		* 0x9E3779B97F4A7C15ULL) | 1;
+	tls_data->last_dequeued_thread_idx = 0;
+
+	/* Without a row this thread's batches are just not recorded */
+	tls_data->transfer_row = NULL;
+	tls_data->numa_node = -1;
+	if (scq->flags & SCQ_FLAG_TRANSFER_MATRIX) {
+		tls_data->transfer_row = aligned_alloc(SCQ_CACHE_LINE_SIZE,
+			sizeof(struct scq_transfer_counter) * MAX_THREAD_NUM);
+		if (tls_data->transfer_row != NULL) {
+			memset(tls_data->transfer_row, 0,
+				sizeof(struct scq_transfer_counter) * MAX_THREAD_NUM);
+		}
+		tls_data->numa_node = scq_current_numa_node();
+	}
+
+	/* Without a ring this thread just records nothing */
+	tls_data->recorder = NULL;
+	if (scq->recorder_event_num != 0) {
+		tls_data->recorder = calloc(1, sizeof(struct scq_recorder)
+			+ sizeof(struct scq_recorder_event) * scq->recorder_event_num);
+		if (tls_data->recorder != NULL) {
+			tls_data->recorder->mask = scq->recorder_event_num - 1;
+		}
+	}
+
+	tls_data->shm_lane = NULL;
+#ifndef SCQ_NO_STATS
+	tls_data->stats = &tls_data->stats_buf;
+#endif /* SCQ_NO_STATS */
+
+	/* Without a histogram this thread just does not sample */
+	tls_data->latency_countdown = UINT64_MAX;
+	tls_data->latency = NULL;
+	if (scq->latency_sample_rate != 0 && scq->engine == SCQ_ENGINE_RELAXED &&
+			scq->shm == NULL) {
+		tls_data->latency = aligned_alloc(SCQ_CACHE_LINE_SIZE,
+			sizeof(struct scq_thread_latency));
+		if (tls_data->latency != NULL) {
+			memset(tls_data->latency, 0, sizeof(struct scq_thread_latency));
+		}
+	}
+
+	pthread_spin_lock(&scq->spinlock);
+	tls_data->thread_idx = scq->thread_num;
+	tls_data->sublist_cursor = scq->thread_num;
+
+	/* The slot is still unseen by scqstat, lane_num is raised after it */
+	if (scq->shm != NULL) {
+		tls_data->shm_lane = scq_shm_lane_slot(scq->shm, scq->thread_num);
+#ifndef SCQ_NO_STATS
+		tls_data->stats = &tls_data->shm_lane->stats;
+#endif /* SCQ_NO_STATS */
+		if (scq->latency_sample_rate != 0) {
+			tls_data->latency = &tls_data->shm_lane->latency;
+		}
+	}
+
+	scq->tls_data_ptr_list[scq->thread_num] = tls_data;
+	scq->thread_num++;
+
+	if (scq->shm != NULL) {
+		atomic_store_explicit(&scq->shm->lane_num, (uint32_t)scq->thread_num,
+			memory_order_release);
+	}
+	pthread_spin_unlock(&scq->spinlock);
+
+	if (tls_data->latency != NULL) {
+		tls_data->latency_countdown = scq->latency_sample_rate;
+	}
+
+	tls_scq_ptr_arr[scq->scq_id] = scq;
+}
+
+/*
+ * Wait for an enqueue thread that has exchanged the tail but not yet linked
+ * the node. The wait is recorded, so that a hang here shows up in the flight
+ * recorder as a SPIN_ENTER without its SPIN_EXIT.
+ */
+static void scq_spin_next(struct scq_tls_data *tls_data,
+	struct scq_node *node, int site, int lane)
+{
+	uint64_t spin_cnt = 0;
+
+	scq_record(tls_data, SCQ_EVENT_SPIN_ENTER, lane, (uint64_t)site);
+
+	while (node->next == NULL) {
+		spin_cnt++;
+		__asm__ __volatile__("pause");
+	}
+
+	SCQ_STAT_ADD(tls_data, spin_cnt, spin_cnt);
+	scq_record(tls_data, SCQ_EVENT_SPIN_EXIT, lane, spin_cnt);
+}
+
+/*
+ * Allocate a brand new node, from the thread's arena if the queue uses one.
+ */
+static struct scq_node *scq_new_node(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data)
+{
+	struct scq_node *node = NULL;
+
+	SCQ_STAT_ADD(tls_data, malloc_fallback_cnt, 1);
+	SCQ_PROBE2(malloc_fallback, scq->scq_id, tls_data->thread_idx);
+
+	if (scq->flags & SCQ_FLAG_NUMA_ARENA) {
+		node = scq_arena_alloc_node(&tls_data->arena, scq->node_size);
+	} else {
+		node = (struct scq_node *)malloc(scq->node_size);
+	}
+
+	return node;
+}
+
+/*
+ * If there is free node, return it.
+ * Otherwise call malloc().
+ */
+static struct scq_node *scq_allocate_node(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data)
+{
+	struct scq_node *node = NULL;
+	struct scq_free_node_list *free_node_list = &tls_data->free_node_list;
+
+	if (free_node_list->local_head == NULL) {
+		if (free_node_list->shared_sentinel.next == NULL) {
+			return scq_new_node(scq, tls_data);
+		}
+
+		free_node_list->local_head
+			= atomic_exchange(&free_node_list->shared_sentinel.next, NULL);
+
+		if (free_node_list->local_head == NULL) {
+			return scq_new_node(scq, tls_data);
+		}
+
+		free_node_list->local_tail
+			= atomic_exchange(&free_node_list->shared_tail,
+				&free_node_list->shared_sentinel);
+	}
+
+	node = free_node_list->local_head;
+	SCQ_STAT_ADD(tls_data, free_list_recycle_cnt, 1);
+
+	if (free_node_list->local_head == free_node_list->local_tail) {
+		free_node_list->local_head = NULL;
+		free_node_list->local_tail = NULL;
+	} else {
+		if (node->next == NULL) {
+			SCQ_PROBE2(spin, scq->scq_id, SCQ_SPIN_FREE_LIST);
+			scq_spin_next(tls_data, node, SCQ_SPIN_FREE_LIST,
+				tls_data->thread_idx);
+		}
+
+		free_node_list->local_head = node->next;
+	}
+
+	return node;
+}
+
+/*
+ * Is any sublist of the given enqueue thread non-empty?
+ */
+static bool scq_lane_has_nodes(struct scq_tls_data *tls_data)
+{
+	for (int i = 0; i < tls_data->sublist_num; i++) {
+		if (tls_data->sublist_arr[i].shared_sentinel.next != NULL) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Number of nodes enqueued by the given thread and not yet returned by a
+ * dequeue thread, including nodes detached but not yet popped.
+ */
+static uint64_t scq_lane_queued(struct scq_tls_data *tls_data)
+{
+	/* dequeue_cnt first, it never passes an enqueue_cnt read after it */
+	uint64_t dequeue_cnt = atomic_load_explicit(
+		&tls_data->free_node_list.dequeue_cnt, memory_order_relaxed);
+	uint64_t enqueue_cnt = atomic_load_explicit(&tls_data->enqueue_cnt,
+		memory_order_relaxed);
+
+	return enqueue_cnt - dequeue_cnt;
+}
+
+/*
+ * Sum of every lane's queued nodes, minus the nodes dequeue threads have
+ * already popped from batches they have not finished. Each counter has a
+ * single writer or is advanced once per batch, so this costs nothing on the
+ * fast paths.
+ */
+static uint64_t scq_queued_estimate(struct scalable_queue *scq)
+{
+	int thread_num = scq->thread_num;
+	struct scq_tls_data *tls_data = NULL;
+	uint64_t queued = 0, popped = 0;
+
+	for (int i = 0; i < thread_num; i++) {
+		tls_data = scq->tls_data_ptr_list[i];
+
+		popped += atomic_load_explicit(&tls_data->dequeued_node_list.batch_len,
+			memory_order_relaxed);
+		queued += scq_lane_queued(tls_data);
+	}
+
+	return (queued > popped) ? queued - popped : 0;
+}
+
+/*
+ * Coarse monotonic clock, in nanoseconds. Only a few nanoseconds to read.
+ */
+static uint64_t scq_coarse_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Spin for a while, then start giving the cpu away.
+ */
+static void scq_backoff(struct scalable_queue *scq, int *spin_cnt)
+{
+	if (*spin_cnt == 0) {
+		SCQ_PROBE2(spin, scq->scq_id, SCQ_SPIN_BACKOFF);
+	}
+
+	if (*spin_cnt < SCQ_BACKOFF_SPIN_NUM) {
+		(*spin_cnt)++;
+		__asm__ __volatile__("pause");
+	} else {
+		sched_yield();
+	}
+}
+
+static bool scq_drop_oldest(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum);
+
+/*
+ * Slow path of the capacity check, taken when this thread's enqueue_credit is
+ * used up. If the queue's estimated size is below capacity, the thread gets a
+ * new share of the remaining room as credit, so enqueue threads check the
+ * shared counters rarely while the queue is far from full, and more often as
+ * it fills up.
+ *
+ * Otherwise the overflow policy decides. Returns false if the datum must not
+ * be enqueued. @is_try tells whether the caller can report that, which
+ * scq_enqueue() cannot, so it waits under FAIL and BLOCK instead.
+ */
+static bool scq_admit(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t datum, bool is_try)
+{
+	struct timespec now, deadline = { 0, 0 };
+	uint64_t queued = 0, oldest = 0;
+	int spin_cnt = 0;
+
+	if (scq->capacity == 0) {
+		tls_data->enqueue_credit = UINT64_MAX;
+		return true;
+	}
+
+	for (;;) {
+		queued = scq_queued_estimate(scq);
+
+		if (queued < scq->capacity) {
+			tls_data->enqueue_credit
+				= (scq->capacity - queued) / scq->thread_num;
+
+			if (tls_data->enqueue_credit == 0) {
+				tls_data->enqueue_credit = 1;
+			}
+
+			return true;
+		}
+
+		switch (scq->overflow_policy) {
+		case SCQ_OVERFLOW_DROP_NEWEST:
+			if (!is_try && scq->drop_func != NULL) {
+				scq->drop_func(datum, scq->drop_arg);
+			}
+			return false;
+		case SCQ_OVERFLOW_DROP_OLDEST:
+			if (scq_drop_oldest(scq, tls_data, &oldest)) {
+				if (scq->drop_func != NULL) {
+					scq->drop_func(oldest, scq->drop_arg);
+				}
+				tls_data->enqueue_credit = 1;
+				return true;
+			}
+			/* Everything is held by dequeue threads, wait for them */
+			break;
+		case SCQ_OVERFLOW_BLOCK:
+			if (!is_try || scq->block_timeout_ns == 0) {
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if (deadline.tv_sec == 0 && deadline.tv_nsec == 0) {
+				deadline.tv_sec = now.tv_sec
+					+ (time_t)(scq->block_timeout_ns / 1000000000ULL);
+				deadline.tv_nsec = now.tv_nsec
+					+ (long)(scq->block_timeout_ns % 1000000000ULL);
+
+				if (deadline.tv_nsec >= 1000000000L) {
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000L;
+				}
+			} else if (now.tv_sec > deadline.tv_sec ||
+					(now.tv_sec == deadline.tv_sec &&
+					 now.tv_nsec >= deadline.tv_nsec)) {
+				return false;
+			}
+			break;
+		default:
+			if (is_try) {
+				return false;
+			}
+			break;
+		}
+
+		scq_backoff(scq, &spin_cnt);
+	}
+}
+
+/*
+ * Hand the datum directly to a waiting dequeue thread, if there is one.
+ * This thread's own lane must be empty, otherwise the datum would overtake
+ * data this thread enqueued before, and its previous handoff claimed, see
+ * scq_handoff_reclaim().
+ *
+ * The datum counts as queued in this thread's lane until a dequeue thread
+ * claims it, so the size queries and the capacity check see it.
+ */
+static bool scq_handoff(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t datum)
+{
+	struct scq_handoff_slot *slot = NULL;
+	int waiter = atomic_load_explicit(&scq->handoff_waiter,
+		memory_order_relaxed);
+	uint64_t state = 0;
+
+	if (waiter == 0 || tls_data->handoff_pending != NULL ||
+			scq_lane_has_nodes(tls_data)) {
+		return false;
+	}
+
+	if (!atomic_compare_exchange_strong(&scq->handoff_waiter, &waiter, 0)) {
+		return false;
+	}
+
+	slot = &scq->tls_data_ptr_list[waiter - 1]->handoff_slot;
+	state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+
+	atomic_store_explicit(&slot->datum, datum, memory_order_relaxed);
+	atomic_store_explicit(&slot->lane, tls_data->thread_idx,
+		memory_order_relaxed);
+
+	/* Counted before it can be claimed, so the backlog never underflows */
+	atomic_store_explicit(&tls_data->enqueue_cnt,
+		atomic_load_explicit(&tls_data->enqueue_cnt, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+
+	state = ((state & ~SCQ_HANDOFF_KIND_MASK) + SCQ_HANDOFF_FILL) |
+		SCQ_HANDOFF_FULL;
+	atomic_store_explicit(&slot->state, state, memory_order_release);
+
+	tls_data->handoff_pending = slot;
+	tls_data->handoff_pending_state = state;
+	tls_data->handoff_pending_datum = datum;
+
+	return true;
+}
+
+/*
+ * Take the datum out of a full handoff slot and return it to the lane of the
+ * enqueue thread that handed it over, like a node. Returns false if the slot
+ * is not full or another dequeue thread claimed it first.
+ */
+static bool scq_handoff_claim(struct scalable_queue *scq,
+	struct scq_handoff_slot *slot, uint64_t *datum)
+{
+	struct scq_tls_data *tls_data_enq_thread = NULL;
+	uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+	uint64_t claimed = 0;
+	int lane = 0;
+
+	if ((state & SCQ_HANDOFF_KIND_MASK) != SCQ_HANDOFF_FULL) {
+		return false;
+	}
+
+	claimed = atomic_load_explicit(&slot->datum, memory_order_relaxed);
+	lane = atomic_load_explicit(&slot->lane, memory_order_relaxed);
+
+	if (!atomic_compare_exchange_strong(&slot->state, &state,
+			(state & ~SCQ_HANDOFF_KIND_MASK) | SCQ_HANDOFF_EMPTY)) {
+		return false;
+	}
+
+	tls_data_enq_thread = scq->tls_data_ptr_list[lane];
+
+	atomic_fetch_add_explicit(&tls_data_enq_thread->free_node_list.dequeue_cnt,
+		1, memory_order_relaxed);
+
+	if (tls_data_enq_thread->shm_lane != NULL) {
+		atomic_fetch_add_explicit(
+			&tls_data_enq_thread->shm_lane->returned_cnt, 1,
+			memory_order_relaxed);
+	}
+
+	*datum = claimed;
+
+	return true;
+}
+
+/*
+ * Allocate this enqueue thread's row of the MATRIX engine. The row is
+ * published only once all of its rings exist, so dequeue threads either see
+ * nothing or a complete row.
+ */
+static struct scq_spsc_ring **scq_matrix_init_row(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data)
+{
+	struct scq_spsc_ring **row
+		= calloc(scq->consumer_num, sizeof(struct scq_spsc_ring *));
+
+	if (row == NULL) {
+		return NULL;
+	}
+
+	for (int i = 0; i < scq->consumer_num; i++) {
+		row[i] = scq_spsc_ring_init();
+
+		if (row[i] == NULL) {
+			for (int j = 0; j < i; j++) {
+				scq_spsc_ring_destroy(row[j]);
+			}
+			free(row);
+			return NULL;
+		}
+	}
+
+	atomic_store_explicit(&tls_data->matrix_row, row, memory_order_release);
+
+	return row;
+}
+
+/*
+ * MATRIX engine enqueue. The ring of the given column is used, or the next one
+ * in round-robin order if the column is negative. Nothing but the enqueue
+ * thread's own ring is written, so there is no read-modify-write atomic.
+ */
+static bool scq_matrix_enqueue(struct scalable_queue *scq, int column,
+	uint64_t datum)
+{
+	struct scq_tls_data *tls_data = NULL;
+	struct scq_spsc_ring **row = NULL;
+
+	check_and_init_scq_tls_data(scq);
+	tls_data = tls_data_ptr_arr[scq->scq_id];
+
+	row = atomic_load_explicit(&tls_data->matrix_row, memory_order_relaxed);
+	if (row == NULL && (row = scq_matrix_init_row(scq, tls_data)) == NULL) {
+		return false;
+	}
+
+	if (column < 0) {
+		column = (int)(tls_data->matrix_rr++ % scq->consumer_num);
+	}
+
+	return scq_spsc_ring_enqueue(row[column], datum);
+}
+
+/*
+ * scq_enqueue() of the specialized engines. Returns false if the datum could
+ * not be enqueued, i.e. the bounded ring is full or memory ran out.
+ *
+ * The SPSC engine does not even look up thread-local data. In the MPSC engine
+ * each enqueue thread writes its own ring, so no atomic exchange is needed.
+ */
+static bool scq_engine_enqueue(struct scalable_queue *scq, uint64_t datum)
+{
+	struct scq_spsc_ring *ring = NULL;
+
+	switch (scq->engine) {
+	case SCQ_ENGINE_SPSC:
+		return scq_spsc_ring_enqueue(scq->spsc_ring, datum);
+	case SCQ_ENGINE_MPSC:
+		check_and_init_scq_tls_data(scq);
+		ring = tls_data_ptr_arr[scq->scq_id]->spsc_ring;
+
+		/* Its allocation failed when this thread registered */
+		if (ring == NULL) {
+			return false;
+		}
+
+		return scq_spsc_ring_enqueue(ring, datum);
+	case SCQ_ENGINE_BOUNDED:
+		return scq_bounded_ring_enqueue(scq->bounded_ring, datum);
+	case SCQ_ENGINE_MATRIX:
+		return scq_matrix_enqueue(scq, -1, datum);
+	default:
+		assert(false);
+	}
+
+	return false;
+}
+
+/*
+ * Append the node at the tail of the sublist: the fence, the exchange of
+ * shared_tail and the store linking the previous tail to the node. Between the
+ * exchange and the link, dequeue threads that reach the previous tail spin on
+ * its next pointer.
+ */
+static inline void scq_sublist_append(struct scq_sublist *sublist,
+	struct scq_node *node)
+{
+	struct scq_node *prev_tail = NULL;
+
+	__sync_synchronize();
+
+	prev_tail = atomic_exchange(&sublist->shared_tail, node);
+	assert(prev_tail != NULL);
+
+	SCQ_PREEMPT_POINT();
+
+	/* Stamped before the link, a dequeue thread seeing the node sees it too */
+	if (prev_tail == &sublist->shared_sentinel) {
+		atomic_store_explicit(&sublist->head_enqueue_ns, scq_coarse_now_ns(),
+			memory_order_relaxed);
+	}
+
+	prev_tail->next = node;
+}
+
+/*
+ * Any dequeue thread may claim a full handoff slot, so this thread's datum
+ * still waiting in one could be claimed after data it enqueues later. Before
+ * appending to its lane again, the thread takes the datum back with the same
+ * CAS and appends it first. Usually the dequeue thread has taken it already,
+ * which costs one load of its slot. Returns false if no node could be
+ * allocated for it, the datum then stays in the slot.
+ */
+static bool scq_handoff_reclaim(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data)
+{
+	struct scq_free_node_list *free_node_list = &tls_data->free_node_list;
+	struct scq_handoff_slot *slot = tls_data->handoff_pending;
+	uint64_t state = tls_data->handoff_pending_state;
+	struct scq_node *node = NULL;
+
+	if (atomic_load_explicit(&slot->state, memory_order_relaxed) != state) {
+		tls_data->handoff_pending = NULL;
+		return true;
+	}
+
+	/* Allocated first, the datum must not be in hand without a node */
+	node = scq_allocate_node(scq, tls_data);
+	if (node == NULL) {
+		return false;
+	}
+
+	tls_data->handoff_pending = NULL;
+
+	if (!atomic_compare_exchange_strong(&slot->state, &state,
+			(state & ~SCQ_HANDOFF_KIND_MASK) | SCQ_HANDOFF_EMPTY)) {
+		/* Claimed in the meantime, the node goes back to the local list */
+		if (free_node_list->local_head == NULL) {
+			free_node_list->local_tail = node;
+		}
+		node->next = free_node_list->local_head;
+		free_node_list->local_head = node;
+		return true;
+	}
+
+	/* Still counted in enqueue_cnt since the handoff, and never sampled */
+	node->datum = tls_data->handoff_pending_datum;
+	node->next = NULL;
+
+	if (scq->latency_sample_rate != 0) {
+		((struct scq_stamped_node *)node)->tsc = 0;
+	}
+
+	scq_sublist_append(&tls_data->sublist_arr[tls_data->next_sublist_idx],
+		node);
+
+	return true;
+}
+
+/*
+ * Enqueue of the relaxed engine. Returns false if the capacity policy rejected
+ * the datum, see scq_admit(), or if no node could be allocated for it.
+ */
+static bool scq_relaxed_enqueue(struct scalable_queue *scq, uint64_t datum,
+	bool is_try)
+{
+	struct scq_tls_data *tls_data = NULL;
+	struct scq_sublist *sublist = NULL;
+	struct scq_node *node = NULL;
+
+	check_and_init_scq_tls_data(scq);
+	tls_data = tls_data_ptr_arr[scq->scq_id];
+
+	if (scq->flags & SCQ_FLAG_HANDOFF) {
+		/* Nothing may be appended behind a datum that is still out */
+		if (tls_data->handoff_pending != NULL &&
+				!scq_handoff_reclaim(scq, tls_data)) {
+			return false;
+		}
+
+		if (scq_handoff(scq, tls_data, datum)) {
+			SCQ_STAT_ADD(tls_data, enqueue_cnt, 1);
+			scq_record(tls_data, SCQ_EVENT_ENQUEUE, tls_data->thread_idx,
+				datum);
+			return true;
+		}
+	}
+
+	/* Unbounded queues start with UINT64_MAX credit and never get here */
+	if (tls_data->enqueue_credit == 0 &&
+			!scq_admit(scq, tls_data, datum, is_try)) {
+		return false;
+	}
+
+	/* The arena or malloc() may fail, before anything is counted */
+	node = scq_allocate_node(scq, tls_data);
+	if (node == NULL) {
+		return false;
+	}
+
+	tls_data->enqueue_credit--;
+	SCQ_STAT_ADD(tls_data, enqueue_cnt, 1);
+
+	sublist = &tls_data->sublist_arr[tls_data->next_sublist_idx];
+	if (tls_data->sublist_num > 1 &&
+			++tls_data->next_sublist_idx == tls_data->sublist_num) {
+		tls_data->next_sublist_idx = 0;
+	}
+
+	node->datum = datum;
+	node->next = NULL;
+
+	if (scq->latency_sample_rate != 0) {
+		scq_latency_stamp(scq, tls_data, node);
+	}
+
+	/* Counted before the node is visible, so the backlog never underflows */
+	atomic_store_explicit(&tls_data->enqueue_cnt,
+		atomic_load_explicit(&tls_data->enqueue_cnt, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+
+	scq_sublist_append(sublist, node);
+
+	SCQ_PROBE3(enqueue, scq->scq_id, tls_data->thread_idx, datum);
+	scq_record(tls_data, SCQ_EVENT_ENQUEUE, tls_data->thread_idx, datum);
+
+	return true;
+}
+
+/*
+ * Enqueue the given datum into the queue. Returns false if it was not
+ * enqueued: dropped under SCQ_OVERFLOW_DROP_NEWEST, or a specialized engine
+ * could not allocate memory for it.
+ */
+bool scq_enqueue(struct scalable_queue *scq, uint64_t datum)
+{
+	int spin_cnt = 0;
+
+	if (scq->engine != SCQ_ENGINE_RELAXED) {
+		/* Wait for room in the bounded ring, others only fail to allocate */
+		while (!scq_engine_enqueue(scq, datum)) {
+			if (scq->engine != SCQ_ENGINE_BOUNDED) {
+				return false;
+			}
+			scq_backoff(scq, &spin_cnt);
+		}
+		return true;
+	}
+
+	return scq_relaxed_enqueue(scq, datum, false);
+}
+
+/*
+ * Enqueue the given datum into the queue, choosing the dequeue thread by key.
+ * Data with the same key go to the same dequeue thread, in order. Only the
+ * MATRIX engine uses the key, the others behave as scq_enqueue().
+ */
+bool scq_enqueue_key(struct scalable_queue *scq, uint64_t key, uint64_t datum)
+{
+	if (scq->engine == SCQ_ENGINE_MATRIX) {
+		return scq_matrix_enqueue(scq, (int)(key % scq->consumer_num), datum);
+	}
+
+	return scq_enqueue(scq, datum);
+}
+
+/*
+ * Enqueue the given datum, unless the queue is full.
+ * Return false if the datum was not enqueued.
+ */
+bool scq_try_enqueue(struct scalable_queue *scq, uint64_t datum)
+{
+	if (scq->engine != SCQ_ENGINE_RELAXED) {
+		return scq_engine_enqueue(scq, datum);
+	}
+
+	return scq_relaxed_enqueue(scq, datum, true);
+}
+
+/*
+ * Return the given nodes into enqueue thread's free node list.
+ */
+static void scq_free_nodes(struct scalable_queue *scq,
+	struct scq_node *initial_head_node, struct scq_node *tail_node,
+	uint64_t node_cnt, int enqueue_thread_idx)
+{
+	struct scq_tls_data *tls_data = scq->tls_data_ptr_list[enqueue_thread_idx];
+	struct scq_free_node_list *free_node_list = &tls_data->free_node_list;
+	struct scq_node *prev_tail = NULL;
+
+	tail_node->next = NULL;
+	__sync_synchronize();
+
+	prev_tail = atomic_exchange(&free_node_list->shared_tail, tail_node);
+	assert(prev_tail != NULL);
+
+	SCQ_PREEMPT_POINT();
+
+	prev_tail->next = initial_head_node;
+
+	atomic_fetch_add_explicit(&free_node_list->dequeue_cnt, node_cnt,
+		memory_order_relaxed);
+
+	if (tls_data->shm_lane != NULL) {
+		atomic_fetch_add_explicit(&tls_data->shm_lane->returned_cnt, node_cnt,
+			memory_order_relaxed);
+	}
+
+	SCQ_PROBE3(free_return, scq->scq_id, enqueue_thread_idx, node_cnt);
+}
+
+/*
+ * SCQ_OVERFLOW_DROP_OLDEST. Detach a sublist, take its first node and put the
+ * rest back at the tail of the same sublist, the way scq_enqueue() appends, so
+ * dequeue threads still find it. The data never leave their lane, so the lane
+ * counters stay right, and only exchanges are used, so a node recycled in the
+ * meantime cannot be confused with the one seen before.
+ *
+ * This thread's own lane is tried first, since no other thread appends to it
+ * and the rest keeps its order. In other lanes the rest goes after whatever
+ * their enqueue thread appended in between.
+ *
+ * Return false if every lane is empty, i.e. all data are held by dequeue
+ * threads.
+ */
+static bool scq_drop_oldest(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	struct scq_tls_data *tls_data_enq_thread = NULL;
+	struct scq_sublist *sublist = NULL;
+	struct scq_node *head = NULL, *tail = NULL, *rest = NULL;
+	struct scq_node *prev_tail = NULL;
+	int thread_num = scq->thread_num, thread_idx = 0;
+	uint64_t head_enqueue_ns = 0;
+
+	for (int i = 0; i < thread_num; i++) {
+		thread_idx = (tls_data->thread_idx + i) % thread_num;
+		tls_data_enq_thread = scq->tls_data_ptr_list[thread_idx];
+
+		for (int j = 0; j < tls_data_enq_thread->sublist_num; j++) {
+			sublist = &tls_data_enq_thread->sublist_arr[j];
+
+			if (sublist->shared_sentinel.next == NULL) {
+				continue;
+			}
+
+			head = atomic_exchange(&sublist->shared_sentinel.next, NULL);
+			if (head == NULL) {
+				continue;
+			}
+
+			head_enqueue_ns = atomic_load_explicit(&sublist->head_enqueue_ns,
+				memory_order_relaxed);
+			tail = atomic_exchange(&sublist->shared_tail,
+				&sublist->shared_sentinel);
+
+			if (head != tail) {
+				if (head->next == NULL) {
+					scq_spin_next(tls_data, head, SCQ_SPIN_DEQUEUED_LIST,
+						thread_idx);
+				}
+				rest = head->next;
+
+				prev_tail = atomic_exchange(&sublist->shared_tail, tail);
+
+				if (prev_tail == &sublist->shared_sentinel) {
+					atomic_store_explicit(&sublist->head_enqueue_ns,
+						head_enqueue_ns, memory_order_relaxed);
+				}
+
+				prev_tail->next = rest;
+			}
+
+			*datum = head->datum;
+			scq_free_nodes(scq, head, head, 1, thread_idx);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * If the popped node carries a stamp, add its time in the queue to this
+ * thread's histogram. TSCs of different cpus may be slightly apart, a negative
+ * latency counts as 0.
+ */
+static inline void scq_latency_record(struct scq_tls_data *tls_data,
+	struct scq_node *node)
+{
+	uint64_t tsc = ((struct scq_stamped_node *)node)->tsc;
+	uint64_t now = 0, delta = 0;
+	_Atomic uint64_t *cnt = NULL;
+
+	if (tsc == 0 || tls_data->latency == NULL) {
+		return;
+	}
+
+	now = scq_rdtsc();
+	delta = (now > tsc) ? now - tsc : 0;
+	cnt = &tls_data->latency->bucket_cnt[scq_latency_bucket(delta)];
+
+	atomic_store_explicit(cnt,
+		atomic_load_explicit(cnt, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+}
+
+/*
+ * Add to a counter only this thread writes, without read-modify-write.
+ */
+static inline void scq_transfer_add(_Atomic uint64_t *cnt, uint64_t n)
+{
+	atomic_store_explicit(cnt,
+		atomic_load_explicit(cnt, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+/*
+ * Dequeue node from thread local linked list.
+ * If the list is empty, return false.
+ */
+static bool pop_from_dequeued_list(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum, int enqueue_thread_idx)
+{
+	struct scq_dequeued_node_list *dequeued_node_list
+		= &tls_data->dequeued_node_list;
+	struct scq_node *node = NULL;
+	uint64_t batch_len = 0;
+
+	if (dequeued_node_list->local_head == NULL) {
+		return false;
+	}
+
+	node = dequeued_node_list->local_head;
+	*datum = node->datum;
+
+	if (scq->latency_sample_rate != 0) {
+		scq_latency_record(tls_data, node);
+	}
+
+	batch_len = atomic_load_explicit(&dequeued_node_list->batch_len,
+		memory_order_relaxed) + 1;
+	atomic_store_explicit(&dequeued_node_list->batch_len, batch_len,
+		memory_order_relaxed);
+
+	if (node == dequeued_node_list->local_tail) {
+		if (tls_data->transfer_row != NULL) {
+			scq_transfer_add(&tls_data->transfer_row[enqueue_thread_idx]
+				.item_cnt, batch_len);
+		}
+
+		scq_record(tls_data, SCQ_EVENT_FREE_RETURN, enqueue_thread_idx,
+			batch_len);
+
+		scq_free_nodes(scq, dequeued_node_list->local_initial_head,
+			dequeued_node_list->local_tail, batch_len, enqueue_thread_idx);
+
+		dequeued_node_list->local_head = NULL;
+		dequeued_node_list->local_tail = NULL;
+		dequeued_node_list->local_initial_head = NULL;
+		atomic_store_explicit(&dequeued_node_list->batch_len, 0,
+			memory_order_relaxed);
+		atomic_store_explicit(&dequeued_node_list->batch_enqueue_ns, 0,
+			memory_order_relaxed);
+	} else {
+		if (node->next == NULL) {
+			SCQ_PROBE2(spin, scq->scq_id, SCQ_SPIN_DEQUEUED_LIST);
+			scq_spin_next(tls_data, node, SCQ_SPIN_DEQUEUED_LIST,
+				enqueue_thread_idx);
+		}
+
+		dequeued_node_list->local_head = node->next;
+	}
+
+	return true;
+}
+
+/*
+ * Detach all nodes from a shared sublist of the given enqueue thread and attach
+ * them into this thread's dequeued list, then pop the first one.
+ * Return false if the lane was empty or other dequeue threads detached it.
+ *
+ * With striped lanes the sublists are tried from this thread's rotating cursor,
+ * so dequeue threads draining the same lane start on different sublists.
+ */
+static bool scq_detach_lane(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, int thread_idx, uint64_t *datum)
+{
+	struct scq_dequeued_node_list *dequeued_node_list
+		= &tls_data->dequeued_node_list;
+	struct scq_tls_data *tls_data_enq_thread
+		= scq->tls_data_ptr_list[thread_idx];
+	int sublist_num = tls_data_enq_thread->sublist_num;
+	struct scq_sublist *sublist = NULL;
+	uint64_t queued = 0;
+
+	SCQ_STAT_ADD(tls_data, scan_lane_num, 1);
+
+	for (int i = 0; i < sublist_num; i++) {
+		sublist = &tls_data_enq_thread->sublist_arr[
+			(tls_data->sublist_cursor + i) % sublist_num];
+
+		if (sublist->shared_sentinel.next == NULL) {
+			continue;
+		}
+
+		dequeued_node_list->local_head
+			= atomic_exchange(&sublist->shared_sentinel.next, NULL);
+
+		if (dequeued_node_list->local_head == NULL) {
+			SCQ_STAT_ADD(tls_data, detach_fail_cnt, 1);
+			continue;
+		}
+
+		SCQ_STAT_ADD(tls_data, detach_success_cnt, 1);
+
+		if (tls_data->transfer_row != NULL) {
+			scq_transfer_add(&tls_data->transfer_row[thread_idx].batch_cnt, 1);
+		}
+
+		/* The estimate reads two shared counters, skip it when unobserved */
+		if (SCQ_PROBE_ENABLED(detach) || tls_data->recorder != NULL) {
+			queued = scq_lane_queued(tls_data_enq_thread);
+			SCQ_PROBE3(detach, scq->scq_id, thread_idx, queued);
+			scq_record(tls_data, SCQ_EVENT_DETACH, thread_idx, queued);
+		}
+
+		/* Not restamped until shared_tail is back on the sentinel */
+		atomic_store_explicit(&dequeued_node_list->batch_enqueue_ns,
+			atomic_load_explicit(&sublist->head_enqueue_ns,
+				memory_order_relaxed), memory_order_relaxed);
+
+		dequeued_node_list->local_tail
+			= atomic_exchange(&sublist->shared_tail, &sublist->shared_sentinel);
+
+		dequeued_node_list->local_initial_head
+			= dequeued_node_list->local_head;
+
+		tls_data->last_dequeued_thread_idx = thread_idx;
+
+		if (sublist_num > 1) {
+			tls_data->sublist_cursor
+				= (tls_data->sublist_cursor + i + 1) % sublist_num;
+		}
+
+		pop_from_dequeued_list(scq, tls_data, datum, thread_idx);
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Estimated number of nodes enqueued by the given thread and not yet returned
+ * by a dequeue thread. Nodes already detached but not yet popped are counted,
+ * so an empty shared list is reported as zero explicitly.
+ */
+static uint64_t scq_lane_backlog_estimate(struct scq_tls_data *tls_data)
+{
+	if (!scq_lane_has_nodes(tls_data)) {
+		return 0;
+	}
+
+	return scq_lane_queued(tls_data);
+}
+
+/*
+ * SCQ_FLAG_LANE_LEASE scan.
+ *
+ * The dequeue thread first visits only the shared lists it has leased, so
+ * other dequeue threads do not touch them. Only when all of them are empty it
+ * rebalances:
+ *
+ *  - a non-empty list nobody leases is taken first,
+ *  - a leased one only if its owner has not taken a batch for
+ *    SCQ_LEASE_IDLE_NS, or its backlog is over SCQ_LEASE_STEAL_BACKLOG,
+ *
+ * so a list moves away from a busy owner only when the owner falls behind,
+ * instead of bouncing between dequeue threads that keep stealing it back.
+ * Leases are handed over with a CAS, so two idle dequeue threads never end up
+ * leasing the same list.
+ */
+static bool scq_lease_stealable(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data_enq_thread, int owner, uint64_t now_ns)
+{
+	uint64_t active_ns = atomic_load_explicit(
+		&scq->tls_data_ptr_list[owner]->lease_active_ns, memory_order_relaxed);
+
+	return now_ns - active_ns > SCQ_LEASE_IDLE_NS ||
+		scq_lane_backlog_estimate(tls_data_enq_thread)
+			> SCQ_LEASE_STEAL_BACKLOG;
+}
+
+static bool scq_dequeue_leased(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	struct scq_tls_data *tls_data_enq_thread = NULL;
+	int thread_num = scq->thread_num;
+	int thread_idx = 0, owner = 0;
+	uint64_t now_ns = 0;
+
+	for (int i = 0; i < thread_num; i++) {
+		thread_idx = (tls_data->last_dequeued_thread_idx + i) % thread_num;
+		tls_data_enq_thread = scq->tls_data_ptr_list[thread_idx];
+
+		if (atomic_load_explicit(&tls_data_enq_thread->lease_owner,
+				memory_order_relaxed) != tls_data->thread_idx) {
+			continue;
+		}
+
+		if (scq_detach_lane(scq, tls_data, thread_idx, datum)) {
+			goto active;
+		}
+	}
+
+	/* Unleased lists in the first pass, other owners' in the second */
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < thread_num; i++) {
+			thread_idx = (tls_data->last_dequeued_thread_idx + i) % thread_num;
+			tls_data_enq_thread = scq->tls_data_ptr_list[thread_idx];
+
+			if (!scq_lane_has_nodes(tls_data_enq_thread)) {
+				continue;
+			}
+
+			owner = atomic_load_explicit(&tls_data_enq_thread->lease_owner,
+				memory_order_relaxed);
+
+			if (owner == tls_data->thread_idx ||
+					(pass == 0 && owner != -1) ||
+					(pass == 1 && owner == -1)) {
+				continue;
+			}
+
+			if (pass == 1) {
+				if (now_ns == 0) {
+					now_ns = scq_coarse_now_ns();
+				}
+
+				if (!scq_lease_stealable(scq, tls_data_enq_thread, owner,
+						now_ns)) {
+					continue;
+				}
+			}
+
+			if (!atomic_compare_exchange_strong(
+					&tls_data_enq_thread->lease_owner, &owner,
+					tls_data->thread_idx)) {
+				continue;
+			}
+
+			if (scq_detach_lane(scq, tls_data, thread_idx, datum)) {
+				goto active;
+			}
+		}
+	}
+
+	return false;
+
+active:
+	atomic_store_explicit(&tls_data->lease_active_ns, scq_coarse_now_ns(),
+		memory_order_relaxed);
+	return true;
+}
+
+/*
+ * xorshift64, only used to spread dequeue threads over the lanes.
+ */
+static uint64_t scq_next_rand(struct scq_tls_data *tls_data)
+{
+	uint64_t x = tls_data->rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	tls_data->rand_state = x;
+
+	return x;
+}
+
+/*
+ * SCQ_FLAG_SCAN_P2C scan.
+ *
+ * Two random lanes are sampled and the one with the larger estimated backlog
+ * is tried first. If that fails, the rest of the lanes are scanned from a
+ * random start index instead of the last dequeued one, so dequeue threads
+ * coming out of an empty period do not all converge on the same lane.
+ */
+static bool scq_dequeue_p2c(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	int thread_num = scq->thread_num;
+	int first_idx = 0, second_idx = 0, start_idx = 0, thread_idx = 0;
+	uint64_t rand = 0;
+
+	if (thread_num == 0) {
+		return false;
+	}
+
+	rand = scq_next_rand(tls_data);
+	first_idx = (int)((rand & 0xFFFFFFFF) % thread_num);
+	second_idx = (int)((rand >> 32) % thread_num);
+
+	if (scq_lane_backlog_estimate(scq->tls_data_ptr_list[second_idx]) >
+			scq_lane_backlog_estimate(scq->tls_data_ptr_list[first_idx])) {
+		first_idx = second_idx;
+	}
+
+	if (scq_detach_lane(scq, tls_data, first_idx, datum)) {
+		return true;
+	}
+
+	start_idx = (int)(scq_next_rand(tls_data) % thread_num);
+
+	for (int i = 0; i < thread_num; i++) {
+		thread_idx = (start_idx + i) % thread_num;
+
+		if (thread_idx == first_idx) {
+			continue;
+		}
+
+		if (scq_detach_lane(scq, tls_data, thread_idx, datum)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Dequeue from this thread's dequeued list, or detach a new batch from the
+ * enqueue threads' shared lists with the scan policy of the queue.
+ */
+static bool scq_dequeue_nodes(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	int thread_idx = 0;
+
+	if (pop_from_dequeued_list(scq, tls_data, datum,
+			tls_data->last_dequeued_thread_idx)) {
+		return true;
+	}
+
+	if (scq->flags & SCQ_FLAG_LANE_LEASE) {
+		return scq_dequeue_leased(scq, tls_data, datum);
+	}
+
+	if (scq->flags & SCQ_FLAG_SCAN_P2C) {
+		return scq_dequeue_p2c(scq, tls_data, datum);
+	}
+
+	for (int i = 0; i < scq->thread_num; i++ ) {
+		thread_idx = (tls_data->last_dequeued_thread_idx + i) % scq->thread_num;
+
+		if (scq_detach_lane(scq, tls_data, thread_idx, datum)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Claim a datum handed over to another dequeue thread, e.g. one that has
+ * stopped polling since it advertised its slot.
+ */
+static bool scq_handoff_claim_other(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	struct scq_handoff_slot *slot = NULL;
+
+	for (int i = 0; i < scq->thread_num; i++) {
+		if (i == tls_data->thread_idx) {
+			continue;
+		}
+
+		slot = &scq->tls_data_ptr_list[i]->handoff_slot;
+
+		if (scq_handoff_claim(scq, slot, datum)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * SCQ_FLAG_HANDOFF dequeue.
+ *
+ * A datum already handed over is taken first, unless a batch detached before
+ * it still holds older data of the same lane. If nothing is found, neither in
+ * the lanes nor in other dequeue threads' slots, this thread advertises its
+ * slot so that the next scq_enqueue() can give its datum directly, skipping
+ * the node allocation and the scan. If something is found while advertised,
+ * the advertisement is withdrawn. When the withdrawal loses against an enqueue
+ * thread, the slot is filled soon and taken by a later call, or by another
+ * dequeue thread if this one stops polling.
+ */
+static bool scq_dequeue_handoff(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data, uint64_t *datum)
+{
+	struct scq_handoff_slot *slot = &tls_data->handoff_slot;
+	uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+	int waiter = tls_data->thread_idx + 1;
+
+	if (tls_data->dequeued_node_list.local_head == NULL &&
+			scq_handoff_claim(scq, slot, datum)) {
+		return true;
+	}
+
+	if (scq_dequeue_nodes(scq, tls_data, datum) ||
+			scq_handoff_claim_other(scq, tls_data, datum)) {
+		if ((state & SCQ_HANDOFF_KIND_MASK) == SCQ_HANDOFF_WAITING &&
+				atomic_compare_exchange_strong(&scq->handoff_waiter,
+					&waiter, 0)) {
+			atomic_store_explicit(&slot->state, state & ~SCQ_HANDOFF_KIND_MASK,
+				memory_order_relaxed);
+		}
+		return true;
+	}
+
+	/* Only this thread moves its slot out of EMPTY, so that still holds */
+	if ((state & SCQ_HANDOFF_KIND_MASK) == SCQ_HANDOFF_EMPTY) {
+		int no_waiter = 0;
+
+		atomic_store(&slot->state, state | SCQ_HANDOFF_WAITING);
+
+		if (!atomic_compare_exchange_strong(&scq->handoff_waiter,
+				&no_waiter, waiter)) {
+			atomic_store_explicit(&slot->state, state, memory_order_relaxed);
+		}
+	}
+
+	return false;
+}
+
+/*
+ * MATRIX engine dequeue. On its first call the dequeue thread claims a column,
+ * after that it only reads that column of every enqueue thread's row.
+ */
+static bool scq_matrix_dequeue(struct scalable_queue *scq, uint64_t *datum)
 {
 	struct scq_tls_data *tls_data = NULL;
-	struct scq_node *node = NULL;
-	struct scq_node *prev_tail = NULL;
+	struct scq_spsc_ring **row = NULL;
+	int thread_num = 0, thread_idx = 0;
 
 	check_and_init_scq_tls_data(scq);
 	tls_data = tls_data_ptr_arr[scq->scq_id];
 
-	node = scq_allocate_node(tls_data);
+	if (tls_data->matrix_column < 0) {
+		if (tls_data->matrix_column == SCQ_MATRIX_COLUMN_EXHAUSTED) {
+			return false;
+		}
 
-	node->datum = datum;
-	node->next = NULL;
-	__sync_synchronize();
+		tls_data->matrix_column = atomic_fetch_add(&scq->matrix_column_cnt, 1);
 
-	prev_tail = atomic_exchange(&tls_data->shared_tail, node);
-	assert(prev_tail != NULL);
+		if (tls_data->matrix_column >= scq->consumer_num) {
+			fprintf(stderr,
+				"scq_dequeue: more dequeue threads than consumer_num\n");
+			tls_data->matrix_column = SCQ_MATRIX_COLUMN_EXHAUSTED;
+			return false;
+		}
+	}
 
-	prev_tail->next = node;
+	thread_num = scq->thread_num;
+
+	for (int i = 0; i < thread_num; i++) {
+		thread_idx = (tls_data->last_dequeued_thread_idx + i) % thread_num;
+		row = atomic_load_explicit(
+			&scq->tls_data_ptr_list[thread_idx]->matrix_row,
+			memory_order_acquire);
+
+		if (row != NULL &&
+				scq_spsc_ring_dequeue(row[tls_data->matrix_column], datum)) {
+			tls_data->last_dequeued_thread_idx = thread_idx;
+			return true;
+		}
+	}
+
+	return false;
 }
 
 /*
- * Return the given nodes into enqueue thread's free node list.
+ * scq_dequeue() of the specialized engines.
+ *
+ * The only dequeue thread of the MPSC engine reads the enqueue threads' rings
+ * directly, starting from the one it took data from last time. It never
+ * registers itself, since it owns no ring.
  */
-static void scq_free_nodes(struct scalable_queue *scq,
-	struct scq_node *initial_head_node, struct scq_node *tail_node,
-	int enqueue_thread_idx)
+static bool scq_engine_dequeue(struct scalable_queue *scq, uint64_t *datum)
 {
-	struct scq_tls_data *tls_data = scq->tls_data_ptr_list[enqueue_thread_idx];
-	struct scq_free_node_list *free_node_list = &tls_data->free_node_list;
-	struct scq_node *prev_tail = NULL;
-
-	tail_node->next = NULL;
-	__sync_synchronize();
+	struct scq_spsc_ring *ring = NULL;
+	int thread_num = 0, thread_idx = 0;
+
+	switch (scq->engine) {
+	case SCQ_ENGINE_SPSC:
+		return scq_spsc_ring_dequeue(scq->spsc_ring, datum);
+	case SCQ_ENGINE_BOUNDED:
+		return scq_bounded_ring_dequeue(scq->bounded_ring, datum);
+	case SCQ_ENGINE_MATRIX:
+		return scq_matrix_dequeue(scq, datum);
+	case SCQ_ENGINE_MPSC:
+		thread_num = scq->thread_num;
+
+		for (int i = 0; i < thread_num; i++) {
+			thread_idx = (scq->mpsc_cursor + i) % thread_num;
+			ring = scq->tls_data_ptr_list[thread_idx]->spsc_ring;
+
+			if (ring != NULL && scq_spsc_ring_dequeue(ring, datum)) {
+				scq->mpsc_cursor = thread_idx;
+				return true;
+			}
+		}
 
-	prev_tail = atomic_exchange(&free_node_list->shared_tail, tail_node);
-	assert(prev_tail != NULL);
+		return false;
+	default:
+		assert(false);
+	}
 
-	prev_tail->next = initial_head_node;
+	return false;
 }
 
 /*
- * Dequeue node from thread local linked list.
- * If the list is empty, return false.
+ * Dequeue the datum from the scalable_queue.
+ * Return true if there is dequeued node.
  */
-static bool pop_from_dequeued_list(struct scalable_queue *scq,
-	struct scq_dequeued_node_list *dequeued_node_list,
-	uint64_t *datum, int enqueue_thread_idx)
+bool scq_dequeue(struct scalable_queue *scq, uint64_t *datum)
 {
-	struct scq_node *node = NULL;
+	struct scq_tls_data *tls_data = NULL;
+	bool found = false;
 
-	if (dequeued_node_list->local_head == NULL) {
-		return false;
+	if (scq->engine != SCQ_ENGINE_RELAXED) {
+		return scq_engine_dequeue(scq, datum);
 	}
 
-	node = dequeued_node_list->local_head;
-	*datum = node->datum;
+	check_and_init_scq_tls_data(scq);
 
-	if (node == dequeued_node_list->local_tail) {
-		scq_free_nodes(scq, dequeued_node_list->local_initial_head,
-			dequeued_node_list->local_tail, enqueue_thread_idx);
+	tls_data = tls_data_ptr_arr[scq->scq_id];
+	SCQ_STAT_SET(tls_data, scan_lane_num, 0);
 
-		dequeued_node_list->local_head = NULL;
-		dequeued_node_list->local_tail = NULL;
-		dequeued_node_list->local_initial_head = NULL;
+	if (scq->flags & SCQ_FLAG_HANDOFF) {
+		found = scq_dequeue_handoff(scq, tls_data, datum);
 	} else {
-		while (node->next == NULL) {
-			__asm__ __volatile__("pause");
+		found = scq_dequeue_nodes(scq, tls_data, datum);
+	}
+
+	if (found) {
+		SCQ_STAT_ADD(tls_data, dequeue_cnt, 1);
+	} else {
+		SCQ_STAT_ADD(tls_data, dequeue_miss_cnt, 1);
+		SCQ_STAT_ADD(tls_data, miss_scan_lane_cnt,
+			SCQ_STAT_GET(tls_data, scan_lane_num));
+	}
+
+	return found;
+}
+
+/*
+ * Number of data in one enqueue thread's lane of a specialized engine.
+ */
+static uint64_t scq_engine_lane_size(struct scalable_queue *scq,
+	struct scq_tls_data *tls_data)
+{
+	struct scq_spsc_ring **row = NULL;
+	uint64_t size = 0;
+
+	if (scq->engine == SCQ_ENGINE_MPSC && tls_data->spsc_ring != NULL) {
+		return scq_spsc_ring_size(tls_data->spsc_ring);
+	}
+
+	if (scq->engine == SCQ_ENGINE_MATRIX) {
+		row = atomic_load_explicit(&tls_data->matrix_row,
+			memory_order_acquire);
+
+		for (int i = 0; row != NULL && i < scq->consumer_num; i++) {
+			size += scq_spsc_ring_size(row[i]);
 		}
+	}
 
-		dequeued_node_list->local_head = node->next;
+	return size;
+}
+
+/*
+ * Approximate number of data in the queue. The per-lane counters are summed
+ * here, nothing is added to scq_enqueue()/scq_dequeue() for it.
+ */
+uint64_t scq_size_approx(struct scalable_queue *scq)
+{
+	int thread_num = scq->thread_num;
+	uint64_t size = 0;
+
+	switch (scq->engine) {
+	case SCQ_ENGINE_SPSC:
+		return scq_spsc_ring_size(scq->spsc_ring);
+	case SCQ_ENGINE_BOUNDED:
+		return scq_bounded_ring_size(scq->bounded_ring);
+	case SCQ_ENGINE_RELAXED:
+		return scq_queued_estimate(scq);
+	default:
+		for (int i = 0; i < thread_num; i++) {
+			size += scq_engine_lane_size(scq, scq->tls_data_ptr_list[i]);
+		}
+		return size;
 	}
+}
 
-	return true;
+/*
+ * Number of lanes, i.e. threads that have used the queue. Lane indexes are
+ * given in the order the threads first touched the queue.
+ */
+int scq_lane_num(struct scalable_queue *scq)
+{
+	return scq->thread_num;
 }
 
 /*
- * Dequeue the datum from the scalable_queue.
- * Return true if there is dequeued node.
+ * Approximate number of data enqueued by the given lane and not dequeued yet.
+ * In the relaxed engine, a batch detached from the lane is counted until the
+ * dequeue thread has popped all of it. The SPSC and BOUNDED engines have no
+ * lanes and report their whole size as lane 0.
  */
-bool scq_dequeue(struct scalable_queue *scq, uint64_t *datum)
+uint64_t scq_lane_backlog(struct scalable_queue *scq, int lane)
 {
-	struct scq_dequeued_node_list *dequeued_node_list = NULL;
-	struct scq_tls_data *tls_data = NULL, *tls_data_enq_thread = NULL;
-	int thread_idx = 0;
+	if (scq->engine == SCQ_ENGINE_SPSC || scq->engine == SCQ_ENGINE_BOUNDED) {
+		return (lane == 0) ? scq_size_approx(scq) : 0;
+	}
 
-	check_and_init_scq_tls_data(scq);
+	if (lane < 0 || lane >= scq->thread_num) {
+		return 0;
+	}
 
-	tls_data = tls_data_ptr_arr[scq->scq_id];
-	dequeued_node_list = &tls_data->dequeued_node_list;
+	if (scq->engine != SCQ_ENGINE_RELAXED) {
+		return scq_engine_lane_size(scq, scq->tls_data_ptr_list[lane]);
+	}
 
-	if (pop_from_dequeued_list(scq, dequeued_node_list, datum,
-			tls_data->last_dequeued_thread_idx)) {
-		return true;
+	return scq_lane_queued(scq->tls_data_ptr_list[lane]);
+}
+
+/*
+ * How long the oldest datum has been in the queue, in nanoseconds, with the
+ * resolution of the coarse clock. 0 if the queue is empty. Only the relaxed
+ * engine keeps the stamps, the others always report 0.
+ *
+ * The oldest datum is either at the head of some sublist, or in a batch that a
+ * dequeue thread has detached but not finished yet.
+ */
+uint64_t scq_oldest_age_ns(struct scalable_queue *scq)
+{
+	int thread_num = scq->thread_num;
+	struct scq_tls_data *tls_data = NULL;
+	uint64_t oldest_ns = UINT64_MAX, stamp_ns = 0, now_ns = 0;
+
+	if (scq->engine != SCQ_ENGINE_RELAXED) {
+		return 0;
 	}
 
-	for (int i = 0; i < scq->thread_num; i++ ) {
-		thread_idx = (tls_data->last_dequeued_thread_idx + i) % scq->thread_num;
-		tls_data_enq_thread = scq->tls_data_ptr_list[thread_idx];
+	for (int i = 0; i < thread_num; i++) {
+		tls_data = scq->tls_data_ptr_list[i];
+
+		stamp_ns = atomic_load_explicit(
+			&tls_data->dequeued_node_list.batch_enqueue_ns,
+			memory_order_relaxed);
+		if (stamp_ns != 0 && stamp_ns < oldest_ns) {
+			oldest_ns = stamp_ns;
+		}
+
+		for (int j = 0; j < tls_data->sublist_num; j++) {
+			if (tls_data->sublist_arr[j].shared_sentinel.next == NULL) {
+				continue;
+			}
+
+			stamp_ns = atomic_load_explicit(
+				&tls_data->sublist_arr[j].head_enqueue_ns,
+				memory_order_relaxed);
+			if (stamp_ns != 0 && stamp_ns < oldest_ns) {
+				oldest_ns = stamp_ns;
+			}
+		}
+	}
+
+	if (oldest_ns == UINT64_MAX) {
+		return 0;
+	}
+
+	now_ns = scq_coarse_now_ns();
+
+	return (now_ns > oldest_ns) ? now_ns - oldest_ns : 0;
+}
+
+/*
+ * Sum every thread's counters into @stats. Returns false, with @stats zeroed,
+ * if the library was built with SCQ_NO_STATS. Only the default engine keeps
+ * statistics.
+ */
+bool scq_get_stats(struct scalable_queue *scq, struct scq_stats *stats)
+{
+#ifndef SCQ_NO_STATS
+	int thread_num = scq->thread_num;
+	struct scq_tls_data *tls_data = NULL;
+#endif /* SCQ_NO_STATS */
+
+	memset(stats, 0, sizeof(struct scq_stats));
+
+#ifndef SCQ_NO_STATS
+	for (int i = 0; i < thread_num; i++) {
+		tls_data = scq->tls_data_ptr_list[i];
+
+		stats->enqueue_cnt += SCQ_STAT_GET(tls_data, enqueue_cnt);
+		stats->dequeue_cnt += SCQ_STAT_GET(tls_data, dequeue_cnt);
+		stats->dequeue_miss_cnt += SCQ_STAT_GET(tls_data, dequeue_miss_cnt);
+		stats->detach_success_cnt += SCQ_STAT_GET(tls_data, detach_success_cnt);
+		stats->detach_fail_cnt += SCQ_STAT_GET(tls_data, detach_fail_cnt);
+		stats->miss_scan_lane_cnt += SCQ_STAT_GET(tls_data, miss_scan_lane_cnt);
+		stats->malloc_fallback_cnt
+			+= SCQ_STAT_GET(tls_data, malloc_fallback_cnt);
+		stats->free_list_recycle_cnt
+			+= SCQ_STAT_GET(tls_data, free_list_recycle_cnt);
+		stats->spin_cnt += SCQ_STAT_GET(tls_data, spin_cnt);
+	}
+
+	return true;
+#else
+	(void)scq;
+	return false;
+#endif /* SCQ_NO_STATS */
+}
 
-		if (tls_data_enq_thread->shared_sentinel.next == NULL) {
+/*
+ * Merge every thread's latency histogram into @hist, and measure the TSC rate
+ * against CLOCK_MONOTONIC since the queue was created. Returns false if
+ * latency sampling is off.
+ */
+bool scq_get_latency_hist(struct scalable_queue *scq,
+	struct scq_latency_hist *hist)
+{
+	int thread_num = scq->thread_num;
+	struct scq_thread_latency *latency = NULL;
+	uint64_t cnt = 0, now_ns = 0, now_tsc = 0;
+
+	memset(hist, 0, sizeof(struct scq_latency_hist));
+
+	if (scq->latency_sample_rate == 0) {
+		return false;
+	}
+
+	for (int i = 0; i < thread_num; i++) {
+		latency = scq->tls_data_ptr_list[i]->latency;
+
+		if (latency == NULL) {
 			continue;
 		}
 
-		dequeued_node_list->local_head
-			= atomic_exchange(&tls_data_enq_thread->shared_sentinel.next, NULL);
+		for (int j = 0; j < SCQ_LATENCY_BUCKET_NUM; j++) {
+			cnt = atomic_load_explicit(&latency->bucket_cnt[j],
+				memory_order_relaxed);
+			hist->bucket_cnt[j] += cnt;
+			hist->sample_cnt += cnt;
+		}
+	}
 
-		if (dequeued_node_list->local_head == NULL) {
+	/* A queue queried right after creation waits a little for the rate */
+	do {
+		now_ns = scq_now_ns();
+		now_tsc = scq_rdtsc();
+	} while (now_ns - scq->calib_ns < SCQ_TSC_CALIBRATION_NS);
+
+	hist->tsc_per_ns = (double)(now_tsc - scq->calib_tsc)
+		/ (double)(now_ns - scq->calib_ns);
+
+	return true;
+}
+
+/*
+ * Latency in nanoseconds below which the given fraction (0.0 - 1.0) of the
+ * samples fall, rounded up to the end of its bucket. Returns 0 for an empty
+ * histogram.
+ */
+uint64_t scq_latency_percentile_ns(const struct scq_latency_hist *hist,
+	double percentile)
+{
+	uint64_t rank = 0, seen = 0;
+
+	if (hist->sample_cnt == 0 || hist->tsc_per_ns <= 0.0) {
+		return 0;
+	}
+
+	if (percentile < 0.0) {
+		percentile = 0.0;
+	} else if (percentile > 1.0) {
+		percentile = 1.0;
+	}
+
+	rank = (uint64_t)(percentile * (double)hist->sample_cnt);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (int i = 0; i < SCQ_LATENCY_BUCKET_NUM; i++) {
+		seen += hist->bucket_cnt[i];
+
+		if (seen >= rank) {
+			return (uint64_t)((double)scq_latency_bucket_max(i)
+				/ hist->tsc_per_ns);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the transfer matrix into @matrix, laid out as
+ * matrix[dequeue thread lane * lane_max + enqueue thread lane], for the first
+ * lane_max lanes. Returns the number of lanes, which may exceed lane_max, or -1
+ * without SCQ_FLAG_TRANSFER_MATRIX.
+ */
+int scq_get_transfer_matrix(struct scalable_queue *scq,
+	struct scq_transfer_cell *matrix, int lane_max)
+{
+	int thread_num = scq->thread_num;
+	int lane_num = (thread_num < lane_max) ? thread_num : lane_max;
+	struct scq_transfer_counter *row = NULL;
+	struct scq_transfer_cell *cell = NULL;
+
+	if (!(scq->flags & SCQ_FLAG_TRANSFER_MATRIX)) {
+		return -1;
+	}
+
+	for (int i = 0; i < lane_num; i++) {
+		row = scq->tls_data_ptr_list[i]->transfer_row;
+
+		for (int j = 0; j < lane_num; j++) {
+			cell = &matrix[i * lane_max + j];
+			cell->batch_cnt = 0;
+			cell->item_cnt = 0;
+
+			if (row == NULL) {
+				continue;
+			}
+
+			cell->batch_cnt = atomic_load_explicit(&row[j].batch_cnt,
+				memory_order_relaxed);
+			cell->item_cnt = atomic_load_explicit(&row[j].item_cnt,
+				memory_order_relaxed);
+		}
+	}
+
+	return thread_num;
+}
+
+/*
+ * NUMA node of the given lane: where its arena is bound with
+ * SCQ_FLAG_NUMA_ARENA, otherwise where the thread was running when it first
+ * used the queue. Returns -1 if unknown.
+ */
+int scq_lane_numa_node(struct scalable_queue *scq, int lane)
+{
+	struct scq_tls_data *tls_data = NULL;
+
+	if (lane < 0 || lane >= scq->thread_num) {
+		return -1;
+	}
+
+	tls_data = scq->tls_data_ptr_list[lane];
+
+	if (tls_data->arena.numa_node != -1) {
+		return tls_data->arena.numa_node;
+	}
+
+	return tls_data->numa_node;
+}
+
+/*
+ * Buffer of scq_dump_recorder(). Only write(2) is used to emit it, so that the
+ * dump is safe in a signal handler.
+ */
+struct scq_dump_buf {
+	char data[256];
+	size_t len;
+	int fd;
+};
+
+static void scq_dump_flush(struct scq_dump_buf *buf)
+{
+	size_t off = 0;
+	ssize_t ret;
+
+	while (off < buf->len) {
+		ret = write(buf->fd, buf->data + off, buf->len - off);
+		if (ret <= 0) {
+			break;
+		}
+		off += (size_t)ret;
+	}
+
+	buf->len = 0;
+}
+
+static void scq_dump_str(struct scq_dump_buf *buf, const char *str)
+{
+	while (*str != '\0') {
+		if (buf->len == sizeof(buf->data)) {
+			scq_dump_flush(buf);
+		}
+		buf->data[buf->len++] = *str++;
+	}
+}
+
+static void scq_dump_u64(struct scq_dump_buf *buf, uint64_t value)
+{
+	char digits[21];
+	int pos = sizeof(digits) - 1;
+
+	digits[pos] = '\0';
+	do {
+		digits[--pos] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	scq_dump_str(buf, &digits[pos]);
+}
+
+/*
+ * Write every thread's recent events to @fd, oldest first, as text. Only
+ * write(2) is called, so it may be used from a signal handler. Does nothing
+ * without SCQ_FLAG_FLIGHT_RECORDER.
+ */
+void scq_dump_recorder(struct scalable_queue *scq, int fd)
+{
+	static const char *event_names[] = {
+		"enqueue", "detach", "free_return", "spin_enter", "spin_exit"
+	};
+	struct scq_dump_buf buf = { .len = 0, .fd = fd };
+	struct scq_recorder *recorder = NULL;
+	struct scq_recorder_event *event = NULL;
+	int thread_num = scq->thread_num;
+	uint64_t pos, start;
+
+	if (scq->recorder_event_num == 0) {
+		return;
+	}
+
+	for (int i = 0; i < thread_num; i++) {
+		recorder = scq->tls_data_ptr_list[i]->recorder;
+		if (recorder == NULL) {
 			continue;
 		}
 
-		dequeued_node_list->local_tail
-			= atomic_exchange(&tls_data_enq_thread->shared_tail,
-				&tls_data_enq_thread->shared_sentinel);
+		pos = atomic_load_explicit(&recorder->pos, memory_order_acquire);
+		start = (pos > recorder->mask + 1) ? pos - recorder->mask - 1 : 0;
+
+		scq_dump_str(&buf, "scq ");
+		scq_dump_u64(&buf, (uint64_t)scq->scq_id);
+		scq_dump_str(&buf, " thread ");
+		scq_dump_u64(&buf, (uint64_t)i);
+		scq_dump_str(&buf, " events ");
+		scq_dump_u64(&buf, pos);
+		scq_dump_str(&buf, "\n");
+
+		for (uint64_t j = start; j < pos; j++) {
+			event = &recorder->events[j & recorder->mask];
+
+			scq_dump_str(&buf, "  tsc ");
+			scq_dump_u64(&buf, event->tsc);
+			scq_dump_str(&buf, " ");
+			scq_dump_str(&buf, (event->type <= SCQ_EVENT_SPIN_EXIT) ?
+				event_names[event->type] : "unknown");
+			scq_dump_str(&buf, " lane ");
+			scq_dump_u64(&buf, (uint64_t)event->lane);
+			scq_dump_str(&buf, " arg ");
+			scq_dump_u64(&buf, event->arg);
+			scq_dump_str(&buf, "\n");
+		}
+	}
 
-		dequeued_node_list->local_initial_head = dequeued_node_list->local_head;
+	scq_dump_flush(&buf);
+}
 
-		tls_data->last_dequeued_thread_idx = thread_idx;
+/*
+ * Dump every queue with a flight recorder, then die of the same signal.
+ */
+static void scq_recorder_signal_handler(int sig)
+{
+	struct scalable_queue *scq = NULL;
+
+	for (int i = 0; i < MAX_SCQ_NUM; i++) {
+		scq = atomic_load(&recorder_scq_arr[i]);
+		if (scq != NULL) {
+			scq_dump_recorder(scq, recorder_signal_fd);
+		}
+	}
 
-		pop_from_dequeued_list(scq, dequeued_node_list, datum, thread_idx);
+	raise(sig);
+}
 
-		return true;
+/*
+ * Dump the flight recorders of all queues to @fd when the process receives
+ * SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT. The previous handlers are
+ * replaced. Returns false if a handler could not be installed.
+ */
+bool scq_install_recorder_signal_handler(int fd)
+{
+	static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = scq_recorder_signal_handler;
+	sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+
+	recorder_signal_fd = fd;
+
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+		if (sigaction(signals[i], &sa, NULL) != 0) {
+			fprintf(stderr, "scq_install_recorder_signal_handler: "
+				"sigaction failed\n");
+			return false;
+		}
 	}
 
-	return false;
+	return true;
 }
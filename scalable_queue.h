@@ -12,14 +12,274 @@ typedef struct scalable_queue scalable_queue;
 
 typedef struct scalable_queue scq;
 
+/*
+ * Each producer lane carves its nodes out of its own memory chunks. The chunks
+ * are bound to the NUMA node the producer was running on when it first
+ * enqueued, and are backed by huge pages when the system allows it.
+ */
+#define SCQ_FLAG_NUMA_ARENA (0x1U)
+
+/*
+ * Dequeue threads lease disjoint sets of producer lanes and only look at other
+ * lanes once all of their own lanes are empty. They then lease a free lane, or
+ * take over the lease of a lane whose owner is idle or falling behind.
+ */
+#define SCQ_FLAG_LANE_LEASE (0x2U)
+
+/*
+ * Dequeue threads pick the busier of two randomly sampled lanes and fall back
+ * to a scan from a random start, instead of all scanning in the same order.
+ */
+#define SCQ_FLAG_SCAN_P2C (0x4U)
+
+/*
+ * A dequeue thread that finds the queue empty advertises a slot, and the next
+ * scq_enqueue() hands its datum over directly without allocating a node. If
+ * the dequeue thread does not come back for it, other dequeue threads do.
+ */
+#define SCQ_FLAG_HANDOFF (0x8U)
+
+/*
+ * Each dequeue thread counts the batches and data it takes from every enqueue
+ * thread, see scq_get_transfer_matrix().
+ */
+#define SCQ_FLAG_TRANSFER_MATRIX (0x100U)
+
+/*
+ * Each thread records its recent queue events (enqueue, detach, free-return,
+ * spin enter/exit) with TSC stamps in its own ring, see scq_dump_recorder().
+ */
+#define SCQ_FLAG_FLIGHT_RECORDER (0x200U)
+
+/*
+ * Engine flags. At most one of them may be given. They select another engine
+ * behind the same scq_enqueue()/scq_dequeue():
+ *
+ * SCQ_FLAG_SPSC: one enqueue thread and one dequeue thread. A wait-free ring.
+ * SCQ_FLAG_MPSC: any enqueue threads and one dequeue thread. Each enqueue
+ * thread owns a ring, which the dequeue thread reads without any exchange.
+ * SCQ_FLAG_BOUNDED_RING: any threads. A fixed-capacity array ring that never
+ * allocates after scq_init_ex(). scq_try_enqueue() fails when it is full, and
+ * scq_enqueue() waits for room.
+ * SCQ_FLAG_SPSC_MATRIX: any enqueue threads and consumer_num dequeue threads.
+ * Each enqueue thread owns one SPSC ring per dequeue thread and picks one
+ * round-robin, or by key with scq_enqueue_key(). Each dequeue thread only reads
+ * its own ring of every enqueue thread, so the steady state uses no
+ * read-modify-write atomic at all.
+ *
+ * SPSC, MPSC and SPSC_MATRIX are promises about the threads, breaking them
+ * corrupts the queue. The other SCQ_FLAG_* options and sublist_num only apply to the
+ * default engine and are ignored by these.
+ */
+#define SCQ_FLAG_SPSC (0x10U)
+#define SCQ_FLAG_MPSC (0x20U)
+#define SCQ_FLAG_BOUNDED_RING (0x40U)
+#define SCQ_FLAG_SPSC_MATRIX (0x80U)
+
+/*
+ * Overflow policies of a capacity-bounded queue.
+ *
+ * SCQ_OVERFLOW_FAIL: scq_try_enqueue() fails, scq_enqueue() waits for room.
+ * SCQ_OVERFLOW_BLOCK: scq_try_enqueue() waits up to block_timeout_ns before
+ * failing, scq_enqueue() waits for room.
+ * SCQ_OVERFLOW_DROP_NEWEST: the new datum is dropped.
+ * SCQ_OVERFLOW_DROP_OLDEST: an old datum is dequeued and dropped to make room.
+ */
+#define SCQ_OVERFLOW_FAIL (0)
+#define SCQ_OVERFLOW_BLOCK (1)
+#define SCQ_OVERFLOW_DROP_NEWEST (2)
+#define SCQ_OVERFLOW_DROP_OLDEST (3)
+
+/*
+ * scq_init_context - scq_init_ex's argument
+ * @flags: bitwise OR of SCQ_FLAG_* values, 0 for the default queue
+ * @sublist_num: number of shared lists each enqueue thread stripes its data
+ * over (up to 64). 0 or 1 keeps a single list per enqueue thread.
+ * @capacity: number of slots of SCQ_FLAG_BOUNDED_RING, rounded up to a power
+ * of two. 0 selects the default (65536). For the default engine, approximate
+ * limit on queued data enforced with @overflow_policy. 0 means unbounded.
+ * @consumer_num: number of dequeue threads of SCQ_FLAG_SPSC_MATRIX
+ * @overflow_policy: SCQ_OVERFLOW_* applied when @capacity is reached
+ * @block_timeout_ns: how long scq_try_enqueue() waits for room under
+ * SCQ_OVERFLOW_BLOCK. 0 waits without limit.
+ * @drop_func: called with each datum discarded by SCQ_OVERFLOW_DROP_OLDEST,
+ * with each datum scq_enqueue() drops under SCQ_OVERFLOW_DROP_NEWEST, and with
+ * each datum of SCQ_FLAG_HANDOFF still in a slot at scq_destroy(). May be NULL.
+ * @drop_arg: second argument of @drop_func
+ * @latency_sample_rate: default engine only. If not 0, every this many'th
+ * enqueue of each thread is stamped with the TSC, and dequeue threads record
+ * its time in the queue, see scq_get_latency_hist(). Nodes then grow from 16
+ * to 24 bytes to carry the stamp. 0 disables sampling.
+ * @stats_shm_name: default engine only. If not NULL, e.g. "/myqueue", the
+ * per-thread statistics and latency histograms are kept in a segment created
+ * with shm_open() under this name, which scqstat can attach to. The segment
+ * is unlinked by scq_destroy(). scq_init_ex() fails if the name is taken,
+ * unless by the segment of a process that has exited.
+ * @recorder_event_num: events kept per thread by SCQ_FLAG_FLIGHT_RECORDER,
+ * rounded up to a power of two. 0 selects the default (256).
+ *
+ * The capacity of the default engine is checked with per-lane counters. Each
+ * enqueue thread gets a share of the remaining room as thread-local credit and
+ * only looks at the counters once it is used up, so enqueues below the limit
+ * pay nothing for it. The limit is approximate: it may be exceeded by a few
+ * data per enqueue thread.
+ *
+ * With sublist_num > 1, a single hot enqueue thread can feed several dequeue
+ * threads at once, since each of them detaches a different sublist. The order
+ * of data is preserved within each sublist only.
+ */
+typedef struct scq_init_context {
+	uint32_t flags;
+	uint32_t sublist_num;
+	uint64_t capacity;
+	uint32_t consumer_num;
+	int overflow_policy;
+	uint64_t block_timeout_ns;
+	void (*drop_func)(uint64_t datum, void *drop_arg);
+	void *drop_arg;
+	uint32_t latency_sample_rate;
+	const char *stats_shm_name;
+	uint32_t recorder_event_num;
+} scq_init_context;
+
 struct scalable_queue *scq_init(void);
 
+struct scalable_queue *scq_init_ex(struct scq_init_context *ctx);
+
 void scq_destroy(struct scalable_queue *scq);
 
-void scq_enqueue(struct scalable_queue *scq, uint64_t datum);
+/*
+ * scq_enqueue() and scq_enqueue_key() return false if the datum was dropped
+ * under SCQ_OVERFLOW_DROP_NEWEST, or if no memory could be allocated for it.
+ */
+bool scq_enqueue(struct scalable_queue *scq, uint64_t datum);
+
+bool scq_try_enqueue(struct scalable_queue *scq, uint64_t datum);
+
+bool scq_enqueue_key(struct scalable_queue *scq, uint64_t key, uint64_t datum);
 
 bool scq_dequeue(struct scalable_queue *scq, uint64_t *datum);
 
+/*
+ * Monitoring queries. They only sum counters kept by each thread, so they can
+ * be called at any time from any thread, and the results are approximate.
+ */
+uint64_t scq_size_approx(struct scalable_queue *scq);
+
+int scq_lane_num(struct scalable_queue *scq);
+
+uint64_t scq_lane_backlog(struct scalable_queue *scq, int lane);
+
+uint64_t scq_oldest_age_ns(struct scalable_queue *scq);
+
+/*
+ * scq_stats - Operation statistics of the default engine
+ * @enqueue_cnt: data enqueued
+ * @dequeue_cnt: scq_dequeue() calls that found a datum
+ * @dequeue_miss_cnt: scq_dequeue() calls that found nothing
+ * @detach_success_cnt: batches detached from enqueue threads' lists
+ * @detach_fail_cnt: detaches lost to another dequeue thread
+ * @miss_scan_lane_cnt: lanes visited by the missed scq_dequeue() calls,
+ * divide by dequeue_miss_cnt for lanes scanned per miss
+ * @malloc_fallback_cnt: nodes allocated because the free list was empty
+ * @free_list_recycle_cnt: nodes reused from the free list
+ * @spin_cnt: pause iterations waiting for a node's next pointer
+ *
+ * The counters are kept per thread without atomic read-modify-write and
+ * summed by scq_get_stats(), so the result is a slightly stale snapshot.
+ */
+typedef struct scq_stats {
+	uint64_t enqueue_cnt;
+	uint64_t dequeue_cnt;
+	uint64_t dequeue_miss_cnt;
+	uint64_t detach_success_cnt;
+	uint64_t detach_fail_cnt;
+	uint64_t miss_scan_lane_cnt;
+	uint64_t malloc_fallback_cnt;
+	uint64_t free_list_recycle_cnt;
+	uint64_t spin_cnt;
+} scq_stats;
+
+/*
+ * Returns false if the library was built without statistics (SCQ_NO_STATS).
+ */
+bool scq_get_stats(struct scalable_queue *scq, struct scq_stats *stats);
+
+/*
+ * scq_transfer_cell - What one dequeue thread took from one enqueue thread
+ * @batch_cnt: batches detached from the enqueue thread's lane
+ * @item_cnt: data of the batches used up so far
+ *
+ * item_cnt / batch_cnt is the average batch length of the pair.
+ */
+typedef struct scq_transfer_cell {
+	uint64_t batch_cnt;
+	uint64_t item_cnt;
+} scq_transfer_cell;
+
+/*
+ * Copy the transfer matrix of a queue created with SCQ_FLAG_TRANSFER_MATRIX.
+ * matrix[consumer * lane_max + producer] is filled for lanes below lane_max,
+ * lanes being numbered as in scq_lane_backlog(). Returns the number of lanes,
+ * call again with a larger matrix if it exceeds lane_max. Returns -1 if the
+ * flag was not given.
+ */
+int scq_get_transfer_matrix(struct scalable_queue *scq,
+	struct scq_transfer_cell *matrix, int lane_max);
+
+/*
+ * NUMA node of the lane, to tell cross-node transfers apart, or -1 if unknown.
+ */
+int scq_lane_numa_node(struct scalable_queue *scq, int lane);
+
+/*
+ * Write the flight recorder of every thread to the file descriptor as text,
+ * oldest event first. Async-signal-safe. Does nothing without
+ * SCQ_FLAG_FLIGHT_RECORDER.
+ */
+void scq_dump_recorder(struct scalable_queue *scq, int fd);
+
+/*
+ * Dump the flight recorders of all queues to the file descriptor on SIGSEGV,
+ * SIGBUS, SIGILL, SIGFPE or SIGABRT, then let the signal kill the process.
+ * Returns false on failure.
+ */
+bool scq_install_recorder_signal_handler(int fd);
+
+/*
+ * Latency histogram buckets. Values below SCQ_LATENCY_SUB_BUCKET_NUM TSC cycles
+ * have a bucket each, and every power of two above is split into
+ * SCQ_LATENCY_SUB_BUCKET_NUM equal buckets.
+ */
+#define SCQ_LATENCY_SUB_BUCKET_NUM (8)
+#define SCQ_LATENCY_BUCKET_NUM (62 * SCQ_LATENCY_SUB_BUCKET_NUM)
+
+/*
+ * scq_latency_hist - Merged enqueue-to-dequeue latency histogram
+ * @sample_cnt: number of sampled data dequeued so far
+ * @tsc_per_ns: measured TSC rate, to convert bucket values
+ * @bucket_cnt: samples per log-linear bucket of TSC cycles
+ */
+typedef struct scq_latency_hist {
+	uint64_t sample_cnt;
+	double tsc_per_ns;
+	uint64_t bucket_cnt[SCQ_LATENCY_BUCKET_NUM];
+} scq_latency_hist;
+
+/*
+ * Merge the per-thread histograms of a queue created with latency_sample_rate.
+ * Returns false if sampling is off.
+ */
+bool scq_get_latency_hist(struct scalable_queue *scq,
+	struct scq_latency_hist *hist);
+
+/*
+ * Latency in nanoseconds that the given fraction (0.0 - 1.0) of the samples do
+ * not exceed, e.g. 0.99 for p99. Returns 0 if there is no sample.
+ */
+uint64_t scq_latency_percentile_ns(const struct scq_latency_hist *hist,
+	double percentile);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "scq_bounded_ring.h"
+
+#define SCQ_BOUNDED_CACHE_LINE_SIZE (64)
+
+/*
+ * scq_bounded_cell - Slot of the ring
+ * @sequence: position this slot is waiting for
+ * @datum: 8 bytes scalar or pointer
+ *
+ * A slot whose sequence equals the enqueue position is free for that position.
+ * After it is written, the sequence becomes position + 1, which is what the
+ * dequeue of the same position waits for. The dequeue then moves the sequence
+ * one lap ahead, to position + capacity.
+ */
+struct scq_bounded_cell {
+	_Atomic uint64_t sequence;
+	uint64_t datum;
+};
+
+/*
+ * scq_bounded_ring - main data structure of the ring
+ * @cell_arr: capacity slots
+ * @mask: capacity - 1
+ * @enqueue_pos: next position to enqueue, claimed with a CAS
+ * @dequeue_pos: next position to dequeue, claimed with a CAS
+ *
+ * The two positions are on separate cache lines so that enqueue threads and
+ * dequeue threads do not invalidate each other.
+ */
+struct scq_bounded_ring {
+	struct scq_bounded_cell *cell_arr;
+	uint64_t mask;
+	_Atomic uint64_t enqueue_pos
+		__attribute__((aligned(SCQ_BOUNDED_CACHE_LINE_SIZE)));
+	_Atomic uint64_t dequeue_pos
+		__attribute__((aligned(SCQ_BOUNDED_CACHE_LINE_SIZE)));
+};
+
+/*
+ * Returns pointer to an scq_bounded_ring, or NULL on failure.
+ */
+struct scq_bounded_ring *scq_bounded_ring_init(uint64_t capacity)
+{
+	struct scq_bounded_ring *ring = NULL;
+	uint64_t cell_num = 2;
+	size_t cell_size = 0;
+
+	/* No power of two above 2^63, the rounding below would never end */
+	if (capacity > (1ULL << 63)) {
+		fprintf(stderr, "scq_bounded_ring_init: capacity too large\n");
+		return NULL;
+	}
+
+	while (cell_num < capacity) {
+		cell_num <<= 1;
+	}
+
+	if (cell_num > (SIZE_MAX - SCQ_BOUNDED_CACHE_LINE_SIZE)
+			/ sizeof(struct scq_bounded_cell)) {
+		fprintf(stderr, "scq_bounded_ring_init: capacity too large\n");
+		return NULL;
+	}
+
+	/* aligned_alloc() wants a multiple of the alignment, small rings are not */
+	cell_size = (sizeof(struct scq_bounded_cell) * cell_num
+		+ SCQ_BOUNDED_CACHE_LINE_SIZE - 1) & ~(size_t)(SCQ_BOUNDED_CACHE_LINE_SIZE - 1);
+
+	ring = aligned_alloc(SCQ_BOUNDED_CACHE_LINE_SIZE,
+		sizeof(struct scq_bounded_ring));
+	if (ring == NULL) {
+		fprintf(stderr, "scq_bounded_ring_init: ring allocation failed\n");
+		return NULL;
+	}
+
+	ring->cell_arr = aligned_alloc(SCQ_BOUNDED_CACHE_LINE_SIZE, cell_size);
+	if (ring->cell_arr == NULL) {
+		fprintf(stderr, "scq_bounded_ring_init: cell allocation failed\n");
+		free(ring);
+		return NULL;
+	}
+
+	for (uint64_t i = 0; i < cell_num; i++) {
+		atomic_store_explicit(&ring->cell_arr[i].sequence, i,
+			memory_order_relaxed);
+	}
+
+	ring->mask = cell_num - 1;
+	atomic_store(&ring->enqueue_pos, 0);
+	atomic_store(&ring->dequeue_pos, 0);
+
+	return ring;
+}
+
+/*
+ * Destroy the scq_bounded_ring.
+ */
+void scq_bounded_ring_destroy(struct scq_bounded_ring *ring)
+{
+	if (ring == NULL) {
+		return;
+	}
+
+	free(ring->cell_arr);
+	free(ring);
+}
+
+/*
+ * Claim the enqueue position whose slot is free, then publish the datum
+ * through the slot's sequence.
+ */
+bool scq_bounded_ring_enqueue(struct scq_bounded_ring *ring, uint64_t datum)
+{
+	struct scq_bounded_cell *cell = NULL;
+	uint64_t pos = atomic_load_explicit(&ring->enqueue_pos,
+		memory_order_relaxed);
+	uint64_t sequence = 0;
+	int64_t diff = 0;
+
+	for (;;) {
+		cell = &ring->cell_arr[pos & ring->mask];
+		sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (int64_t)sequence - (int64_t)pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos,
+					&pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* The slot still holds the datum of the previous lap */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&ring->enqueue_pos,
+				memory_order_relaxed);
+		}
+	}
+
+	cell->datum = datum;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return true;
+}
+
+/*
+ * Claim the dequeue position whose slot is written, then hand the slot over to
+ * the enqueue of the next lap.
+ */
+bool scq_bounded_ring_dequeue(struct scq_bounded_ring *ring, uint64_t *datum)
+{
+	struct scq_bounded_cell *cell = NULL;
+	uint64_t pos = atomic_load_explicit(&ring->dequeue_pos,
+		memory_order_relaxed);
+	uint64_t sequence = 0;
+	int64_t diff = 0;
+
+	for (;;) {
+		cell = &ring->cell_arr[pos & ring->mask];
+		sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (int64_t)sequence - (int64_t)(pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos,
+					&pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Nothing has been written for this position yet */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&ring->dequeue_pos,
+				memory_order_relaxed);
+		}
+	}
+
+	*datum = cell->datum;
+	atomic_store_explicit(&cell->sequence, pos + ring->mask + 1,
+		memory_order_release);
+
+	return true;
+}
+
+/*
+ * Claimed but not yet published positions are counted as well.
+ */
+uint64_t scq_bounded_ring_size(struct scq_bounded_ring *ring)
+{
+	uint64_t dequeue_pos = atomic_load_explicit(&ring->dequeue_pos,
+		memory_order_relaxed);
+	uint64_t enqueue_pos = atomic_load_explicit(&ring->enqueue_pos,
+		memory_order_relaxed);
+
+	return (enqueue_pos > dequeue_pos) ? enqueue_pos - dequeue_pos : 0;
+}
@@ -0,0 +1,48 @@
+#ifndef SCQ_BOUNDED_RING_H
+#define SCQ_BOUNDED_RING_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fixed-capacity multi-producer, multi-consumer array ring with a sequence
+ * number per slot (Dmitry Vyukov's bounded MPMC queue). All memory is
+ * allocated by scq_bounded_ring_init(), nothing is allocated afterwards.
+ */
+typedef struct scq_bounded_ring scq_bounded_ring;
+
+/*
+ * Returns pointer to an scq_bounded_ring, or NULL on failure. The capacity is
+ * rounded up to a power of two, and at least 2. Capacities above 2^63, or too
+ * large to allocate, fail.
+ */
+struct scq_bounded_ring *scq_bounded_ring_init(uint64_t capacity);
+
+/*
+ * Destroy the scq_bounded_ring. Data still in the ring is discarded.
+ */
+void scq_bounded_ring_destroy(struct scq_bounded_ring *ring);
+
+/*
+ * Returns false if the ring is full.
+ */
+bool scq_bounded_ring_enqueue(struct scq_bounded_ring *ring, uint64_t datum);
+
+/*
+ * Returns false if the ring is empty.
+ */
+bool scq_bounded_ring_dequeue(struct scq_bounded_ring *ring, uint64_t *datum);
+
+/*
+ * Number of data in the ring, as a snapshot.
+ */
+uint64_t scq_bounded_ring_size(struct scq_bounded_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* SCQ_BOUNDED_RING_H */
@@ -0,0 +1,112 @@
+#ifndef SCQ_SHM_H
+#define SCQ_SHM_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "scalable_queue.h"
+
+/*
+ * Layout of the statistics segment a queue publishes under /dev/shm when it is
+ * created with scq_init_context's stats_shm_name. It is shared by
+ * scalable_queue.c, which writes it, and scqstat, which maps it read-only.
+ *
+ * The segment is a header followed by SCQ_SHM_LANE_MAX lane slots, one per
+ * thread in the order threads first used the queue. Pages of unused slots are
+ * never touched, so they take no memory.
+ */
+#define SCQ_SHM_MAGIC (0x3154415453514353ULL) /* "SCQSTAT1" */
+#define SCQ_SHM_VERSION (1)
+#define SCQ_SHM_LANE_MAX (1024)
+
+#define SCQ_SHM_CACHE_LINE_SIZE (64)
+
+/*
+ * scq_thread_stats - Per-thread counters behind struct scq_stats
+ *
+ * See scalable_queue.h for the meaning of each counter. scan_lane_num is not
+ * exported, it counts the lanes visited by the scq_dequeue() in progress.
+ * Only the owning thread writes them, scq_get_stats() and scqstat read them.
+ */
+struct scq_thread_stats {
+	_Atomic uint64_t enqueue_cnt;
+	_Atomic uint64_t dequeue_cnt;
+	_Atomic uint64_t dequeue_miss_cnt;
+	_Atomic uint64_t detach_success_cnt;
+	_Atomic uint64_t detach_fail_cnt;
+	_Atomic uint64_t miss_scan_lane_cnt;
+	_Atomic uint64_t malloc_fallback_cnt;
+	_Atomic uint64_t free_list_recycle_cnt;
+	_Atomic uint64_t spin_cnt;
+	_Atomic uint64_t scan_lane_num;
+} __attribute__((aligned(SCQ_SHM_CACHE_LINE_SIZE)));
+
+/*
+ * scq_thread_latency - Per-thread enqueue-to-dequeue latency histogram
+ * @bucket_cnt: samples per bucket, in TSC cycles
+ *
+ * Only the owning dequeue thread writes it.
+ */
+struct scq_thread_latency {
+	_Atomic uint64_t bucket_cnt[SCQ_LATENCY_BUCKET_NUM];
+} __attribute__((aligned(SCQ_SHM_CACHE_LINE_SIZE)));
+
+/*
+ * scq_shm_header - First cache line of the segment
+ * @magic: SCQ_SHM_MAGIC, written last when the segment is ready
+ * @version: SCQ_SHM_VERSION
+ * @lane_max: number of lane slots following the header
+ * @lane_num: number of lane slots in use
+ * @pid: process that owns the queue
+ * @latency_sample_rate: the queue's latency_sample_rate, 0 if not sampling
+ * @calib_tsc: TSC when the queue was created
+ * @calib_ns: CLOCK_MONOTONIC time when the queue was created
+ *
+ * The TSC rate is measured by the reader against calib_tsc and calib_ns.
+ */
+struct scq_shm_header {
+	_Atomic uint64_t magic;
+	uint32_t version;
+	uint32_t lane_max;
+	_Atomic uint32_t lane_num;
+	int32_t pid;
+	uint64_t latency_sample_rate;
+	uint64_t calib_tsc;
+	uint64_t calib_ns;
+} __attribute__((aligned(SCQ_SHM_CACHE_LINE_SIZE)));
+
+/*
+ * scq_shm_lane - Slot of one thread
+ * @stats: operation counters, written by this thread only
+ * @returned_cnt: nodes of this lane returned by dequeue threads, added once
+ * per batch like the lane's own counter
+ * @latency: latency histogram this thread fills as a dequeue thread
+ *
+ * The lane's backlog is stats.enqueue_cnt - returned_cnt, read in that order
+ * reversed so that it never underflows.
+ */
+struct scq_shm_lane {
+	struct scq_thread_stats stats;
+	_Atomic uint64_t returned_cnt
+		__attribute__((aligned(SCQ_SHM_CACHE_LINE_SIZE)));
+	struct scq_thread_latency latency;
+};
+
+#define SCQ_SHM_SIZE \
+	(sizeof(struct scq_shm_header) + \
+	 sizeof(struct scq_shm_lane) * SCQ_SHM_LANE_MAX)
+
+static inline struct scq_shm_lane *scq_shm_lane_slot(
+	struct scq_shm_header *header, int lane)
+{
+	return (struct scq_shm_lane *)(header + 1) + lane;
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* SCQ_SHM_H */
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "scq_spsc_ring.h"
+
+#define SCQ_SPSC_SLOT_NUM (1024)
+#define SCQ_SPSC_CACHE_LINE_SIZE (64)
+
+/*
+ * scq_spsc_segment - Fixed-size part of the ring
+ * @next: next segment, set by the producer before it publishes any datum of it
+ * @slots: data
+ */
+struct scq_spsc_segment {
+	struct scq_spsc_segment *next;
+	uint64_t slots[SCQ_SPSC_SLOT_NUM];
+};
+
+/*
+ * scq_spsc_ring - main data structure of the ring
+ * @tail_segment: segment the producer is writing
+ * @tail_pos: producer's private copy of enqueue_pos
+ * @enqueue_pos: number of data ever enqueued, published by the producer
+ * @head_segment: segment the consumer is reading
+ * @head_pos: consumer's private copy of dequeue_pos
+ * @cached_enqueue_pos: last enqueue_pos seen by the consumer
+ * @dequeue_pos: number of data ever dequeued, published by the consumer
+ * @spare_segment: one consumed segment kept for the producer to reuse
+ *
+ * Positions only grow, so a datum's slot is (pos % SCQ_SPSC_SLOT_NUM) of the
+ * (pos / SCQ_SPSC_SLOT_NUM)'th segment. Each side keeps its fields on its own
+ * cache line and reads the other side's position only when it has run out of
+ * what it saw last time.
+ *
+ * The consumer gives a drained segment back through spare_segment only when
+ * the slot is empty, and only the producer empties it. So the slot is handed
+ * over with plain loads and stores.
+ */
+struct scq_spsc_ring {
+	struct scq_spsc_segment *tail_segment;
+	uint64_t tail_pos;
+	_Atomic uint64_t enqueue_pos;
+
+	struct scq_spsc_segment *head_segment
+		__attribute__((aligned(SCQ_SPSC_CACHE_LINE_SIZE)));
+	uint64_t head_pos;
+	uint64_t cached_enqueue_pos;
+	_Atomic uint64_t dequeue_pos;
+
+	_Atomic(struct scq_spsc_segment *) spare_segment
+		__attribute__((aligned(SCQ_SPSC_CACHE_LINE_SIZE)));
+};
+
+/*
+ * Returns pointer to an scq_spsc_ring, or NULL on failure.
+ */
+struct scq_spsc_ring *scq_spsc_ring_init(void)
+{
+	struct scq_spsc_ring *ring = aligned_alloc(SCQ_SPSC_CACHE_LINE_SIZE,
+		sizeof(struct scq_spsc_ring));
+	struct scq_spsc_segment *segment = NULL;
+
+	if (ring == NULL) {
+		fprintf(stderr, "scq_spsc_ring_init: ring allocation failed\n");
+		return NULL;
+	}
+
+	segment = malloc(sizeof(struct scq_spsc_segment));
+	if (segment == NULL) {
+		fprintf(stderr, "scq_spsc_ring_init: segment allocation failed\n");
+		free(ring);
+		return NULL;
+	}
+
+	segment->next = NULL;
+
+	ring->tail_segment = segment;
+	ring->tail_pos = 0;
+	atomic_store(&ring->enqueue_pos, 0);
+
+	ring->head_segment = segment;
+	ring->head_pos = 0;
+	ring->cached_enqueue_pos = 0;
+	atomic_store(&ring->dequeue_pos, 0);
+
+	atomic_store(&ring->spare_segment, NULL);
+
+	return ring;
+}
+
+/*
+ * Destroy the scq_spsc_ring.
+ */
+void scq_spsc_ring_destroy(struct scq_spsc_ring *ring)
+{
+	struct scq_spsc_segment *segment, *next_segment;
+
+	if (ring == NULL) {
+		return;
+	}
+
+	segment = ring->head_segment;
+	while (segment != NULL) {
+		next_segment = segment->next;
+		free(segment);
+		segment = next_segment;
+	}
+
+	free(atomic_load(&ring->spare_segment));
+
+	free(ring);
+}
+
+/*
+ * Producer's function. A new segment is linked before the first datum of it is
+ * published, so the consumer always finds the next pointer set.
+ */
+bool scq_spsc_ring_enqueue(struct scq_spsc_ring *ring, uint64_t datum)
+{
+	struct scq_spsc_segment *segment = NULL;
+	uint64_t pos = ring->tail_pos;
+	size_t slot_idx = pos % SCQ_SPSC_SLOT_NUM;
+
+	if (slot_idx == 0 && pos != 0) {
+		segment = atomic_load_explicit(&ring->spare_segment,
+			memory_order_acquire);
+
+		if (segment != NULL) {
+			atomic_store_explicit(&ring->spare_segment, NULL,
+				memory_order_relaxed);
+		} else {
+			segment = malloc(sizeof(struct scq_spsc_segment));
+			if (segment == NULL) {
+				return false;
+			}
+		}
+
+		segment->next = NULL;
+		ring->tail_segment->next = segment;
+		ring->tail_segment = segment;
+	}
+
+	ring->tail_segment->slots[slot_idx] = datum;
+	ring->tail_pos = pos + 1;
+
+	atomic_store_explicit(&ring->enqueue_pos, pos + 1, memory_order_release);
+
+	return true;
+}
+
+/*
+ * Consumer's function. A drained segment is offered to the producer, or freed
+ * if the producer has not taken the previous one yet.
+ */
+bool scq_spsc_ring_dequeue(struct scq_spsc_ring *ring, uint64_t *datum)
+{
+	struct scq_spsc_segment *segment = NULL;
+	uint64_t pos = ring->head_pos;
+	size_t slot_idx = pos % SCQ_SPSC_SLOT_NUM;
+
+	if (pos == ring->cached_enqueue_pos) {
+		ring->cached_enqueue_pos = atomic_load_explicit(&ring->enqueue_pos,
+			memory_order_acquire);
+
+		if (pos == ring->cached_enqueue_pos) {
+			return false;
+		}
+	}
+
+	if (slot_idx == 0 && pos != 0) {
+		segment = ring->head_segment;
+		ring->head_segment = segment->next;
+
+		if (atomic_load_explicit(&ring->spare_segment,
+				memory_order_relaxed) == NULL) {
+			atomic_store_explicit(&ring->spare_segment, segment,
+				memory_order_release);
+		} else {
+			free(segment);
+		}
+	}
+
+	*datum = ring->head_segment->slots[slot_idx];
+	ring->head_pos = pos + 1;
+
+	atomic_store_explicit(&ring->dequeue_pos, pos + 1, memory_order_relaxed);
+
+	return true;
+}
+
+/*
+ * dequeue_pos is read first, so the difference never underflows.
+ */
+uint64_t scq_spsc_ring_size(struct scq_spsc_ring *ring)
+{
+	uint64_t dequeue_pos = atomic_load_explicit(&ring->dequeue_pos,
+		memory_order_relaxed);
+	uint64_t enqueue_pos = atomic_load_explicit(&ring->enqueue_pos,
+		memory_order_acquire);
+
+	return enqueue_pos - dequeue_pos;
+}
@@ -0,0 +1,49 @@
+#ifndef SCQ_SPSC_RING_H
+#define SCQ_SPSC_RING_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Unbounded single-producer, single-consumer ring used by the specialized
+ * engines of scalable_queue.c. It is made of fixed-size segments linked in
+ * order. Both sides only use plain loads and stores, no read-modify-write
+ * atomic instruction is needed.
+ */
+typedef struct scq_spsc_ring scq_spsc_ring;
+
+/*
+ * Returns pointer to an scq_spsc_ring, or NULL on failure.
+ */
+struct scq_spsc_ring *scq_spsc_ring_init(void);
+
+/*
+ * Destroy the scq_spsc_ring. Data still in the ring is discarded.
+ */
+void scq_spsc_ring_destroy(struct scq_spsc_ring *ring);
+
+/*
+ * Producer's function. Returns false only if a new segment was needed and
+ * could not be allocated.
+ */
+bool scq_spsc_ring_enqueue(struct scq_spsc_ring *ring, uint64_t datum);
+
+/*
+ * Consumer's function. Returns false if the ring is empty.
+ */
+bool scq_spsc_ring_dequeue(struct scq_spsc_ring *ring, uint64_t *datum);
+
+/*
+ * Number of data in the ring. May be called from any thread, the result is
+ * only a snapshot.
+ */
+uint64_t scq_spsc_ring_size(struct scq_spsc_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* SCQ_SPSC_RING_H */
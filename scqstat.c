@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "scalable_queue.h"
+#include "scq_shm.h"
+
+/* Print the column header again after this many lines, like vmstat */
+#define SCQSTAT_HEADER_INTERVAL (20)
+
+/*
+ * scqstat_snapshot - Counters read from the segment at one point in time
+ * @lane_num: number of lanes in use
+ * @enqueue_cnt: per-lane enqueued data
+ * @dequeue_cnt: per-lane dequeued data, as a dequeue thread
+ * @returned_cnt: per-lane data returned by dequeue threads
+ * @miss_cnt: missed dequeues of all lanes
+ * @hist: latency histogram of all lanes, in TSC cycles
+ */
+struct scqstat_snapshot {
+	int lane_num;
+	uint64_t enqueue_cnt[SCQ_SHM_LANE_MAX];
+	uint64_t dequeue_cnt[SCQ_SHM_LANE_MAX];
+	uint64_t returned_cnt[SCQ_SHM_LANE_MAX];
+	uint64_t miss_cnt;
+	struct scq_latency_hist hist;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-l] name [interval [count]]\n"
+		"  name      stats_shm_name the queue was created with, e.g. /myqueue\n"
+		"  interval  seconds between reports (default 1)\n"
+		"  count     number of reports (default until the process exits)\n"
+		"  -l        also report each lane\n", prog);
+}
+
+static inline uint64_t scqstat_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t scqstat_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Map the segment read-only. Returns NULL if it does not exist or is not a
+ * segment of this version.
+ */
+static struct scq_shm_header *scqstat_attach(const char *name)
+{
+	struct scq_shm_header *header = NULL;
+	int fd = shm_open(name, O_RDONLY, 0);
+
+	if (fd == -1) {
+		fprintf(stderr, "scqstat: cannot open %s: %s\n", name,
+			strerror(errno));
+		return NULL;
+	}
+
+	header = mmap(NULL, SCQ_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (header == MAP_FAILED) {
+		fprintf(stderr, "scqstat: cannot map %s: %s\n", name,
+			strerror(errno));
+		return NULL;
+	}
+
+	if (atomic_load(&header->magic) != SCQ_SHM_MAGIC ||
+			header->version != SCQ_SHM_VERSION ||
+			header->lane_max != SCQ_SHM_LANE_MAX) {
+		fprintf(stderr, "scqstat: %s is not a scalable_queue segment\n", name);
+		munmap(header, SCQ_SHM_SIZE);
+		return NULL;
+	}
+
+	return header;
+}
+
+static void scqstat_read(struct scq_shm_header *header,
+	struct scqstat_snapshot *snap)
+{
+	struct scq_shm_lane *lane = NULL;
+
+	memset(snap, 0, sizeof(struct scqstat_snapshot));
+
+	snap->lane_num = (int)atomic_load_explicit(&header->lane_num,
+		memory_order_acquire);
+
+	for (int i = 0; i < snap->lane_num; i++) {
+		lane = scq_shm_lane_slot(header, i);
+
+		/* returned first, so that a lane's backlog never underflows */
+		snap->returned_cnt[i] = atomic_load_explicit(&lane->returned_cnt,
+			memory_order_relaxed);
+		snap->enqueue_cnt[i] = atomic_load_explicit(&lane->stats.enqueue_cnt,
+			memory_order_relaxed);
+		snap->dequeue_cnt[i] = atomic_load_explicit(&lane->stats.dequeue_cnt,
+			memory_order_relaxed);
+		snap->miss_cnt += atomic_load_explicit(&lane->stats.dequeue_miss_cnt,
+			memory_order_relaxed);
+
+		if (header->latency_sample_rate == 0) {
+			continue;
+		}
+
+		for (int j = 0; j < SCQ_LATENCY_BUCKET_NUM; j++) {
+			snap->hist.bucket_cnt[j] += atomic_load_explicit(
+				&lane->latency.bucket_cnt[j], memory_order_relaxed);
+		}
+	}
+}
+
+static uint64_t scqstat_backlog(struct scqstat_snapshot *snap, int lane)
+{
+	if (snap->enqueue_cnt[lane] < snap->returned_cnt[lane]) {
+		return 0;
+	}
+
+	return snap->enqueue_cnt[lane] - snap->returned_cnt[lane];
+}
+
+/*
+ * Latency percentiles of the samples dequeued between two snapshots.
+ */
+static void scqstat_interval_hist(struct scq_shm_header *header,
+	struct scqstat_snapshot *prev, struct scqstat_snapshot *cur,
+	struct scq_latency_hist *hist)
+{
+	uint64_t now_ns = scqstat_now_ns();
+	uint64_t now_tsc = scqstat_rdtsc();
+
+	memset(hist, 0, sizeof(struct scq_latency_hist));
+
+	for (int i = 0; i < SCQ_LATENCY_BUCKET_NUM; i++) {
+		hist->bucket_cnt[i]
+			= cur->hist.bucket_cnt[i] - prev->hist.bucket_cnt[i];
+		hist->sample_cnt += hist->bucket_cnt[i];
+	}
+
+	if (now_ns > header->calib_ns) {
+		hist->tsc_per_ns = (double)(now_tsc - header->calib_tsc)
+			/ (double)(now_ns - header->calib_ns);
+	}
+}
+
+static void scqstat_print_header(void)
+{
+	printf("%5s %12s %12s %12s %12s %10s %10s %10s\n", "lanes", "enq/s",
+		"deq/s", "miss/s", "backlog", "p50(ns)", "p99(ns)", "p999(ns)");
+}
+
+static void scqstat_print(struct scq_shm_header *header,
+	struct scqstat_snapshot *prev, struct scqstat_snapshot *cur,
+	double seconds, int show_lanes)
+{
+	struct scq_latency_hist hist;
+	uint64_t enqueue_cnt = 0, dequeue_cnt = 0, backlog = 0;
+
+	for (int i = 0; i < cur->lane_num; i++) {
+		/* Lanes registered during the interval start from zero */
+		enqueue_cnt += cur->enqueue_cnt[i] - prev->enqueue_cnt[i];
+		dequeue_cnt += cur->dequeue_cnt[i] - prev->dequeue_cnt[i];
+		backlog += scqstat_backlog(cur, i);
+	}
+
+	scqstat_interval_hist(header, prev, cur, &hist);
+
+	printf("%5d %12.0f %12.0f %12.0f %12" PRIu64 " %10" PRIu64 " %10" PRIu64
+		" %10" PRIu64 "\n",
+		cur->lane_num, enqueue_cnt / seconds, dequeue_cnt / seconds,
+		(cur->miss_cnt - prev->miss_cnt) / seconds, backlog,
+		scq_latency_percentile_ns(&hist, 0.5),
+		scq_latency_percentile_ns(&hist, 0.99),
+		scq_latency_percentile_ns(&hist, 0.999));
+
+	if (!show_lanes) {
+		return;
+	}
+
+	for (int i = 0; i < cur->lane_num; i++) {
+		printf("  lane %4d %12.0f %12.0f %25" PRIu64 "\n", i,
+			(cur->enqueue_cnt[i] - prev->enqueue_cnt[i]) / seconds,
+			(cur->dequeue_cnt[i] - prev->dequeue_cnt[i]) / seconds,
+			scqstat_backlog(cur, i));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct scqstat_snapshot *prev = NULL, *cur = NULL, *tmp = NULL;
+	struct scq_shm_header *header = NULL;
+	uint64_t prev_ns, cur_ns;
+	double interval = 1.0;
+	long count = -1;
+	int show_lanes = 0, opt, line = 0;
+	struct timespec delay;
+
+	while ((opt = getopt(argc, argv, "lh")) != -1) {
+		switch (opt) {
+		case 'l':
+			show_lanes = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (optind + 1 < argc) {
+		interval = atof(argv[optind + 1]);
+	}
+
+	if (optind + 2 < argc) {
+		count = atol(argv[optind + 2]);
+	}
+
+	if (interval <= 0.0) {
+		fprintf(stderr, "scqstat: invalid interval\n");
+		return 1;
+	}
+
+	header = scqstat_attach(argv[optind]);
+	if (header == NULL) {
+		return 1;
+	}
+
+	prev = malloc(sizeof(struct scqstat_snapshot));
+	cur = malloc(sizeof(struct scqstat_snapshot));
+	if (prev == NULL || cur == NULL) {
+		fprintf(stderr, "scqstat: snapshot allocation failed\n");
+		return 1;
+	}
+
+	delay.tv_sec = (time_t)interval;
+	delay.tv_nsec = (long)((interval - (double)delay.tv_sec) * 1e9);
+
+	scqstat_read(header, prev);
+	prev_ns = scqstat_now_ns();
+
+	while (count != 0) {
+		nanosleep(&delay, NULL);
+
+		/* The owner is gone, its segment only lingers if it crashed */
+		if (kill(header->pid, 0) != 0 && errno == ESRCH) {
+			fprintf(stderr, "scqstat: process %d exited\n", header->pid);
+			break;
+		}
+
+		scqstat_read(header, cur);
+		cur_ns = scqstat_now_ns();
+
+		if (line++ % SCQSTAT_HEADER_INTERVAL == 0 || show_lanes) {
+			scqstat_print_header();
+		}
+
+		scqstat_print(header, prev, cur, (double)(cur_ns - prev_ns) / 1e9,
+			show_lanes);
+		fflush(stdout);
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		prev_ns = cur_ns;
+
+		if (count > 0) {
+			count--;
+		}
+	}
+
+	free(prev);
+	free(cur);
+	munmap(header, SCQ_SHM_SIZE);
+
+	return 0;
+}
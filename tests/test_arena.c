@@ -0,0 +1,23 @@
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_NUMA_ARENA: nodes carved from per-node arenas instead of malloc.
+ * Arenas fall back to plain pages where hugepages or mbind are unavailable,
+ * so the cases pass on any machine.
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "numa-arena", .ctx = { .flags = SCQ_FLAG_NUMA_ARENA },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true },
+	{ .name = "numa-arena-drain-after",
+		.ctx = { .flags = SCQ_FLAG_NUMA_ARENA }, .producer_num = 4,
+		.consumer_num = 2, .item_num = 50000, .ordered = true,
+		.drain_after = true },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_BOUNDED_RING: a Vyukov-style MPMC ring of @capacity slots, where
+ * scq_enqueue() waits for room and scq_try_enqueue() fails instead.
+ */
+
+/*
+ * Rings too large to round up or to allocate fail at init.
+ */
+static bool test_bounded_ring_capacity(void)
+{
+	static const uint64_t capacities[] = {
+		(1ULL << 63) + 1, UINT64_MAX, 1ULL << 62
+	};
+	struct scq_init_context ctx;
+	struct scalable_queue *scq;
+	bool ok = true;
+
+	for (int i = 0; i < 3; i++) {
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.flags = SCQ_FLAG_BOUNDED_RING;
+		ctx.capacity = capacities[i];
+
+		scq = scq_init_ex(&ctx);
+		if (scq != NULL) {
+			fprintf(stderr, "  bounded_ring_capacity: %" PRIu64
+				" accepted\n", capacities[i]);
+			scq_destroy(scq);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "bounded-ring", .ctx = { .flags = SCQ_FLAG_BOUNDED_RING,
+		.capacity = 256 }, .producer_num = 4, .consumer_num = 4,
+		.item_num = 20000, .ordered = true },
+	{ .name = "bounded-ring-try", .ctx = { .flags = SCQ_FLAG_BOUNDED_RING,
+		.capacity = 256 }, .producer_num = 4, .consumer_num = 4,
+		.item_num = 20000, .use_try = true, .ordered = true },
+	{ .name = "bounded-ring-tiny", .ctx = { .flags = SCQ_FLAG_BOUNDED_RING,
+		.capacity = 2 }, .producer_num = 4, .consumer_num = 4,
+		.item_num = 5000, .ordered = true },
+	{ .name = "bounded-ring-default", .ctx = { .flags = SCQ_FLAG_BOUNDED_RING },
+		.producer_num = 4, .consumer_num = 2, .item_num = 16384,
+		.ordered = true, .drain_after = true },
+};
+
+int main(void)
+{
+	int failed = test_run_cases(test_cases, TEST_CASE_NUM(test_cases));
+
+	failed += test_report("bounded-ring-capacity",
+		test_bounded_ring_capacity());
+
+	return test_finish(failed);
+}
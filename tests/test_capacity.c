@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "test_harness.h"
+
+/*
+ * Queues bounded by @capacity, under each SCQ_OVERFLOW_* policy.
+ */
+
+#define TEST_ORDER_CAPACITY (100)
+#define TEST_ORDER_ITEM_NUM (250)
+
+/*
+ * test_drop_log - What drop_func was given, in the order it was given
+ */
+struct test_drop_log {
+	uint64_t datum_arr[TEST_ORDER_ITEM_NUM];
+	int datum_num;
+};
+
+static void test_drop_record(uint64_t datum, void *drop_arg)
+{
+	struct test_drop_log *log = drop_arg;
+
+	if (log->datum_num < TEST_ORDER_ITEM_NUM) {
+		log->datum_arr[log->datum_num] = datum;
+	}
+	log->datum_num++;
+}
+
+/*
+ * One thread alone overfills a SCQ_OVERFLOW_DROP_OLDEST queue. Its admission
+ * is exact, so drop_func must get the first data in the order they were
+ * enqueued, and the last @capacity must come out in order.
+ */
+static bool test_drop_oldest_order(void)
+{
+	struct scq_init_context ctx;
+	struct scalable_queue *scq;
+	struct test_drop_log log;
+	uint64_t drop_num = TEST_ORDER_ITEM_NUM - TEST_ORDER_CAPACITY;
+	uint64_t datum, next;
+	bool ok = true;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&log, 0, sizeof(log));
+	ctx.capacity = TEST_ORDER_CAPACITY;
+	ctx.overflow_policy = SCQ_OVERFLOW_DROP_OLDEST;
+	ctx.drop_func = test_drop_record;
+	ctx.drop_arg = &log;
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  drop_oldest_order: init failed\n");
+		return false;
+	}
+
+	for (uint64_t i = 0; i < TEST_ORDER_ITEM_NUM; i++) {
+		if (!scq_enqueue(scq, i)) {
+			fprintf(stderr, "  drop_oldest_order: enqueue %" PRIu64
+				" failed\n", i);
+			ok = false;
+		}
+	}
+
+	if ((uint64_t)log.datum_num != drop_num) {
+		fprintf(stderr, "  drop_oldest_order: %d dropped, expected %"
+			PRIu64 "\n", log.datum_num, drop_num);
+		ok = false;
+	}
+
+	for (int i = 0; i < log.datum_num && i < TEST_ORDER_ITEM_NUM; i++) {
+		if (log.datum_arr[i] != (uint64_t)i) {
+			fprintf(stderr, "  drop_oldest_order: drop %d was %" PRIu64
+				"\n", i, log.datum_arr[i]);
+			ok = false;
+			break;
+		}
+	}
+
+	next = drop_num;
+	while (scq_dequeue(scq, &datum)) {
+		if (datum != next) {
+			fprintf(stderr, "  drop_oldest_order: dequeued %" PRIu64
+				", expected %" PRIu64 "\n", datum, next);
+			ok = false;
+			break;
+		}
+		next++;
+	}
+
+	if (ok && next != TEST_ORDER_ITEM_NUM) {
+		fprintf(stderr, "  drop_oldest_order: %" PRIu64 " survivors, "
+			"expected %d\n", next - drop_num, TEST_ORDER_CAPACITY);
+		ok = false;
+	}
+
+	scq_destroy(scq);
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "capacity-fail", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_FAIL }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .use_try = true,
+		.ordered = true },
+	{ .name = "capacity-block", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_BLOCK }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .ordered = true },
+	{ .name = "capacity-block-timeout", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_BLOCK,
+		.block_timeout_ns = 1000000 }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .use_try = true,
+		.ordered = true },
+	{ .name = "capacity-drop-newest", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_DROP_NEWEST }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .ordered = true,
+		.may_drop = true },
+	{ .name = "capacity-drop-newest-try", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_DROP_NEWEST }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .use_try = true,
+		.ordered = true, .may_drop = true },
+	{ .name = "capacity-drop-oldest", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_DROP_OLDEST }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .may_drop = true },
+	{ .name = "capacity-drop-oldest-drain", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_DROP_OLDEST }, .producer_num = 1,
+		.consumer_num = 1, .item_num = 1001, .ordered = true,
+		.may_drop = true, .drain_after = true },
+	{ .name = "capacity-drop-oldest-drain-multi", .ctx = { .capacity = 1000,
+		.overflow_policy = SCQ_OVERFLOW_DROP_OLDEST }, .producer_num = 4,
+		.consumer_num = 2, .item_num = 5000, .may_drop = true,
+		.drain_after = true },
+};
+
+int main(void)
+{
+	int failed = test_run_cases(test_cases, TEST_CASE_NUM(test_cases));
+
+	failed += test_report("drop-oldest-order", test_drop_oldest_order());
+
+	return test_finish(failed);
+}
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_HANDOFF: a dequeue thread that misses advertises a slot and the next
+ * enqueue fills it instead of allocating a node.
+ */
+
+static void *test_handoff_poll_once(void *arg)
+{
+	uint64_t datum;
+
+	scq_dequeue(arg, &datum);
+
+	return NULL;
+}
+
+static void test_handoff_drop(uint64_t datum, void *drop_arg)
+{
+	*(uint64_t *)drop_arg = datum;
+}
+
+/*
+ * A dequeue thread misses once, which advertises its slot, and exits. The
+ * datum handed to it must be counted by the size queries and reach the other
+ * dequeue threads, or drop_func if the queue is destroyed first.
+ */
+static bool test_handoff_abandoned(bool destroy_first)
+{
+	const char *name = destroy_first ?
+		"handoff-abandoned-destroy" : "handoff-abandoned";
+	uint64_t datum = 0, dropped = 0, backlog = 0;
+	struct scq_init_context ctx = { .flags = SCQ_FLAG_HANDOFF,
+		.drop_func = test_handoff_drop, .drop_arg = &dropped };
+	struct scalable_queue *scq = scq_init_ex(&ctx);
+	pthread_t thread;
+	bool ok = true;
+
+	if (scq == NULL) {
+		fprintf(stderr, "  %s: init failed\n", name);
+		return false;
+	}
+
+	pthread_create(&thread, NULL, test_handoff_poll_once, scq);
+	pthread_join(thread, NULL);
+
+	scq_enqueue(scq, 42);
+
+	for (int i = 0; i < scq_lane_num(scq); i++) {
+		backlog += scq_lane_backlog(scq, i);
+	}
+
+	if (scq_size_approx(scq) != 1 || backlog != 1) {
+		fprintf(stderr, "  %s: size %" PRIu64 ", backlog %" PRIu64
+			" with one datum\n", name, scq_size_approx(scq), backlog);
+		ok = false;
+	}
+
+	if (destroy_first) {
+		scq_destroy(scq);
+
+		if (dropped != 42) {
+			fprintf(stderr, "  %s: datum not passed to drop_func\n", name);
+			ok = false;
+		}
+
+		return ok;
+	}
+
+	if (!scq_dequeue(scq, &datum) || datum != 42) {
+		fprintf(stderr, "  %s: datum stranded in the slot\n", name);
+		ok = false;
+	} else if (scq_size_approx(scq) != 0) {
+		fprintf(stderr, "  %s: size %" PRIu64 " after the dequeue\n", name,
+			scq_size_approx(scq));
+		ok = false;
+	}
+
+	scq_destroy(scq);
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "handoff", .ctx = { .flags = SCQ_FLAG_HANDOFF },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true },
+	{ .name = "handoff-1p1c", .ctx = { .flags = SCQ_FLAG_HANDOFF },
+		.producer_num = 1, .consumer_num = 1, .item_num = 100000,
+		.ordered = true },
+	{ .name = "handoff-many-consumers",
+		.ctx = { .flags = SCQ_FLAG_HANDOFF }, .producer_num = 2,
+		.consumer_num = 8, .item_num = 20000, .ordered = true },
+};
+
+int main(void)
+{
+	int failed = test_run_cases(test_cases, TEST_CASE_NUM(test_cases));
+
+	failed += test_report("handoff-abandoned", test_handoff_abandoned(false));
+	failed += test_report("handoff-abandoned-destroy",
+		test_handoff_abandoned(true));
+
+	return test_finish(failed);
+}
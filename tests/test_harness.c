@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_harness.h"
+
+/* Consumers give up once nothing has been taken for this long */
+#define TEST_STALL_NS (5000000000ULL)
+
+struct test_worker {
+	pthread_t thread;
+	struct test_run *run;
+	int idx;
+};
+
+static uint64_t test_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t test_total(const struct test_case *tc)
+{
+	return (uint64_t)tc->producer_num * tc->item_num;
+}
+
+/*
+ * Mark the datum as taken. Returns false if it is not one of ours.
+ */
+static bool test_mark(struct test_run *run, uint64_t datum)
+{
+	uint64_t producer = datum >> 32, seq = datum & 0xFFFFFFFFULL;
+
+	if (producer >= (uint64_t)run->tc->producer_num ||
+			seq >= run->tc->item_num) {
+		atomic_fetch_add(&run->corrupt_cnt, 1);
+		return false;
+	}
+
+	if (atomic_exchange(&run->seen[producer * run->tc->item_num + seq], 1)) {
+		atomic_fetch_add(&run->duplicate_cnt, 1);
+		return false;
+	}
+
+	atomic_fetch_add(&run->taken_cnt, 1);
+
+	return true;
+}
+
+static void test_drop(uint64_t datum, void *drop_arg)
+{
+	struct test_run *run = drop_arg;
+
+	if (test_mark(run, datum)) {
+		atomic_fetch_add(&run->dropped_cnt, 1);
+	}
+}
+
+static void *test_producer(void *arg)
+{
+	struct test_worker *worker = arg;
+	struct test_run *run = worker->run;
+	const struct test_case *tc = run->tc;
+	uint64_t datum;
+	bool ok;
+
+	for (uint64_t seq = 0; seq < tc->item_num; seq++) {
+		datum = ((uint64_t)worker->idx << 32) | seq;
+		ok = true;
+
+		if (tc->use_key) {
+			ok = scq_enqueue_key(run->scq, datum, datum);
+		} else if (!tc->use_try) {
+			ok = scq_enqueue(run->scq, datum);
+		} else {
+			while (!scq_try_enqueue(run->scq, datum)) {
+				/* A failed try under DROP_NEWEST is the drop */
+				if (tc->ctx.overflow_policy == SCQ_OVERFLOW_DROP_NEWEST) {
+					test_drop(datum, run);
+					break;
+				}
+				sched_yield();
+			}
+		}
+
+		/* Under DROP_NEWEST the datum went to drop_func */
+		if (!ok && tc->ctx.overflow_policy != SCQ_OVERFLOW_DROP_NEWEST) {
+			atomic_fetch_add(&run->enqueue_fail_cnt, 1);
+		}
+	}
+
+	return NULL;
+}
+
+static void *test_consumer(void *arg)
+{
+	struct test_worker *worker = arg;
+	struct test_run *run = worker->run;
+	const struct test_case *tc = run->tc;
+	int64_t last_seq[TEST_MAX_THREAD_NUM];
+	uint64_t total = test_total(tc), datum, producer, seq;
+	uint64_t last_taken = 0, stall_start = 0, taken;
+
+	for (int i = 0; i < TEST_MAX_THREAD_NUM; i++) {
+		last_seq[i] = -1;
+	}
+
+	while ((taken = atomic_load(&run->taken_cnt)) < total) {
+		if (!scq_dequeue(run->scq, &datum)) {
+			if (taken != last_taken || stall_start == 0) {
+				last_taken = taken;
+				stall_start = test_now_ns();
+			} else if (test_now_ns() - stall_start > TEST_STALL_NS) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+
+		if (!test_mark(run, datum)) {
+			continue;
+		}
+
+		atomic_fetch_add(&run->delivered_cnt, 1);
+
+		producer = datum >> 32;
+		seq = datum & 0xFFFFFFFFULL;
+
+		if (tc->ordered && (int64_t)seq <= last_seq[producer]) {
+			atomic_fetch_add(&run->disorder_cnt, 1);
+		}
+		last_seq[producer] = (int64_t)seq;
+	}
+
+	return NULL;
+}
+
+bool test_run_case(const struct test_case *tc)
+{
+	struct test_worker producers[TEST_MAX_THREAD_NUM];
+	struct test_worker consumers[TEST_MAX_THREAD_NUM];
+	struct scq_init_context ctx = tc->ctx;
+	struct test_run run;
+	uint64_t total = test_total(tc), missing = 0;
+	bool ok = true;
+
+	memset(&run, 0, sizeof(run));
+	run.tc = tc;
+	run.seen = calloc(total, sizeof(_Atomic uint8_t));
+
+	ctx.drop_func = test_drop;
+	ctx.drop_arg = &run;
+
+	run.scq = scq_init_ex(&ctx);
+	if (run.seen == NULL || run.scq == NULL) {
+		fprintf(stderr, "  %s: init failed\n", tc->name);
+		free(run.seen);
+		return false;
+	}
+
+	for (int i = 0; i < tc->consumer_num && !tc->drain_after; i++) {
+		consumers[i].run = &run;
+		consumers[i].idx = i;
+		pthread_create(&consumers[i].thread, NULL, test_consumer,
+			&consumers[i]);
+	}
+
+	for (int i = 0; i < tc->producer_num; i++) {
+		producers[i].run = &run;
+		producers[i].idx = i;
+		pthread_create(&producers[i].thread, NULL, test_producer,
+			&producers[i]);
+	}
+
+	for (int i = 0; i < tc->producer_num; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+
+	/*
+	 * Whatever the producers left must be reachable from other threads. The
+	 * limit is exact for a single enqueue thread only, others may have taken
+	 * credit before all of them were registered.
+	 */
+	if (tc->drain_after) {
+		TEST_CHECK(tc->producer_num > 1 || tc->ctx.capacity == 0 ||
+			scq_size_approx(run.scq) <= tc->ctx.capacity,
+			"size %" PRIu64 " over the capacity",
+			scq_size_approx(run.scq));
+
+		for (int i = 0; i < tc->consumer_num; i++) {
+			consumers[i].run = &run;
+			consumers[i].idx = i;
+			pthread_create(&consumers[i].thread, NULL, test_consumer,
+				&consumers[i]);
+		}
+	}
+
+	for (int i = 0; i < tc->consumer_num; i++) {
+		pthread_join(consumers[i].thread, NULL);
+	}
+
+	for (uint64_t i = 0; i < total; i++) {
+		missing += !atomic_load(&run.seen[i]);
+	}
+
+	TEST_CHECK(missing == 0, "%" PRIu64 " of %" PRIu64 " data never taken",
+		missing, total);
+	TEST_CHECK(run.enqueue_fail_cnt == 0, "%" PRIu64 " enqueues failed",
+		atomic_load(&run.enqueue_fail_cnt));
+	TEST_CHECK(run.duplicate_cnt == 0, "%" PRIu64 " data taken twice",
+		atomic_load(&run.duplicate_cnt));
+	TEST_CHECK(run.corrupt_cnt == 0, "%" PRIu64 " unknown data",
+		atomic_load(&run.corrupt_cnt));
+	TEST_CHECK(run.disorder_cnt == 0, "%" PRIu64 " data out of order",
+		atomic_load(&run.disorder_cnt));
+	TEST_CHECK(tc->may_drop || run.dropped_cnt == 0,
+		"%" PRIu64 " data dropped", atomic_load(&run.dropped_cnt));
+	TEST_CHECK(scq_size_approx(run.scq) == 0,
+		"size %" PRIu64 " after the drain", scq_size_approx(run.scq));
+
+	if (ok && tc->check != NULL) {
+		ok = tc->check(tc, &run);
+	}
+
+	scq_destroy(run.scq);
+	free(run.seen);
+
+	return ok;
+}
+
+int test_run_cases(const struct test_case *cases, int case_num)
+{
+	int failed = 0;
+
+	for (int i = 0; i < case_num; i++) {
+		failed += test_report(cases[i].name, test_run_case(&cases[i]));
+	}
+
+	return failed;
+}
+
+int test_report(const char *name, bool ok)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+	fflush(stdout);
+
+	return !ok;
+}
+
+int test_finish(int failed)
+{
+	if (failed) {
+		printf("%d test(s) failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
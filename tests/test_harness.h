@@ -0,0 +1,98 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../scalable_queue.h"
+
+/*
+ * Functional test harness of scalable_queue.
+ *
+ * Producers enqueue (producer << 32 | sequence) and consumers mark what they
+ * take, so every datum must show up exactly once, either dequeued or handed to
+ * drop_func. Where the engine keeps each producer's order, every consumer must
+ * also see each producer's sequence numbers increase.
+ *
+ * Each test_*.c is its own binary, built with -fsanitize=address,undefined by
+ * 'make test'.
+ */
+
+#define TEST_MAX_THREAD_NUM (16)
+
+struct test_run;
+
+/*
+ * test_case - One queue configuration
+ * @ctx: given to scq_init_ex(), drop_func and drop_arg are set by the test
+ * @item_num: data enqueued by each producer
+ * @use_try: enqueue with scq_try_enqueue(), retrying while it fails
+ * @use_key: enqueue with scq_enqueue_key(), the datum being the key
+ * @ordered: the engine keeps each producer's order per consumer
+ * @may_drop: the overflow policy may discard data
+ * @drain_after: start the consumers only once the producers are done
+ * @check: what the feature under test reports once every datum is taken,
+ *	may be NULL
+ */
+struct test_case {
+	const char *name;
+	struct scq_init_context ctx;
+	int producer_num;
+	int consumer_num;
+	uint64_t item_num;
+	bool use_try;
+	bool use_key;
+	bool ordered;
+	bool may_drop;
+	bool drain_after;
+	bool (*check)(const struct test_case *tc, struct test_run *run);
+};
+
+/*
+ * test_run - Shared state of one case
+ * @seen: one flag per datum, set when it is dequeued or dropped
+ * @taken_cnt: data dequeued or dropped so far
+ */
+struct test_run {
+	const struct test_case *tc;
+	struct scalable_queue *scq;
+	_Atomic uint8_t *seen;
+	_Atomic uint64_t taken_cnt;
+	_Atomic uint64_t delivered_cnt;
+	_Atomic uint64_t dropped_cnt;
+	_Atomic uint64_t duplicate_cnt;
+	_Atomic uint64_t corrupt_cnt;
+	_Atomic uint64_t disorder_cnt;
+	_Atomic uint64_t enqueue_fail_cnt;
+};
+
+/* Report a failed condition of the case @tc and clear the local @ok */
+#define TEST_CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "  %s: ", tc->name); \
+			fprintf(stderr, __VA_ARGS__); \
+			fprintf(stderr, "\n"); \
+			ok = false; \
+		} \
+	} while (0)
+
+#define TEST_CASE_NUM(cases) ((int)(sizeof(cases) / sizeof((cases)[0])))
+
+uint64_t test_total(const struct test_case *tc);
+
+bool test_run_case(const struct test_case *tc);
+
+/* Run the cases in order, returns the number that failed */
+int test_run_cases(const struct test_case *cases, int case_num);
+
+/* Print the result line of a test, returns 1 if it failed */
+int test_report(const char *name, bool ok);
+
+/* Print the summary, returns the exit status of the binary */
+int test_finish(int failed);
+
+#endif /* TEST_HARNESS_H */
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+
+#include "test_harness.h"
+
+/*
+ * Latency sampling: every latency_sample_rate'th enqueue of each thread
+ * carries a TSC stamp in its node, and the dequeue thread that pops it adds
+ * its time in the queue to a histogram.
+ */
+
+static bool test_check_latency(const struct test_case *tc,
+	struct test_run *run)
+{
+	uint64_t sample_num = (uint64_t)tc->producer_num
+		* (tc->item_num / tc->ctx.latency_sample_rate);
+	struct scq_latency_hist *hist;
+	bool ok = true;
+
+	hist = calloc(1, sizeof(struct scq_latency_hist));
+	TEST_CHECK(hist != NULL && scq_get_latency_hist(run->scq, hist),
+		"no latency histogram");
+
+	/* No sample is ever skipped */
+	if (ok) {
+		TEST_CHECK(hist->sample_cnt == sample_num,
+			"%" PRIu64 " latency samples, expected %" PRIu64,
+			hist->sample_cnt, sample_num);
+	}
+	free(hist);
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "latency-sampling", .ctx = { .latency_sample_rate = 16 },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true, .check = test_check_latency },
+	{ .name = "latency-sampling-drain-after",
+		.ctx = { .latency_sample_rate = 16 }, .producer_num = 4,
+		.consumer_num = 2, .item_num = 20000, .ordered = true,
+		.drain_after = true, .check = test_check_latency },
+	{ .name = "latency-sampling-arena", .ctx = { .flags = SCQ_FLAG_NUMA_ARENA,
+		.latency_sample_rate = 7 }, .producer_num = 4, .consumer_num = 4,
+		.item_num = 20000, .ordered = true, .check = test_check_latency },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
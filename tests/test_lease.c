@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_LANE_LEASE: dequeue threads lease lanes and steal them only from
+ * idle or lagging owners, so a lane must never be stranded behind its lease.
+ */
+
+static void *test_lease_take_one(void *arg)
+{
+	uint64_t datum;
+
+	while (!scq_dequeue(arg, &datum)) {
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+/*
+ * A dequeue thread leases the lane and exits. Whatever is enqueued into the
+ * lane afterwards must still reach the other dequeue threads, once the lease
+ * has been idle for SCQ_LEASE_IDLE_NS.
+ */
+static bool test_lease_abandoned(void)
+{
+	struct scq_init_context ctx = { .flags = SCQ_FLAG_LANE_LEASE };
+	struct scalable_queue *scq = scq_init_ex(&ctx);
+	uint64_t datum, taken = 0;
+	struct timespec start, now;
+	pthread_t thread;
+	bool ok = true;
+
+	if (scq == NULL) {
+		fprintf(stderr, "  lane-lease-abandoned: init failed\n");
+		return false;
+	}
+
+	scq_enqueue(scq, 0);
+	pthread_create(&thread, NULL, test_lease_take_one, scq);
+	pthread_join(thread, NULL);
+
+	for (uint64_t i = 1; i <= 100; i++) {
+		scq_enqueue(scq, i);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (taken < 100) {
+		if (scq_dequeue(scq, &datum)) {
+			taken++;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - start.tv_sec > 5) {
+			fprintf(stderr, "  lane-lease-abandoned: %" PRIu64
+				" of 100 taken\n", taken);
+			ok = false;
+			break;
+		}
+		sched_yield();
+	}
+
+	scq_destroy(scq);
+
+	return ok;
+}
+static const struct test_case test_cases[] = {
+	{ .name = "lane-lease", .ctx = { .flags = SCQ_FLAG_LANE_LEASE },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true },
+	{ .name = "lane-lease-few-consumers",
+		.ctx = { .flags = SCQ_FLAG_LANE_LEASE }, .producer_num = 8,
+		.consumer_num = 2, .item_num = 10000, .ordered = true },
+	{ .name = "lane-lease-drain-after",
+		.ctx = { .flags = SCQ_FLAG_LANE_LEASE }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .ordered = true,
+		.drain_after = true },
+};
+
+int main(void)
+{
+	int failed = test_run_cases(test_cases, TEST_CASE_NUM(test_cases));
+
+	failed += test_report("lane-lease-abandoned", test_lease_abandoned());
+
+	return test_finish(failed);
+}
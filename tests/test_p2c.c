@@ -0,0 +1,25 @@
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_SCAN_P2C: dequeue threads pick the busier of two sampled lanes and
+ * fall back to a scan from a random start, so no lane may be left behind.
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "scan-p2c", .ctx = { .flags = SCQ_FLAG_SCAN_P2C },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true },
+	{ .name = "scan-p2c-one-consumer",
+		.ctx = { .flags = SCQ_FLAG_SCAN_P2C }, .producer_num = 8,
+		.consumer_num = 1, .item_num = 10000, .ordered = true },
+	{ .name = "scan-p2c-drain-after",
+		.ctx = { .flags = SCQ_FLAG_SCAN_P2C }, .producer_num = 4,
+		.consumer_num = 4, .item_num = 20000, .ordered = true,
+		.drain_after = true },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
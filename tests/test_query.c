@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <time.h>
+
+#include "test_harness.h"
+
+/*
+ * Monitoring queries: scq_size_approx(), scq_lane_num(), scq_lane_backlog()
+ * and scq_oldest_age_ns(). A single thread enqueues and dequeues, so nothing
+ * moves while they are read and the results are exact.
+ */
+
+#define TEST_QUERY_ITEM_NUM (100)
+#define TEST_QUERY_POP_NUM (40)
+
+/* Long enough for several ticks of the coarse clock */
+#define TEST_QUERY_WAIT_NS ((uint64_t)20000000)
+
+static bool test_query_relaxed(void)
+{
+	struct timespec wait = { 0, (long)TEST_QUERY_WAIT_NS };
+	struct scalable_queue *scq;
+	uint64_t left = TEST_QUERY_ITEM_NUM - TEST_QUERY_POP_NUM;
+	uint64_t datum, value;
+	bool ok = true;
+
+	scq = scq_init();
+	if (scq == NULL) {
+		fprintf(stderr, "  query_relaxed: init failed\n");
+		return false;
+	}
+
+	value = scq_oldest_age_ns(scq);
+	if (scq_size_approx(scq) != 0 || value != 0) {
+		fprintf(stderr, "  query_relaxed: new queue has size %" PRIu64
+			", age %" PRIu64 "\n", scq_size_approx(scq), value);
+		ok = false;
+	}
+
+	for (uint64_t i = 0; i < TEST_QUERY_ITEM_NUM; i++) {
+		scq_enqueue(scq, i);
+	}
+
+	if (scq_lane_num(scq) != 1) {
+		fprintf(stderr, "  query_relaxed: %d lanes\n", scq_lane_num(scq));
+		ok = false;
+	}
+
+	value = scq_size_approx(scq);
+	if (value != TEST_QUERY_ITEM_NUM) {
+		fprintf(stderr, "  query_relaxed: size %" PRIu64 " after enqueue\n",
+			value);
+		ok = false;
+	}
+
+	value = scq_lane_backlog(scq, 0);
+	if (value != TEST_QUERY_ITEM_NUM || scq_lane_backlog(scq, 1) != 0 ||
+			scq_lane_backlog(scq, -1) != 0) {
+		fprintf(stderr, "  query_relaxed: lane backlog %" PRIu64 "\n", value);
+		ok = false;
+	}
+
+	nanosleep(&wait, NULL);
+
+	value = scq_oldest_age_ns(scq);
+	if (value < TEST_QUERY_WAIT_NS / 2) {
+		fprintf(stderr, "  query_relaxed: age %" PRIu64 " after %" PRIu64
+			" ns\n", value, TEST_QUERY_WAIT_NS);
+		ok = false;
+	}
+
+	for (int i = 0; i < TEST_QUERY_POP_NUM; i++) {
+		scq_dequeue(scq, &datum);
+	}
+
+	/* The detached batch counts in the lane until it is used up */
+	value = scq_size_approx(scq);
+	if (value != left) {
+		fprintf(stderr, "  query_relaxed: size %" PRIu64 ", expected %"
+			PRIu64 "\n", value, left);
+		ok = false;
+	}
+
+	value = scq_lane_backlog(scq, 0);
+	if (value < left) {
+		fprintf(stderr, "  query_relaxed: lane backlog %" PRIu64
+			" below %" PRIu64 "\n", value, left);
+		ok = false;
+	}
+
+	if (scq_oldest_age_ns(scq) == 0) {
+		fprintf(stderr, "  query_relaxed: no age with data left\n");
+		ok = false;
+	}
+
+	while (scq_dequeue(scq, &datum)) {
+	}
+
+	value = scq_oldest_age_ns(scq);
+	if (scq_size_approx(scq) != 0 || scq_lane_backlog(scq, 0) != 0 ||
+			value != 0) {
+		fprintf(stderr, "  query_relaxed: drained queue has size %" PRIu64
+			", age %" PRIu64 "\n", scq_size_approx(scq), value);
+		ok = false;
+	}
+
+	scq_destroy(scq);
+
+	return ok;
+}
+
+/*
+ * The ring engines have no lanes and report their size as lane 0.
+ */
+static bool test_query_ring(void)
+{
+	struct scq_init_context ctx;
+	struct scalable_queue *scq;
+	uint64_t datum, value;
+	bool ok = true;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.flags = SCQ_FLAG_BOUNDED_RING;
+	ctx.capacity = 1024;
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  query_ring: init failed\n");
+		return false;
+	}
+
+	for (uint64_t i = 0; i < TEST_QUERY_ITEM_NUM; i++) {
+		scq_enqueue(scq, i);
+	}
+	for (int i = 0; i < TEST_QUERY_POP_NUM; i++) {
+		scq_dequeue(scq, &datum);
+	}
+
+	value = scq_size_approx(scq);
+	if (value != TEST_QUERY_ITEM_NUM - TEST_QUERY_POP_NUM ||
+			scq_lane_backlog(scq, 0) != value ||
+			scq_lane_backlog(scq, 1) != 0) {
+		fprintf(stderr, "  query_ring: size %" PRIu64 ", lane backlog %"
+			PRIu64 "\n", value, scq_lane_backlog(scq, 0));
+		ok = false;
+	}
+
+	if (scq_oldest_age_ns(scq) != 0) {
+		fprintf(stderr, "  query_ring: age reported\n");
+		ok = false;
+	}
+
+	scq_destroy(scq);
+
+	return ok;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	failed += test_report("query-relaxed", test_query_relaxed());
+	failed += test_report("query-ring", test_query_ring());
+
+	return test_finish(failed);
+}
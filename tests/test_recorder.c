@@ -0,0 +1,38 @@
+#include <unistd.h>
+
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_FLIGHT_RECORDER: recent events of every thread, written out by
+ * scq_dump_recorder().
+ */
+
+static bool test_check_recorder(const struct test_case *tc,
+	struct test_run *run)
+{
+	bool ok = true;
+	FILE *fp;
+
+	fp = tmpfile();
+	TEST_CHECK(fp != NULL, "tmpfile failed");
+	if (fp != NULL) {
+		scq_dump_recorder(run->scq, fileno(fp));
+		TEST_CHECK(lseek(fileno(fp), 0, SEEK_END) > 0,
+			"flight recorder dump is empty");
+		fclose(fp);
+	}
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "flight-recorder", .ctx = { .flags = SCQ_FLAG_FLIGHT_RECORDER },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true, .check = test_check_recorder },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
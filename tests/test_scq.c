@@ -0,0 +1,22 @@
+#include "test_harness.h"
+
+/*
+ * The default relaxed engine without any flag, the other engines and flags
+ * have a binary of their own.
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "relaxed", .producer_num = 4, .consumer_num = 4,
+		.item_num = 20000, .ordered = true },
+	{ .name = "relaxed-1p1c", .producer_num = 1, .consumer_num = 1,
+		.item_num = 100000, .ordered = true },
+	{ .name = "relaxed-drain-after", .producer_num = 4, .consumer_num = 2,
+		.item_num = 20000, .ordered = true, .drain_after = true },
+};
+
+int main(void)
+{
+	int failed = test_run_cases(test_cases, TEST_CASE_NUM(test_cases));
+
+	return test_finish(failed);
+}
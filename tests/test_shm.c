@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test_harness.h"
+#include "../scq_shm.h"
+
+/*
+ * Statistics exported to a shm_open() segment by @stats_shm_name.
+ */
+
+/*
+ * The segment is created by scq_init_ex() and unlinked by scq_destroy().
+ */
+static bool test_stats_shm(void)
+{
+	struct scq_init_context ctx;
+	struct scalable_queue *scq;
+	char name[64];
+	uint64_t datum;
+	bool ok = true;
+	int fd;
+
+	snprintf(name, sizeof(name), "/scq_test.%d", (int)getpid());
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.stats_shm_name = name;
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  stats_shm: init failed\n");
+		return false;
+	}
+
+	if (!scq_enqueue(scq, 1) || !scq_dequeue(scq, &datum) || datum != 1) {
+		fprintf(stderr, "  stats_shm: datum lost\n");
+		ok = false;
+	}
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "  stats_shm: segment missing\n");
+		ok = false;
+	} else {
+		close(fd);
+	}
+
+	scq_destroy(scq);
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd >= 0) {
+		fprintf(stderr, "  stats_shm: segment not unlinked\n");
+		close(fd);
+		ok = false;
+	}
+
+	return ok;
+}
+
+/*
+ * A name used by a live queue is refused, and free again once it is gone.
+ */
+static bool test_stats_shm_in_use(void)
+{
+	struct scq_init_context ctx;
+	struct scalable_queue *scq, *other;
+	char name[64];
+	bool ok = true;
+
+	snprintf(name, sizeof(name), "/scq_test_in_use.%d", (int)getpid());
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.stats_shm_name = name;
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  stats_shm_in_use: init failed\n");
+		return false;
+	}
+
+	other = scq_init_ex(&ctx);
+	if (other != NULL) {
+		fprintf(stderr, "  stats_shm_in_use: name taken twice\n");
+		scq_destroy(other);
+		ok = false;
+	}
+
+	scq_destroy(scq);
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  stats_shm_in_use: name not free after destroy\n");
+		return false;
+	}
+	scq_destroy(scq);
+
+	return ok;
+}
+
+/*
+ * Write a complete segment owned by @pid under @name, as a crashed queue would
+ * leave it.
+ */
+static bool test_shm_leave(const char *name, pid_t pid)
+{
+	struct scq_shm_header *header;
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	if (ftruncate(fd, SCQ_SHM_SIZE) != 0) {
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+
+	header = mmap(NULL, SCQ_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+
+	if (header == MAP_FAILED) {
+		shm_unlink(name);
+		return false;
+	}
+
+	header->version = SCQ_SHM_VERSION;
+	header->pid = (int32_t)pid;
+	atomic_store(&header->magic, SCQ_SHM_MAGIC);
+	munmap(header, SCQ_SHM_SIZE);
+
+	return true;
+}
+
+/*
+ * The segment of a process that has exited is replaced, the segment of a live
+ * one or a file that is not a segment is not.
+ */
+static bool test_stats_shm_stale(void)
+{
+	struct scq_init_context ctx;
+	struct scalable_queue *scq;
+	char name[64];
+	bool ok = true;
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid == 0) {
+		_exit(0);
+	}
+	if (pid < 0 || waitpid(pid, NULL, 0) != pid) {
+		fprintf(stderr, "  stats_shm_stale: fork failed\n");
+		return false;
+	}
+
+	snprintf(name, sizeof(name), "/scq_test_stale.%d", (int)getpid());
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.stats_shm_name = name;
+
+	if (!test_shm_leave(name, pid)) {
+		fprintf(stderr, "  stats_shm_stale: cannot create segment\n");
+		return false;
+	}
+
+	scq = scq_init_ex(&ctx);
+	if (scq == NULL) {
+		fprintf(stderr, "  stats_shm_stale: dead process keeps the name\n");
+		shm_unlink(name);
+		return false;
+	}
+	scq_destroy(scq);
+
+	if (test_shm_leave(name, getpid())) {
+		scq = scq_init_ex(&ctx);
+		if (scq != NULL) {
+			fprintf(stderr, "  stats_shm_stale: live segment replaced\n");
+			scq_destroy(scq);
+			ok = false;
+		}
+		shm_unlink(name);
+	}
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd != -1) {
+		close(fd);
+		scq = scq_init_ex(&ctx);
+		if (scq != NULL) {
+			fprintf(stderr, "  stats_shm_stale: foreign file replaced\n");
+			scq_destroy(scq);
+			ok = false;
+		}
+		shm_unlink(name);
+	}
+
+	return ok;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	failed += test_report("stats-shm", test_stats_shm());
+	failed += test_report("stats-shm-in-use", test_stats_shm_in_use());
+	failed += test_report("stats-shm-stale", test_stats_shm_stale());
+
+	return test_finish(failed);
+}
@@ -0,0 +1,27 @@
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_SPSC and SCQ_FLAG_MPSC: one unbounded ring, or one per enqueue
+ * thread, read by a single dequeue thread.
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "spsc", .ctx = { .flags = SCQ_FLAG_SPSC },
+		.producer_num = 1, .consumer_num = 1, .item_num = 100000,
+		.ordered = true },
+	{ .name = "mpsc", .ctx = { .flags = SCQ_FLAG_MPSC },
+		.producer_num = 4, .consumer_num = 1, .item_num = 20000,
+		.ordered = true },
+	{ .name = "spsc-drain-after", .ctx = { .flags = SCQ_FLAG_SPSC },
+		.producer_num = 1, .consumer_num = 1, .item_num = 50000,
+		.ordered = true, .drain_after = true },
+	{ .name = "mpsc-many-producers", .ctx = { .flags = SCQ_FLAG_MPSC },
+		.producer_num = 12, .consumer_num = 1, .item_num = 10000,
+		.ordered = true },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
@@ -0,0 +1,21 @@
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_SPSC_MATRIX: one SPSC ring per enqueue and dequeue thread pair,
+ * picked round-robin by scq_enqueue() and by key by scq_enqueue_key().
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "spsc-matrix", .ctx = { .flags = SCQ_FLAG_SPSC_MATRIX,
+		.consumer_num = 3 }, .producer_num = 4, .consumer_num = 3,
+		.item_num = 20000, .ordered = true },
+	{ .name = "spsc-matrix-key", .ctx = { .flags = SCQ_FLAG_SPSC_MATRIX,
+		.consumer_num = 3 }, .producer_num = 4, .consumer_num = 3,
+		.item_num = 20000, .use_key = true, .ordered = true },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
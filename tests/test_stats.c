@@ -0,0 +1,35 @@
+#include "test_harness.h"
+
+/*
+ * Per-queue statistics summed by scq_get_stats().
+ */
+
+static bool test_check_stats(const struct test_case *tc,
+	struct test_run *run)
+{
+	struct scq_stats stats;
+	bool ok = true;
+
+	/* Compiled out by -DSCQ_NO_STATS */
+	if (!scq_get_stats(run->scq, &stats)) {
+		return true;
+	}
+
+	TEST_CHECK(stats.enqueue_cnt == test_total(tc),
+		"stats count %" PRIu64 " enqueues", stats.enqueue_cnt);
+	TEST_CHECK(stats.dequeue_cnt == test_total(tc),
+		"stats count %" PRIu64 " dequeues", stats.dequeue_cnt);
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "stats", .producer_num = 4, .consumer_num = 4,
+		.item_num = 20000, .ordered = true, .check = test_check_stats },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
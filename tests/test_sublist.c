@@ -0,0 +1,24 @@
+#include "test_harness.h"
+
+/*
+ * sublist_num: each lane is striped over several sublists that dequeue threads
+ * detach separately, so a producer's order only holds within a sublist.
+ */
+
+static const struct test_case test_cases[] = {
+	{ .name = "relaxed-sublists", .ctx = { .sublist_num = 4 },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000 },
+	{ .name = "sublists-drain-after", .ctx = { .sublist_num = 4 },
+		.producer_num = 4, .consumer_num = 2, .item_num = 20000,
+		.drain_after = true },
+	{ .name = "sublists-max", .ctx = { .sublist_num = 64 },
+		.producer_num = 2, .consumer_num = 4, .item_num = 20000 },
+	{ .name = "sublists-over-max", .ctx = { .sublist_num = 1000 },
+		.producer_num = 2, .consumer_num = 4, .item_num = 20000 },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+
+#include "test_harness.h"
+
+/*
+ * SCQ_FLAG_TRANSFER_MATRIX: batches and data counted per dequeue and enqueue
+ * thread pair, read back with scq_get_transfer_matrix().
+ */
+
+static bool test_check_transfer_matrix(const struct test_case *tc,
+	struct test_run *run)
+{
+	struct scq_transfer_cell *matrix;
+	uint64_t item_cnt = 0;
+	int lane_num, lane_max = 2 * TEST_MAX_THREAD_NUM;
+	bool ok = true;
+
+	matrix = calloc((size_t)lane_max * lane_max,
+		sizeof(struct scq_transfer_cell));
+	if (matrix == NULL) {
+		fprintf(stderr, "  %s: out of memory\n", tc->name);
+		return false;
+	}
+
+	lane_num = scq_get_transfer_matrix(run->scq, matrix, lane_max);
+	TEST_CHECK(lane_num > 0 && lane_num <= lane_max,
+		"transfer matrix has %d lanes", lane_num);
+
+	for (int i = 0; i < lane_max * lane_max; i++) {
+		item_cnt += matrix[i].item_cnt;
+	}
+	TEST_CHECK(item_cnt == atomic_load(&run->delivered_cnt),
+		"transfer matrix counts %" PRIu64 " of %" PRIu64 " data", item_cnt,
+		atomic_load(&run->delivered_cnt));
+	free(matrix);
+
+	return ok;
+}
+
+static const struct test_case test_cases[] = {
+	{ .name = "transfer-matrix", .ctx = { .flags = SCQ_FLAG_TRANSFER_MATRIX },
+		.producer_num = 4, .consumer_num = 4, .item_num = 20000,
+		.ordered = true, .check = test_check_transfer_matrix },
+};
+
+int main(void)
+{
+	return test_finish(test_run_cases(test_cases,
+		TEST_CASE_NUM(test_cases)));
+}